@@ -1,13 +1,90 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
 #include <malloc.h>
 #include <termios.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #define ECHOFLAGS (ECHO | ECHOE | ECHOK | ECHONL)
 
 #include "client.h"
+#include "../reference-monitor/refmon_ioctl.h"
+
+/*
+ * The reference monitor is controlled through /dev/refmon when the device exists, its ioctl numbers
+ * do not depend on the syscall table; otherwise the syscalls installed in the table are used.
+ */
+static int refmon_fd = -2;
+
+int refmon_device()
+{
+    if (refmon_fd == -2)
+    {
+        refmon_fd = open(REFMON_DEVICE, O_RDWR | O_CLOEXEC);
+    }
+
+    return refmon_fd;
+}
+
+// status page of the device mapped read-only, NULL if it cannot be mapped
+static const volatile struct refmon_shared *refmon_page = MAP_FAILED;
+
+const volatile struct refmon_shared *refmon_shared()
+{
+    if (refmon_page == MAP_FAILED && refmon_device() >= 0)
+    {
+        refmon_page = mmap(NULL, sizeof(struct refmon_shared), PROT_READ, MAP_SHARED, refmon_device(), 0);
+    }
+
+    return refmon_page == MAP_FAILED ? NULL : refmon_page;
+}
+
+// copy a consistent snapshot of the status page without any syscall, -1 if the page is not available
+int refmon_read_shared(struct refmon_shared *copy)
+{
+    const volatile struct refmon_shared *page = refmon_shared();
+    uint32_t seq;
+
+    if (page == NULL)
+    {
+        return -1;
+    }
+
+    do
+    {
+        seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+        {
+            continue;
+        }
+        memcpy(copy, (const void *)page, sizeof(*copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || __atomic_load_n(&page->seq, __ATOMIC_RELAXED) != seq);
+
+    return 0;
+}
+
+// add or remove a path through the device, returning -1 (errno set) or the number of paths applied
+int refmon_edit_rule(unsigned long cmd, char *path, char *password)
+{
+    struct refmon_batch_req req;
+
+    memset(&req, 0, sizeof(req));
+    strncpy(req.credentials, password, REFMON_SECRET_LEN - 1);
+    req.paths = (uintptr_t)path;
+    req.len = strlen(path) + 1;
+
+    if (ioctl(refmon_device(), cmd, &req) == -1)
+    {
+        return -1;
+    }
+
+    return req.applied;
+}
 
 int change_state(int rf_state, char *password)
 {
@@ -19,7 +96,19 @@ int change_state(int rf_state, char *password)
         return EXIT_FAILURE;
     }
 
-    ret = syscall(SWITCH_STATE, rf_state, password);
+    if (refmon_device() >= 0)
+    {
+        struct refmon_state_req req;
+
+        memset(&req, 0, sizeof(req));
+        req.state = rf_state;
+        strncpy(req.password, password, REFMON_SECRET_LEN - 1);
+        ret = ioctl(refmon_device(), REFMON_IOC_SET_STATE, &req);
+    }
+    else
+    {
+        ret = syscall(SWITCH_STATE, rf_state, password);
+    }
     if (ret == -1)
     {
         if (errno == EACCES)
@@ -66,8 +155,26 @@ int get_rf_state()
 {
     int ret = 0;
     char state_string[16];
+    struct refmon_shared shared;
+
+    if (refmon_read_shared(&shared) == 0)
+    {
+        ret = shared.state;
+    }
+    else if (refmon_device() >= 0)
+    {
+        int state;
 
-    ret = syscall(GET_RF_STATE);
+        ret = ioctl(refmon_device(), REFMON_IOC_GET_STATE, &state);
+        if (ret == 0)
+        {
+            ret = state;
+        }
+    }
+    else
+    {
+        ret = syscall(GET_RF_STATE);
+    }
     if (ret == -1)
     {
 
@@ -103,7 +210,19 @@ int add_to_blacklist(char *path, char *password)
 {
     int ret = 0;
 
-    ret = syscall(ADD_TO_BLACKLIST, path, password);
+    if (refmon_device() >= 0)
+    {
+        ret = refmon_edit_rule(REFMON_IOC_ADD_RULES, path, password);
+        if (ret == 0)
+        {
+            errno = EEXIST;
+            ret = -1;
+        }
+    }
+    else
+    {
+        ret = syscall(ADD_TO_BLACKLIST, path, password);
+    }
     if (ret == -1)
     {
 
@@ -121,7 +240,19 @@ int remove_from_blacklist(char *path, char *password)
 {
     int ret = 0;
 
-    ret = syscall(REMOVE_FROM_BLACKLIST, path, password);
+    if (refmon_device() >= 0)
+    {
+        // a path that is not blacklisted is not applied, as the syscall returns 1 for it
+        ret = refmon_edit_rule(REFMON_IOC_REMOVE_RULES, path, password);
+        if (ret != -1)
+        {
+            ret = !ret;
+        }
+    }
+    else
+    {
+        ret = syscall(REMOVE_FROM_BLACKLIST, path, password);
+    }
     if (ret == -1)
     {
 
@@ -143,33 +274,67 @@ int remove_from_blacklist(char *path, char *password)
 
 void print_blacklist()
 {
-    int ret = 0;
     char *blacklist;
-    int blacklist_size;
+    unsigned long cursor = 0;
+    uint32_t len;
+    long ret, i;
+    char *entry;
 
-    ret = syscall(GET_BLACKLIST_SIZE);
-    if (ret == -1)
+    blacklist = (char *)malloc(DUMP_BUFFER_SIZE);
+    if (!blacklist)
     {
-
         printf("%s: Unexpected error\n", strerror(errno));
-
         return;
     }
 
-    blacklist_size = ret;
-
-    blacklist = (char *)malloc(sizeof(char) * blacklist_size * 4096);
-
-    ret = syscall(PRINT_BLACKLIST, blacklist, blacklist_size);
-    if (ret == -1)
+    printf("Blacklist elements\n");
+    for (;;)
     {
+        if (refmon_device() >= 0)
+        {
+            struct refmon_dump_req req;
 
-        printf("%s: Unexpected error\n", strerror(errno));
+            req.buf = (uintptr_t)blacklist;
+            req.len = DUMP_BUFFER_SIZE;
+            req.cursor = cursor;
+            ret = ioctl(refmon_device(), REFMON_IOC_DUMP, &req);
+            if (ret == 0)
+            {
+                cursor = req.cursor;
+                ret = req.count;
+            }
+        }
+        else
+        {
+            ret = syscall(DUMP_BLACKLIST, blacklist, DUMP_BUFFER_SIZE, &cursor);
+        }
+        if (ret == -1 && errno == ESTALE)
+        {
+            // the blacklist changed while listing it, start again
+            printf("Blacklist changed, listing it again\n");
+            cursor = 0;
+            continue;
+        }
+        if (ret == -1)
+        {
+            printf("%s: Unexpected error\n", strerror(errno));
+            break;
+        }
+        if (ret == 0)
+        {
+            break;
+        }
 
-        return;
+        entry = blacklist;
+        for (i = 0; i < ret; i++)
+        {
+            memcpy(&len, entry, BLACKLIST_ENTRY_HEADER);
+            printf("- %.*s\n", (int)len, entry + BLACKLIST_ENTRY_HEADER);
+            entry += BLACKLIST_ENTRY_HEADER + len;
+        }
     }
 
-    printf("%s", blacklist);
+    free(blacklist);
     return;
 }
 
@@ -441,6 +606,73 @@ ssize_t getpasswd(char **pw, size_t sz, int mask, FILE *fp)
     return idx; /* number of chars in passwd    */
 }
 
+// read the password from a file (first line) or from REFMON_PASSWORD, NULL if none is given
+char *sync_password(const char *file, char *buf, size_t size)
+{
+    FILE *fp;
+    size_t len;
+
+    if (file == NULL)
+    {
+        return getenv("REFMON_PASSWORD");
+    }
+
+    fp = fopen(file, "r");
+    if (!fp || !fgets(buf, size, fp))
+    {
+        fprintf(stderr, "Cannot read the password from %s\n", file);
+        if (fp)
+        {
+            fclose(fp);
+        }
+        return NULL;
+    }
+    fclose(fp);
+
+    len = strcspn(buf, "\r\n");
+    buf[len] = '\0';
+    return buf;
+}
+
+int sync_main(int argc, char **argv)
+{
+    char password[MAX_PASS_LEN + 2];
+    const char *rules_file = NULL, *password_file = NULL;
+    int dry_run = 0;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--sync") == 0 && i + 1 < argc)
+        {
+            rules_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--password-file") == 0 && i + 1 < argc)
+        {
+            password_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--dry-run") == 0)
+        {
+            dry_run = 1;
+        }
+        else
+        {
+            rules_file = NULL;
+            break;
+        }
+    }
+
+    if (rules_file == NULL)
+    {
+        fprintf(stderr, "Usage: %s [--sync <rules file> [--password-file <file>] [--dry-run]]\n"
+                        "  without arguments the interactive menu is shown; the password can also be given in REFMON_PASSWORD\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    return sync_rules(rules_file, sync_password(password_file, password, sizeof(password)), dry_run);
+}
+
 int main(int argc, char **argv)
 {
     int ret;
@@ -454,6 +686,12 @@ int main(int argc, char **argv)
     FILE *fp = stdin;
     ssize_t nchr = 0;
 
+    // non-interactive mode: client --sync <rules file> [--password-file <file>] [--dry-run]
+    if (argc > 1)
+    {
+        return sync_main(argc, argv);
+    }
+
 MODULE_INFO_DISPLAY:
     mod_info = (struct mod_info *)malloc(sizeof(struct mod_info));
 
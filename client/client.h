@@ -7,14 +7,16 @@
 #define GET_RF_STATE            156
 #define ADD_TO_BLACKLIST        174
 #define REMOVE_FROM_BLACKLIST   177
-#define PRINT_BLACKLIST         178
+#define DUMP_BLACKLIST          178
 #define GET_BLACKLIST_SIZE      180
+#define OPEN_REC_SESSION        181
 #else
 #define GET_RF_STATE            174
 #define ADD_TO_BLACKLIST        177
 #define REMOVE_FROM_BLACKLIST   178
-#define PRINT_BLACKLIST         180
+#define DUMP_BLACKLIST          180
 #define GET_BLACKLIST_SIZE      181
+#define OPEN_REC_SESSION        182
 #endif
 
 
@@ -46,4 +48,14 @@
 typedef struct mod_info{
     int mod_number;
     char command[16];
-}mod_info;
\ No newline at end of file
+}mod_info;
+
+// Reconfiguration session tokens (see OPEN_REC_SESSION) are at most REC_TOKEN_LEN bytes, NUL included
+#define REC_TOKEN_LEN   26
+
+// Entries filled by DUMP_BLACKLIST: a 32 bit length followed by the path, without NUL terminator nor padding
+#define BLACKLIST_ENTRY_HEADER  4
+#define DUMP_BUFFER_SIZE        65536
+
+int refmon_device();
+int sync_rules(const char *rules_file, const char *password, int dry_run);
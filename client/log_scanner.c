@@ -0,0 +1,908 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#include "../log-filesystem/file_system.h"
+
+/*
+ * Offline scanner of the reference monitor log. The input is either a copy of ref_monitor_log.txt or
+ * the image of a singlefilefs device (the raw device itself, or a file written by ONEFILEFS_IOC_DUMP):
+ * it is mapped in memory and split into spans that never cut a record (the data blocks of an image,
+ * newline aligned chunks of a text file). Spans are parsed by one thread per core, each thread
+ * aggregating into its own tables, merged once all the threads are done.
+ *
+ * Usage: log_scanner [-t threads] [-n top] [--tgid N] [--uid N] [--since T] [--until T] [--print] <file>
+ */
+
+#define DEFAULT_TOP 10
+#define MAX_THREADS 256
+// text files are split into this many spans per thread, so that short and long lines even out
+#define SPANS_PER_THREAD 8
+#define NO_FILTER UINT64_MAX
+
+struct span
+{
+    const char *data;
+    size_t len;
+    // compressed images: the frame to decode into data before parsing it
+    const struct onefilefs_frame_header *frame;
+};
+
+struct filter
+{
+    uint64_t tgid;
+    uint64_t uid;
+    uint64_t since;
+    uint64_t until;
+};
+
+struct record
+{
+    uint64_t timestamp;
+    uint64_t tid;
+    uint64_t tgid;
+    uint64_t uid;
+    uint64_t euid;
+    const char *exe;
+    size_t exe_len;
+};
+
+// open addressing table counting either strings (key != NULL) or integers (value)
+struct counter
+{
+    const char *key;
+    size_t len;
+    uint64_t value;
+    uint64_t count;
+};
+
+struct table
+{
+    struct counter *slots;
+    size_t capacity;
+    size_t used;
+};
+
+struct worker
+{
+    pthread_t thread;
+    const struct filter *filter;
+    struct span *spans;
+    size_t first;
+    size_t last;
+    int print;
+    int has_timestamps;
+    uint64_t records;
+    uint64_t matching;
+    uint64_t malformed;
+    uint64_t corrupted;
+    struct table exes;
+    struct table uids;
+    struct table minutes;
+    char *out;
+    size_t out_len;
+    size_t out_cap;
+};
+
+static uint64_t hash_bytes(const char *key, size_t len)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)key[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+static uint64_t hash_value(uint64_t value)
+{
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+
+    return value;
+}
+
+static void table_add(struct table *table, const char *key, size_t len, uint64_t value, uint64_t count);
+
+static void table_grow(struct table *table)
+{
+    struct counter *old = table->slots;
+    size_t old_capacity = table->capacity;
+    size_t i;
+
+    table->capacity = old_capacity ? old_capacity * 2 : 64;
+    table->slots = calloc(table->capacity, sizeof(*table->slots));
+    if (!table->slots)
+    {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    table->used = 0;
+
+    for (i = 0; i < old_capacity; i++)
+    {
+        if (old[i].count)
+            table_add(table, old[i].key, old[i].len, old[i].value, old[i].count);
+    }
+    free(old);
+}
+
+static void table_add(struct table *table, const char *key, size_t len, uint64_t value, uint64_t count)
+{
+    struct counter *slot;
+    size_t i;
+
+    if ((table->used + 1) * 4 > table->capacity * 3)
+        table_grow(table);
+
+    i = (key ? hash_bytes(key, len) : hash_value(value)) & (table->capacity - 1);
+    for (;;)
+    {
+        slot = &table->slots[i];
+        if (!slot->count)
+        {
+            slot->key = key;
+            slot->len = len;
+            slot->value = value;
+            slot->count = count;
+            table->used++;
+            return;
+        }
+
+        if (key ? (slot->len == len && !memcmp(slot->key, key, len)) : slot->value == value)
+        {
+            slot->count += count;
+            return;
+        }
+
+        i = (i + 1) & (table->capacity - 1);
+    }
+}
+
+static void table_merge(struct table *into, const struct table *from)
+{
+    size_t i;
+
+    for (i = 0; i < from->capacity; i++)
+    {
+        if (from->slots[i].count)
+            table_add(into, from->slots[i].key, from->slots[i].len, from->slots[i].value, from->slots[i].count);
+    }
+}
+
+static int by_count(const void *a, const void *b)
+{
+    const struct counter *x = a, *y = b;
+
+    if (x->count != y->count)
+        return x->count < y->count ? 1 : -1;
+    if (x->key && y->key)
+        return x->len != y->len ? (x->len < y->len ? -1 : 1) : memcmp(x->key, y->key, x->len);
+    return x->value < y->value ? -1 : x->value > y->value;
+}
+
+static int by_value(const void *a, const void *b)
+{
+    const struct counter *x = a, *y = b;
+
+    return x->value < y->value ? -1 : x->value > y->value;
+}
+
+// copy the used slots of the table into an array sorted with compare
+static struct counter *table_sorted(const struct table *table, int (*compare)(const void *, const void *))
+{
+    struct counter *sorted = malloc((table->used + 1) * sizeof(*sorted));
+    size_t i, n = 0;
+
+    if (!sorted)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < table->capacity; i++)
+    {
+        if (table->slots[i].count)
+            sorted[n++] = table->slots[i];
+    }
+    qsort(sorted, n, sizeof(*sorted), compare);
+
+    return sorted;
+}
+
+/*
+ * Raw LZ4 block decoder, the format produced by the lz4 compressor of the kernel crypto API.
+ * Returns the number of decoded bytes, -1 if the block is malformed or does not fit into dst.
+ */
+static long lz4_decompress(const unsigned char *src, size_t src_len, unsigned char *dst, size_t dst_cap)
+{
+    const unsigned char *ip = src, *iend = src + src_len;
+    unsigned char *op = dst, *oend = dst + dst_cap;
+    const unsigned char *match;
+    size_t literals, length, offset;
+    unsigned int token, byte;
+
+    while (ip < iend)
+    {
+        token = *ip++;
+
+        literals = token >> 4;
+        if (literals == 15)
+        {
+            do
+            {
+                if (ip >= iend)
+                    return -1;
+                byte = *ip++;
+                literals += byte;
+            } while (byte == 255);
+        }
+        if (literals > (size_t)(iend - ip) || literals > (size_t)(oend - op))
+            return -1;
+        memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+
+        // the last sequence is made of literals only
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -1;
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst))
+            return -1;
+
+        length = token & 15;
+        if (length == 15)
+        {
+            do
+            {
+                if (ip >= iend)
+                    return -1;
+                byte = *ip++;
+                length += byte;
+            } while (byte == 255);
+        }
+        length += 4;
+        if (length > (size_t)(oend - op))
+            return -1;
+
+        // matches may overlap the bytes they produce
+        match = op - offset;
+        while (length--)
+            *op++ = *match++;
+    }
+
+    return op - dst;
+}
+
+// parse a decimal field followed by a comma, returning the first byte after the comma or NULL
+static const char *parse_field(const char *p, const char *end, uint64_t *value)
+{
+    const char *start;
+    uint64_t v = 0;
+
+    while (p < end && *p == ' ')
+        p++;
+
+    start = p;
+    while (p < end && *p >= '0' && *p <= '9')
+        v = v * 10 + (*p++ - '0');
+
+    if (p == start || p == end || *p != ',')
+        return NULL;
+
+    *value = v;
+    return p + 1;
+}
+
+/*
+ * A record is "timestamp, tid, tgid, uid, euid, exe, hash" (records written before the timestamps were
+ * introduced have no first field). The path may hold commas: it ends at the last one of the line.
+ */
+static int parse_record(const char *p, const char *end, struct record *record, int *has_timestamp)
+{
+    uint64_t fields[5];
+    const char *next, *comma;
+    int n = 0;
+
+    while (n < 5 && (next = parse_field(p, end, &fields[n])) != NULL)
+    {
+        p = next;
+        n++;
+    }
+
+    if (n == 5)
+    {
+        record->timestamp = fields[0];
+        record->tid = fields[1];
+        record->tgid = fields[2];
+        record->uid = fields[3];
+        record->euid = fields[4];
+        *has_timestamp = 1;
+    }
+    else if (n == 4)
+    {
+        record->timestamp = 0;
+        record->tid = fields[0];
+        record->tgid = fields[1];
+        record->uid = fields[2];
+        record->euid = fields[3];
+        *has_timestamp = 0;
+    }
+    else
+    {
+        return -1;
+    }
+
+    while (p < end && *p == ' ')
+        p++;
+
+    comma = end;
+    while (comma > p && comma[-1] != ',')
+        comma--;
+    if (comma == p)
+        return -1;
+
+    record->exe = p;
+    record->exe_len = comma - 1 - p;
+
+    return 0;
+}
+
+static int record_matches(const struct filter *filter, const struct record *record, int has_timestamp)
+{
+    if (filter->tgid != NO_FILTER && record->tgid != filter->tgid)
+        return 0;
+    if (filter->uid != NO_FILTER && record->uid != filter->uid)
+        return 0;
+    if ((filter->since != NO_FILTER || filter->until != NO_FILTER) && !has_timestamp)
+        return 0;
+    if (filter->since != NO_FILTER && record->timestamp < filter->since)
+        return 0;
+    if (filter->until != NO_FILTER && record->timestamp > filter->until)
+        return 0;
+
+    return 1;
+}
+
+static void worker_print(struct worker *worker, const char *line, size_t len)
+{
+    if (worker->out_len + len + 1 > worker->out_cap)
+    {
+        worker->out_cap = (worker->out_len + len + 1) * 2;
+        worker->out = realloc(worker->out, worker->out_cap);
+        if (!worker->out)
+        {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    memcpy(worker->out + worker->out_len, line, len);
+    worker->out_len += len;
+    worker->out[worker->out_len++] = '\n';
+}
+
+static void scan_span(struct worker *worker, const char *p, const char *end)
+{
+    struct record record;
+    const char *eol;
+    int has_timestamp;
+
+    while (p < end)
+    {
+        // unused bytes of the blocks of a device without checksums are zeroed
+        if (*p == '\0')
+        {
+            p++;
+            continue;
+        }
+
+        eol = memchr(p, '\n', end - p);
+        if (!eol)
+            eol = end;
+
+        if (parse_record(p, eol, &record, &has_timestamp))
+        {
+            // the first line of the log is the header
+            if (memcmp(p, SINGLEFILEFS_LOG_HEADER, eol - p < 9 ? eol - p : 9))
+                worker->malformed++;
+            p = eol + 1;
+            continue;
+        }
+
+        worker->records++;
+        if (has_timestamp)
+            worker->has_timestamps = 1;
+
+        if (record_matches(worker->filter, &record, has_timestamp))
+        {
+            worker->matching++;
+            table_add(&worker->exes, record.exe, record.exe_len, 0, 1);
+            table_add(&worker->uids, NULL, 0, record.uid, 1);
+            if (has_timestamp)
+                table_add(&worker->minutes, NULL, 0, record.timestamp / 60, 1);
+            if (worker->print)
+                worker_print(worker, p, eol - p);
+        }
+
+        p = eol + 1;
+    }
+}
+
+static void *worker_run(void *arg)
+{
+    struct worker *worker = arg;
+    struct span *span;
+    long len;
+    size_t i;
+
+    for (i = worker->first; i < worker->last; i++)
+    {
+        span = &worker->spans[i];
+
+        if (span->frame)
+        {
+            if (span->frame->length == span->frame->raw_length)
+            {
+                memcpy((char *)span->data, span->frame + 1, span->len);
+            }
+            else
+            {
+                len = lz4_decompress((const unsigned char *)(span->frame + 1), span->frame->length,
+                                     (unsigned char *)span->data, span->len);
+                if (len < 0)
+                {
+                    worker->corrupted++;
+                    continue;
+                }
+                span->len = len;
+            }
+        }
+
+        scan_span(worker, span->data, span->data + span->len);
+    }
+
+    return NULL;
+}
+
+static void spans_add(struct span **spans, size_t *count, size_t *capacity, const char *data, size_t len,
+                      const struct onefilefs_frame_header *frame)
+{
+    if (*count == *capacity)
+    {
+        *capacity = *capacity ? *capacity * 2 : 1024;
+        *spans = realloc(*spans, *capacity * sizeof(**spans));
+        if (!*spans)
+        {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    (*spans)[*count].data = data;
+    (*spans)[*count].len = len;
+    (*spans)[*count].frame = frame;
+    (*count)++;
+}
+
+// split a text file into newline aligned spans
+static size_t split_text(const char *map, size_t size, size_t parts, struct span **spans)
+{
+    size_t count = 0, capacity = 0;
+    const char *p = map, *end = map + size, *cut, *eol;
+    size_t chunk = size / parts + 1;
+
+    while (p < end)
+    {
+        cut = (size_t)(end - p) > chunk ? p + chunk : end;
+        if (cut < end)
+        {
+            eol = memchr(cut, '\n', end - cut);
+            cut = eol ? eol + 1 : end;
+        }
+        spans_add(spans, &count, &capacity, p, cut - p, NULL);
+        p = cut;
+    }
+
+    return count;
+}
+
+// address of the region block in the image, NULL if the extents or the image do not hold it
+static const char *image_block(const char *map, size_t size, const struct onefilefs_inode *inode,
+                               uint64_t block_size, uint64_t region_block)
+{
+    uint64_t i, extents = inode->extents_count;
+    uint64_t device_block;
+
+    if (extents > SINGLEFILEFS_MAX_EXTENTS)
+        return NULL;
+
+    for (i = 0; i < extents; i++)
+    {
+        if (region_block < inode->extents[i].length)
+            break;
+        region_block -= inode->extents[i].length;
+    }
+    if (i == extents)
+        return NULL;
+
+    device_block = inode->extents[i].start + region_block;
+    if (device_block >= size / block_size)
+        return NULL;
+
+    return map + device_block * block_size;
+}
+
+// address of len bytes of the data region from byte pos, NULL unless they are contiguous in the image
+static const char *image_range(const char *map, size_t size, const struct onefilefs_inode *inode,
+                               uint64_t block_size, uint64_t pos, uint64_t len)
+{
+    const char *first = image_block(map, size, inode, block_size, pos / block_size);
+    const char *last = image_block(map, size, inode, block_size, (pos + len - 1) / block_size);
+
+    if (!first || !last || last - first != (long)((pos + len - 1) / block_size - pos / block_size) * (long)block_size)
+        return NULL;
+
+    return first + pos % block_size;
+}
+
+/*
+ * Split the log held by a singlefilefs image into spans. The boundaries of the log are the ones of
+ * the superblock: records appended after its last update (recovered at mount time) are not seen.
+ * Returns the number of spans, -1 if the image is not valid.
+ */
+static long split_image(const char *map, size_t size, struct span **spans, char **decoded)
+{
+    const struct onefilefs_sb_info *sb = (const struct onefilefs_sb_info *)map;
+    const struct onefilefs_inode *inode;
+    const struct onefilefs_block_header *header;
+    const uint64_t *frames;
+    const char *block;
+    uint64_t block_size, block_header, payload, segment_bytes, file_size;
+    uint64_t off, segment, region_block, logical_blocks, frame, i;
+    size_t count = 0, capacity = 0, len;
+
+    if (sb->version == SINGLEFILEFS_LEGACY_VERSION)
+    {
+        inode = (const struct onefilefs_inode *)(map + DEFAULT_BLOCK_SIZE);
+        if (size < 2 * DEFAULT_BLOCK_SIZE)
+            return -1;
+        file_size = inode->file_size;
+        if (file_size > size - 2 * DEFAULT_BLOCK_SIZE)
+            file_size = size - 2 * DEFAULT_BLOCK_SIZE;
+        spans_add(spans, &count, &capacity, map + 2 * DEFAULT_BLOCK_SIZE, file_size, NULL);
+        return count;
+    }
+
+    block_size = sb->block_size;
+    if (sb->version != SINGLEFILEFS_VERSION || block_size < SINGLEFILEFS_MIN_BLOCK_SIZE ||
+        block_size > SINGLEFILEFS_MAX_BLOCK_SIZE || (block_size & (block_size - 1)) ||
+        size < (SINGLEFILEFS_DATA_BLOCK_NUMBER + 1) * block_size || !sb->segments_count)
+        return -1;
+
+    inode = (const struct onefilefs_inode *)(map + SINGLEFILEFS_INODES_BLOCK_NUMBER * block_size);
+
+    if (sb->flags & SINGLEFILEFS_FLAG_COMPRESSED)
+    {
+        logical_blocks = (sb->tail_bytes + block_size - 1) / block_size;
+        if (logical_blocks > sb->map_blocks * (block_size / sizeof(uint64_t)))
+            return -1;
+
+        *decoded = malloc(logical_blocks * block_size + 1);
+        if (!*decoded)
+        {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+
+        frames = (const uint64_t *)(map + SINGLEFILEFS_DATA_BLOCK_NUMBER * block_size);
+        for (i = 0; i < logical_blocks; i++)
+        {
+            const struct onefilefs_frame_header *frame_header;
+
+            frame = frames[i];
+            frame_header = (const struct onefilefs_frame_header *)image_range(map, size, inode, block_size, frame,
+                                                                              sizeof(*frame_header));
+            if (!frame_header || frame_header->raw_length > block_size || frame_header->length > block_size ||
+                !image_range(map, size, inode, block_size, frame, sizeof(*frame_header) + frame_header->length))
+                return -1;
+
+            spans_add(spans, &count, &capacity, *decoded + i * block_size, frame_header->raw_length, frame_header);
+        }
+
+        return count;
+    }
+
+    block_header = (sb->flags & SINGLEFILEFS_FLAG_CHECKSUM) ? sizeof(struct onefilefs_block_header) : 0;
+    payload = block_size - block_header;
+    segment_bytes = sb->segment_blocks * payload;
+    file_size = (sb->tail_segment + sb->segments_count - sb->head_segment) % sb->segments_count * segment_bytes +
+                sb->tail_bytes;
+
+    for (off = 0; off < file_size; off += payload)
+    {
+        segment = (sb->head_segment + off / segment_bytes) % sb->segments_count;
+        region_block = segment * sb->segment_blocks + off % segment_bytes / payload;
+
+        block = image_block(map, size, inode, block_size, region_block);
+        if (!block)
+            return -1;
+
+        len = file_size - off < payload ? file_size - off : payload;
+        if (block_header)
+        {
+            // blocks are sealed with the bytes they hold, a crash may leave the hint behind them
+            header = (const struct onefilefs_block_header *)block;
+            len = header->used <= payload ? header->used : 0;
+        }
+
+        spans_add(spans, &count, &capacity, block + block_header, len, NULL);
+    }
+
+    return count;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-t threads] [-n top] [--tgid N] [--uid N] [--since T] [--until T] [--print] <log or image>\n"
+                    "  T is a UNIX timestamp in seconds, the log is read from a text copy or a singlefilefs image\n",
+            name);
+}
+
+static uint64_t parse_number(const char *arg, const char *name)
+{
+    unsigned long long value;
+    char *end;
+
+    errno = 0;
+    value = strtoull(arg, &end, 0);
+    if (errno || *end || end == arg)
+    {
+        fprintf(stderr, "Invalid %s: %s\n", name, arg);
+        exit(EXIT_FAILURE);
+    }
+
+    return value;
+}
+
+static void print_minute(uint64_t minute, uint64_t count)
+{
+    time_t seconds = minute * 60;
+    struct tm tm;
+    char buf[32];
+
+    gmtime_r(&seconds, &tm);
+    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M", &tm);
+    printf("  %s  %llu\n", buf, (unsigned long long)count);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        {"threads", required_argument, NULL, 't'},
+        {"top", required_argument, NULL, 'n'},
+        {"tgid", required_argument, NULL, 'g'},
+        {"uid", required_argument, NULL, 'u'},
+        {"since", required_argument, NULL, 's'},
+        {"until", required_argument, NULL, 'e'},
+        {"print", no_argument, NULL, 'p'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+    struct filter filter = {NO_FILTER, NO_FILTER, NO_FILTER, NO_FILTER};
+    struct worker *workers;
+    struct table exes = {0}, uids = {0}, minutes = {0};
+    struct counter *sorted;
+    struct span *spans = NULL;
+    struct timespec start, stop;
+    struct stat st;
+    char *decoded = NULL;
+    const char *map;
+    uint64_t records = 0, matching = 0, malformed = 0, corrupted = 0;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    long spans_count;
+    size_t size, top = DEFAULT_TOP, i, count, per_worker;
+    int print = 0, has_timestamps = 0;
+    double elapsed;
+    int fd, opt;
+
+    while ((opt = getopt_long(argc, argv, "t:n:ph", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            threads = parse_number(optarg, "thread count");
+            break;
+        case 'n':
+            top = parse_number(optarg, "top count");
+            break;
+        case 'g':
+            filter.tgid = parse_number(optarg, "TGID");
+            break;
+        case 'u':
+            filter.uid = parse_number(optarg, "UID");
+            break;
+        case 's':
+            filter.since = parse_number(optarg, "start time");
+            break;
+        case 'e':
+            filter.until = parse_number(optarg, "end time");
+            break;
+        case 'p':
+            print = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (optind != argc - 1)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (threads < 1)
+        threads = 1;
+    if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+
+    fd = open(argv[optind], O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Cannot open %s: %s\n", argv[optind], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if (fstat(fd, &st))
+    {
+        perror("fstat");
+        return EXIT_FAILURE;
+    }
+
+    size = st.st_size;
+    if (S_ISBLK(st.st_mode))
+    {
+        uint64_t bytes;
+
+        if (ioctl(fd, BLKGETSIZE64, &bytes))
+        {
+            perror("BLKGETSIZE64");
+            return EXIT_FAILURE;
+        }
+        size = bytes;
+    }
+
+    if (size == 0)
+    {
+        printf("Empty log\n");
+        return EXIT_SUCCESS;
+    }
+
+    map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+    close(fd);
+    madvise((void *)map, size, MADV_SEQUENTIAL | MADV_WILLNEED);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (size >= sizeof(struct onefilefs_sb_info) && ((const struct onefilefs_sb_info *)map)->magic == MAGIC)
+    {
+        spans_count = split_image(map, size, &spans, &decoded);
+        if (spans_count < 0)
+        {
+            fprintf(stderr, "%s: corrupted singlefilefs image\n", argv[optind]);
+            return EXIT_FAILURE;
+        }
+    }
+    else
+    {
+        spans_count = split_text(map, size, threads * SPANS_PER_THREAD, &spans);
+    }
+
+    workers = calloc(threads, sizeof(*workers));
+    if (!workers)
+    {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+
+    // each worker takes a contiguous range of spans, so that printed records keep the log order
+    count = spans_count;
+    per_worker = (count + threads - 1) / threads;
+    for (i = 0; i < (size_t)threads; i++)
+    {
+        workers[i].filter = &filter;
+        workers[i].spans = spans;
+        workers[i].print = print;
+        workers[i].first = i * per_worker < count ? i * per_worker : count;
+        workers[i].last = workers[i].first + per_worker < count ? workers[i].first + per_worker : count;
+
+        if (pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]))
+        {
+            perror("pthread_create");
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (i = 0; i < (size_t)threads; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+
+        records += workers[i].records;
+        matching += workers[i].matching;
+        malformed += workers[i].malformed;
+        corrupted += workers[i].corrupted;
+        has_timestamps |= workers[i].has_timestamps;
+        table_merge(&exes, &workers[i].exes);
+        table_merge(&uids, &workers[i].uids);
+        table_merge(&minutes, &workers[i].minutes);
+
+        if (print)
+            fwrite(workers[i].out, 1, workers[i].out_len, stdout);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    elapsed = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+
+    if (print)
+        return EXIT_SUCCESS;
+
+    printf("Scanned %zu bytes in %.3f s (%.1f MB/s) with %ld thread(s)\n", size, elapsed,
+           elapsed > 0 ? size / elapsed / 1e6 : 0.0, threads);
+    printf("Records: %llu, matching: %llu", (unsigned long long)records, (unsigned long long)matching);
+    if (malformed)
+        printf(", malformed lines: %llu", (unsigned long long)malformed);
+    if (corrupted)
+        printf(", corrupted frames: %llu", (unsigned long long)corrupted);
+    printf("\n");
+
+    printf("\nTop offending programs:\n");
+    sorted = table_sorted(&exes, by_count);
+    for (i = 0; i < exes.used && i < top; i++)
+        printf("  %10llu  %.*s\n", (unsigned long long)sorted[i].count, (int)sorted[i].len, sorted[i].key);
+    free(sorted);
+
+    printf("\nRecords per UID:\n");
+    sorted = table_sorted(&uids, by_count);
+    for (i = 0; i < uids.used; i++)
+        printf("  %10llu  %llu\n", (unsigned long long)sorted[i].count, (unsigned long long)sorted[i].value);
+    free(sorted);
+
+    if (has_timestamps)
+    {
+        printf("\nRecords per minute (UTC):\n");
+        sorted = table_sorted(&minutes, by_value);
+        for (i = 0; i < minutes.used; i++)
+            print_minute(sorted[i].value, sorted[i].count);
+        free(sorted);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,207 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+
+#include "../reference-monitor/refmon_ioctl.h"
+
+/*
+ * Deployment preflight: tells which files would be denied by the current blacklist, without touching
+ * them. Paths are read one per line and sent to REFMON_IOC_QUERY in batches, each batch is matched
+ * against a single version of the blacklist. Works in any state of the reference monitor, but only the
+ * armed hooks deny (none while it is OFF or REC_OFF). Paths are matched as the hooks see them:
+ * absolute paths for files on the root file system.
+ *
+ * Usage: preflight [-o op] [-q] [file]    (paths from stdin if no file is given)
+ * Exit status: 0 if nothing would be denied, 1 if some path would be, 2 on errors.
+ */
+
+// paths per query, the packed paths also stay below REFMON_BATCH_MAX_BYTES
+#define QUERY_PATHS 65536
+
+static const char *op_names[] = {"open", "unlink", "create", "mkdir", "rename", "rmdir", "link", "symlink", "write", "lseek", "read"};
+
+struct batch
+{
+    char *paths;
+    size_t len;
+    uint8_t *ops;
+    uint32_t count;
+    uint64_t verdicts[(QUERY_PATHS + 63) / 64];
+};
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-o op] [-q] [file]\n"
+                    "  op is one of open (for writing, the default), unlink, create, mkdir, rename, rmdir, link, symlink,\n"
+                    "  write, lseek, read; paths are read one per line from file or stdin, denied ones are printed\n",
+            name);
+}
+
+static int parse_op(const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(op_names) / sizeof(op_names[0]); i++)
+    {
+        if (strcmp(name, op_names[i]) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+// send the batch, print the paths that would be denied and return how many they are (-1 on errors)
+static long query(int fd, struct batch *batch, int quiet)
+{
+    struct refmon_query_req req;
+    const char *path = batch->paths;
+    uint32_t i;
+
+    memset(&req, 0, sizeof(req));
+    memset(batch->verdicts, 0, sizeof(batch->verdicts));
+    req.paths = (uintptr_t)batch->paths;
+    req.len = batch->len;
+    req.ops = (uintptr_t)batch->ops;
+    req.verdicts = (uintptr_t)batch->verdicts;
+    req.count = batch->count;
+
+    if (ioctl(fd, REFMON_IOC_QUERY, &req) == -1)
+    {
+        fprintf(stderr, "REFMON_IOC_QUERY: %s\n", strerror(errno));
+        return -1;
+    }
+
+    for (i = 0; i < batch->count; i++)
+    {
+        if (!quiet && (batch->verdicts[i / 64] >> (i % 64)) & 1)
+            printf("%s\n", path);
+        path += strlen(path) + 1;
+    }
+
+    batch->len = 0;
+    batch->count = 0;
+
+    return req.denied;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        {"op", required_argument, NULL, 'o'},
+        {"quiet", no_argument, NULL, 'q'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+    struct batch *batch;
+    FILE *input = stdin;
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t len;
+    uint64_t total = 0, denied = 0;
+    long ret;
+    int op = REFMON_OP_OPEN, quiet = 0;
+    int fd, opt;
+
+    while ((opt = getopt_long(argc, argv, "o:qh", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'o':
+            op = parse_op(optarg);
+            if (op < 0)
+            {
+                fprintf(stderr, "Invalid operation: %s\n", optarg);
+                return 2;
+            }
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : 2;
+        }
+    }
+
+    if (optind < argc - 1)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (optind == argc - 1)
+    {
+        input = fopen(argv[optind], "r");
+        if (!input)
+        {
+            fprintf(stderr, "Cannot open %s: %s\n", argv[optind], strerror(errno));
+            return 2;
+        }
+    }
+
+    fd = open(REFMON_DEVICE, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Cannot open %s: %s\n", REFMON_DEVICE, strerror(errno));
+        return 2;
+    }
+
+    batch = calloc(1, sizeof(*batch));
+    if (batch)
+    {
+        batch->paths = malloc(REFMON_BATCH_MAX_BYTES);
+        batch->ops = malloc(QUERY_PATHS);
+    }
+    if (!batch || !batch->paths || !batch->ops)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 2;
+    }
+    memset(batch->ops, op, QUERY_PATHS);
+
+    while ((len = getline(&line, &capacity, input)) != -1)
+    {
+        if (len > 0 && line[len - 1] == '\n')
+            line[--len] = '\0';
+        if (len == 0)
+            continue;
+
+        if (batch->count == QUERY_PATHS || batch->len + len + 1 > REFMON_BATCH_MAX_BYTES)
+        {
+            ret = query(fd, batch, quiet);
+            if (ret < 0)
+                return 2;
+            denied += ret;
+        }
+
+        memcpy(batch->paths + batch->len, line, len + 1);
+        batch->len += len + 1;
+        batch->count++;
+        total++;
+    }
+
+    if (batch->count > 0)
+    {
+        ret = query(fd, batch, quiet);
+        if (ret < 0)
+            return 2;
+        denied += ret;
+    }
+
+    fprintf(stderr, "%llu of %llu paths would be denied (%s)\n", (unsigned long long)denied,
+            (unsigned long long)total, op_names[op]);
+
+    free(line);
+    free(batch->ops);
+    free(batch->paths);
+    free(batch);
+    close(fd);
+
+    return denied ? 1 : EXIT_SUCCESS;
+}
@@ -0,0 +1,408 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/ioctl.h>
+
+#include "client.h"
+#include "../reference-monitor/refmon_ioctl.h"
+
+/*
+ * Declarative sync of the blacklist (client --sync <rules file>): the rules file lists the paths that
+ * must be blacklisted, one per line (empty lines and lines starting with '#' are skipped). The live
+ * blacklist is dumped, both sets are hashed and only the missing paths are added and the extra ones
+ * removed, with one batch ioctl per direction through /dev/refmon (one syscall per path, under a
+ * reconfiguration session, without the device). When nothing changed no password is needed and no
+ * edit is made. The monitor must be in REC_ON or REC_OFF state to apply a diff.
+ */
+
+struct path_list
+{
+    char **paths;
+    size_t count;
+    size_t capacity;
+};
+
+// open addressing set of the paths of a list, slots hold the index of the path plus one (0 is empty)
+struct path_set
+{
+    const struct path_list *list;
+    size_t *slots;
+    size_t mask;
+};
+
+static uint64_t hash_path(const char *path)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL; /* FNV-1a */
+
+    while (*path)
+    {
+        hash ^= (unsigned char)*path++;
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+// append path to the list, which takes it as is
+static int path_list_push(struct path_list *list, char *path)
+{
+    char **paths;
+
+    if (list->count == list->capacity)
+    {
+        list->capacity = list->capacity ? list->capacity * 2 : 256;
+        paths = realloc(list->paths, list->capacity * sizeof(*paths));
+        if (!paths)
+            return -1;
+        list->paths = paths;
+    }
+
+    list->paths[list->count++] = path;
+
+    return 0;
+}
+
+// append a copy of the len bytes of path
+static int path_list_add(struct path_list *list, const char *path, size_t len)
+{
+    char *copy;
+
+    copy = strndup(path, len);
+    if (!copy)
+        return -1;
+
+    if (path_list_push(list, copy))
+    {
+        free(copy);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void path_list_clear(struct path_list *list)
+{
+    size_t i;
+
+    for (i = 0; i < list->count; i++)
+        free(list->paths[i]);
+    list->count = 0;
+}
+
+// slot of path in the set: the one holding it, or the empty one where it would go
+static size_t *path_set_slot(const struct path_set *set, const char *path)
+{
+    size_t i = hash_path(path) & set->mask;
+
+    while (set->slots[i] && strcmp(set->list->paths[set->slots[i] - 1], path) != 0)
+        i = (i + 1) & set->mask;
+
+    return &set->slots[i];
+}
+
+// index the paths of list, dropping the duplicates (they are marked NULL)
+static int path_set_build(struct path_set *set, struct path_list *list)
+{
+    size_t size = 16, i, *slot;
+
+    while (size < list->count * 2)
+        size *= 2;
+
+    set->list = list;
+    set->mask = size - 1;
+    set->slots = calloc(size, sizeof(*set->slots));
+    if (!set->slots)
+        return -1;
+
+    for (i = 0; i < list->count; i++)
+    {
+        slot = path_set_slot(set, list->paths[i]);
+        if (*slot)
+        {
+            free(list->paths[i]);
+            list->paths[i] = NULL;
+            continue;
+        }
+        *slot = i + 1;
+    }
+
+    return 0;
+}
+
+static int path_set_contains(const struct path_set *set, const char *path)
+{
+    return *path_set_slot(set, path) != 0;
+}
+
+static int read_rules(const char *file, struct path_list *rules)
+{
+    FILE *fp;
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t len;
+    int ret = 0;
+
+    fp = fopen(file, "r");
+    if (!fp)
+    {
+        fprintf(stderr, "Cannot open %s: %s\n", file, strerror(errno));
+        return -1;
+    }
+
+    while ((len = getline(&line, &capacity, fp)) != -1)
+    {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+        if (len == 0 || line[0] == '#')
+            continue;
+
+        if (len >= PATH_MAX)
+        {
+            fprintf(stderr, "Path too long in %s: %.64s...\n", file, line);
+            ret = -1;
+            break;
+        }
+
+        if (path_list_add(rules, line, len))
+        {
+            fprintf(stderr, "Out of memory\n");
+            ret = -1;
+            break;
+        }
+    }
+
+    free(line);
+    fclose(fp);
+    return ret;
+}
+
+// dump the whole blacklist, listing it again if it changes meanwhile
+static int read_blacklist(struct path_list *live)
+{
+    char *buf;
+    char *entry;
+    unsigned long cursor = 0;
+    uint32_t len;
+    long ret, i;
+
+    buf = malloc(DUMP_BUFFER_SIZE);
+    if (!buf)
+        return -1;
+
+    for (;;)
+    {
+        if (refmon_device() >= 0)
+        {
+            struct refmon_dump_req req;
+
+            req.buf = (uintptr_t)buf;
+            req.len = DUMP_BUFFER_SIZE;
+            req.cursor = cursor;
+            ret = ioctl(refmon_device(), REFMON_IOC_DUMP, &req);
+            if (ret == 0)
+            {
+                cursor = req.cursor;
+                ret = req.count;
+            }
+        }
+        else
+        {
+            ret = syscall(DUMP_BLACKLIST, buf, DUMP_BUFFER_SIZE, &cursor);
+        }
+        if (ret == -1 && errno == ESTALE)
+        {
+            path_list_clear(live);
+            cursor = 0;
+            continue;
+        }
+        if (ret <= 0)
+            break;
+
+        entry = buf;
+        for (i = 0; i < ret; i++)
+        {
+            memcpy(&len, entry, BLACKLIST_ENTRY_HEADER);
+            if (path_list_add(live, entry + BLACKLIST_ENTRY_HEADER, len))
+            {
+                errno = ENOMEM;
+                ret = -1;
+                break;
+            }
+            entry += BLACKLIST_ENTRY_HEADER + len;
+        }
+        if (ret == -1)
+            break;
+    }
+
+    if (ret == -1)
+        fprintf(stderr, "Cannot dump the blacklist: %s\n", strerror(errno));
+
+    free(buf);
+    return ret == -1 ? -1 : 0;
+}
+
+// send the paths in batches of at most REFMON_BATCH_MAX_BYTES, returning the paths applied
+static long apply_batches(unsigned long cmd, char **paths, size_t count, const char *password)
+{
+    struct refmon_batch_req req;
+    char *buf;
+    size_t i = 0, len, path_len;
+    long applied = 0;
+
+    buf = malloc(REFMON_BATCH_MAX_BYTES);
+    if (!buf)
+        return -1;
+
+    while (i < count)
+    {
+        for (len = 0; i < count; i++)
+        {
+            path_len = strlen(paths[i]) + 1;
+            if (len + path_len > REFMON_BATCH_MAX_BYTES)
+                break;
+            memcpy(buf + len, paths[i], path_len);
+            len += path_len;
+        }
+
+        memset(&req, 0, sizeof(req));
+        strncpy(req.credentials, password, REFMON_SECRET_LEN - 1);
+        req.paths = (uintptr_t)buf;
+        req.len = len;
+        if (ioctl(refmon_device(), cmd, &req) == -1)
+        {
+            applied = -1;
+            break;
+        }
+        applied += req.applied;
+    }
+
+    free(buf);
+    return applied;
+}
+
+// without the device: one syscall per path, the password is checked once to open a session
+static long apply_syscalls(int remove, char **paths, size_t count, const char *password)
+{
+    char token[REC_TOKEN_LEN];
+    long applied = 0;
+    size_t i;
+    long ret;
+
+    if (count == 0)
+        return 0;
+
+    if (syscall(OPEN_REC_SESSION, password, token) == -1)
+        return -1;
+
+    for (i = 0; i < count; i++)
+    {
+        ret = syscall(remove ? REMOVE_FROM_BLACKLIST : ADD_TO_BLACKLIST, paths[i], token);
+        if (ret == -1 && errno != EEXIST)
+            return -1;
+        if (ret == 0)
+            applied++;
+    }
+
+    return applied;
+}
+
+/**
+ * @brief Make the blacklist equal to the paths listed in rules_file
+ * @param password Password of the reference monitor, only needed if the blacklist has to change
+ * @param dry_run Print the diff without applying it
+ * @return EXIT_SUCCESS if the blacklist is (or would be) in sync, EXIT_FAILURE otherwise
+ */
+int sync_rules(const char *rules_file, const char *password, int dry_run)
+{
+    struct path_list rules = {0}, live = {0}, add = {0}, remove = {0};
+    struct path_set rules_set = {0}, live_set = {0};
+    long added = 0, removed = 0;
+    int ret = EXIT_FAILURE;
+    size_t i;
+
+    if (read_rules(rules_file, &rules) || read_blacklist(&live))
+        goto out;
+
+    if (path_set_build(&rules_set, &rules) || path_set_build(&live_set, &live))
+        goto oom;
+
+    // the diff borrows the strings of the two lists
+    for (i = 0; i < live.count; i++)
+    {
+        if (!path_set_contains(&rules_set, live.paths[i]) && path_list_push(&remove, live.paths[i]))
+            goto oom;
+    }
+    for (i = 0; i < rules.count; i++)
+    {
+        if (rules.paths[i] && !path_set_contains(&live_set, rules.paths[i]) && path_list_push(&add, rules.paths[i]))
+            goto oom;
+    }
+
+    if (add.count == 0 && remove.count == 0)
+    {
+        printf("Blacklist in sync (%zu paths)\n", live.count);
+        ret = EXIT_SUCCESS;
+        goto out;
+    }
+
+    if (dry_run)
+    {
+        for (i = 0; i < remove.count; i++)
+            printf("- %s\n", remove.paths[i]);
+        for (i = 0; i < add.count; i++)
+            printf("+ %s\n", add.paths[i]);
+        printf("%zu paths to add, %zu to remove\n", add.count, remove.count);
+        ret = EXIT_SUCCESS;
+        goto out;
+    }
+
+    if (password == NULL)
+    {
+        fprintf(stderr, "The blacklist has to change: set REFMON_PASSWORD or use --password-file\n");
+        goto out;
+    }
+
+    if (refmon_device() >= 0)
+    {
+        removed = remove.count ? apply_batches(REFMON_IOC_REMOVE_RULES, remove.paths, remove.count, password) : 0;
+        if (removed != -1)
+            added = add.count ? apply_batches(REFMON_IOC_ADD_RULES, add.paths, add.count, password) : 0;
+    }
+    else
+    {
+        removed = apply_syscalls(1, remove.paths, remove.count, password);
+        if (removed != -1)
+            added = apply_syscalls(0, add.paths, add.count, password);
+    }
+
+    if (removed == -1 || added == -1)
+    {
+        if (errno == EACCES)
+            fprintf(stderr, "%s: Invalid Password\n", strerror(errno));
+        else
+            fprintf(stderr, "Cannot update the blacklist: %s\n", strerror(errno));
+        goto out;
+    }
+
+    printf("%ld of %zu paths added, %ld of %zu removed\n", added, add.count, removed, remove.count);
+    if ((size_t)added == add.count && (size_t)removed == remove.count)
+        ret = EXIT_SUCCESS;
+    goto out;
+
+oom:
+    fprintf(stderr, "Out of memory\n");
+out:
+    free(add.paths);
+    free(remove.paths);
+    free(rules_set.slots);
+    free(live_set.slots);
+    path_list_clear(&rules);
+    path_list_clear(&live);
+    free(rules.paths);
+    free(live.paths);
+    return ret;
+}
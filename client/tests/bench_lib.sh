@@ -0,0 +1,54 @@
+# Shared by the benchmark runners, sourced from client/ as root. The caller sets PASSWORD and BASE, the
+# directory of the targets: it must be on the root file system, since the hooks match the paths relative
+# to the root of the file system holding the file.
+
+SWITCH=../reference-monitor/user/switch
+
+bench_check_base() {
+    if [ "$(stat -c %d "$(dirname $BASE)")" != "$(stat -c %d /)" ]; then
+        echo "$(dirname $BASE) is not on the root file system, the rules would never match $BASE" >&2
+        return 1
+    fi
+}
+
+# build the state switcher and the client, check BASE and keep the CSV on fd 3
+bench_setup() {
+    (cd ../reference-monitor/user/ && gcc switch_reconfigure.c -o switch) || exit 1
+    make > /dev/null || exit 1
+    bench_check_base || exit 1
+
+    exec 3>&1 # the CSV, the coprocess only reads the "ready" on stderr
+}
+
+bench_loaded() {
+    [ -d /sys/module/the_stack_reference_monitor ]
+}
+
+# install the rules listed in $1 (REC_OFF state)
+bench_sync() {
+    REFMON_PASSWORD=$PASSWORD ./client --sync $1 > /dev/null
+}
+
+# run the benchmark command ($3 and on, with --wait), switching to state $2 (if any) once its files are
+# created; $1 is the config, passed as -c
+bench_run() {
+    local config=$1 state=$2
+    shift 2
+
+    rm -rf $BASE
+    coproc BENCH { exec "$@" --wait -c $config $BASE 2>&1 >&3; }
+    read -r ready <&${BENCH[0]}
+    if [ "$ready" != "ready" ]; then
+        echo "$ready" >&2
+        exit 1
+    fi
+
+    [ -n "$state" ] && $SWITCH $state $PASSWORD > /dev/null
+    kill -USR1 $BENCH_PID
+    wait $BENCH_PID
+    local ret=$?
+
+    [ -n "$state" ] && $SWITCH 3 $PASSWORD > /dev/null
+    rm -rf $BASE
+    [ $ret -eq 0 ] || exit $ret
+}
@@ -0,0 +1,523 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include "../../reference-monitor/refmon_ioctl.h"
+
+/*
+ * Rule churn under hooked traffic, through /dev/refmon (run as root with the password in
+ * REFMON_PASSWORD). A reconfiguration thread cycles as fast as it can: switch to REC_ON, add a batch
+ * of rules, remove another batch, switch back to ON. Meanwhile worker threads open for writing the
+ * target files under the base directory, which the batches blacklist and release, and plain files
+ * never blacklisted, and check every verdict (EACCES or success) against a model of the blacklist.
+ *
+ * The model is guarded by a sequence counter, odd while a batch is in flight: a verdict is checked
+ * only if the counter was even and did not change around the open, the others are counted as
+ * unchecked. A wrong verdict means that a hook saw a blacklist that was neither the one before nor
+ * the one after the batches of a cycle.
+ *
+ * The base directory must be on the root file system: rules are matched against the paths the hooks
+ * resolve, which are relative to the root of the file system holding the file. The monitor runs ON
+ * (REC_ON during the reconfigurations) and is restored to its previous state at exit, with the
+ * rules added by the harness removed.
+ *
+ * Report: hook operations per second, verdicts checked/unchecked/wrong, and one line per phase of the
+ * reconfiguration with count, mean, p50, p99 and max latency in microseconds.
+ * Exit status: 0 without wrong verdicts, 1 with some, 2 on errors.
+ *
+ * Usage: churn_stress [-t workers] [-d seconds] [-k targets] [-b batch] [-f filler rules] <base dir>
+ */
+
+#define DEFAULT_SECONDS 10
+#define DEFAULT_TARGETS 64
+#define MAX_SAMPLES (1 << 20)
+#define MAX_REPORTED 10
+
+enum phase
+{
+    PHASE_REC_ON,
+    PHASE_ADD,
+    PHASE_REMOVE,
+    PHASE_ON,
+    PHASE_CYCLE,
+    NUM_PHASES
+};
+
+static const char *phase_names[NUM_PHASES] = {"rec_on", "add", "remove", "on", "cycle"};
+
+struct worker
+{
+    pthread_t thread;
+    unsigned int seed;
+    uint64_t ops;
+    uint64_t checked;
+    uint64_t unchecked;
+    uint64_t wrong;
+} __attribute__((aligned(64)));
+
+static char base[PATH_MAX];
+static const char *password;
+static int device;
+static long targets = DEFAULT_TARGETS;
+
+// model of the blacklist: blacklisted[i] for target i, changed under an odd model_seq
+static atomic_uint model_seq;
+static atomic_char *blacklisted;
+static atomic_int running;
+static atomic_int reported;
+
+static uint64_t *samples[NUM_PHASES];
+static long sample_count[NUM_PHASES];
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+// rules match by prefix: the suffix keeps target_1 from covering target_10 and the others
+static void target_path(char *buf, size_t size, const char *prefix, long i)
+{
+    snprintf(buf, size, "%s/%s%ld.dat", base, prefix, i);
+}
+
+static int set_state(int state)
+{
+    struct refmon_state_req req;
+
+    memset(&req, 0, sizeof(req));
+    req.state = state;
+    strncpy(req.password, password, REFMON_SECRET_LEN - 1);
+
+    return ioctl(device, REFMON_IOC_SET_STATE, &req);
+}
+
+// add or remove the packed paths, returning the paths applied (-1 on errors)
+static long edit_rules(unsigned long cmd, char *paths, size_t len)
+{
+    struct refmon_batch_req req;
+
+    if (len == 0)
+        return 0;
+
+    memset(&req, 0, sizeof(req));
+    strncpy(req.credentials, password, REFMON_SECRET_LEN - 1);
+    req.paths = (uintptr_t)paths;
+    req.len = len;
+    if (ioctl(device, cmd, &req) == -1)
+        return -1;
+
+    return req.applied;
+}
+
+static void record(enum phase phase, uint64_t start)
+{
+    if (sample_count[phase] < MAX_SAMPLES)
+        samples[phase][sample_count[phase]++] = now_ns() - start;
+}
+
+static void *work(void *arg)
+{
+    struct worker *w = arg;
+    char path[PATH_MAX + 32];
+    unsigned int seq;
+    long i;
+    int fd, expected, denied, plain;
+
+    while (atomic_load(&running))
+    {
+        // one open in four on a plain file
+        i = rand_r(&w->seed) % targets;
+        plain = rand_r(&w->seed) % 4 == 0;
+        target_path(path, sizeof(path), plain ? "plain_" : "target_", i);
+
+        seq = atomic_load(&model_seq);
+        expected = !plain && atomic_load(&blacklisted[i]);
+
+        fd = open(path, O_WRONLY | O_APPEND);
+        denied = fd < 0 && errno == EACCES;
+        if (fd >= 0)
+            close(fd);
+        w->ops++;
+
+        if (fd < 0 && errno != EACCES)
+        {
+            fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+            exit(2);
+        }
+
+        if (seq % 2 == 1 || atomic_load(&model_seq) != seq)
+        {
+            w->unchecked++;
+            continue;
+        }
+
+        w->checked++;
+        if (denied != expected)
+        {
+            w->wrong++;
+            if (atomic_fetch_add(&reported, 1) < MAX_REPORTED)
+                fprintf(stderr, "Wrong verdict: %s %s, expected %s\n", path, denied ? "denied" : "allowed",
+                        expected ? "denied" : "allowed");
+        }
+    }
+
+    return NULL;
+}
+
+// one reconfiguration: batch of targets to blacklist, batch of targets to release
+static int cycle(unsigned int *seed, long batch, char *add, char *remove)
+{
+    size_t add_len = 0, remove_len = 0;
+    char path[PATH_MAX + 32];
+    uint64_t start, begin;
+    long i, k, n, adds = 0, removes = 0, applied;
+    char *pick;
+
+    pick = calloc(targets, 1);
+    if (!pick)
+        return -1;
+
+    // batch distinct targets change verdict: 1 to blacklist, 2 to release
+    for (k = 0, n = 0; n < batch && k < batch * 8; k++)
+    {
+        i = rand_r(seed) % targets;
+        if (pick[i])
+            continue;
+        n++;
+
+        target_path(path, sizeof(path), "target_", i);
+        if (atomic_load(&blacklisted[i]))
+        {
+            pick[i] = 2;
+            removes++;
+            remove_len += sprintf(remove + remove_len, "%s", path) + 1;
+        }
+        else
+        {
+            pick[i] = 1;
+            adds++;
+            add_len += sprintf(add + add_len, "%s", path) + 1;
+        }
+    }
+
+    begin = start = now_ns();
+    if (set_state(2) == -1)
+        goto err;
+    record(PHASE_REC_ON, start);
+
+    // verdicts of the picked targets are unknown until the batches are applied
+    atomic_fetch_add(&model_seq, 1);
+
+    start = now_ns();
+    applied = edit_rules(REFMON_IOC_ADD_RULES, add, add_len);
+    if (applied == -1)
+        goto err;
+    record(PHASE_ADD, start);
+
+    // the model would not be the blacklist anymore
+    if (applied != adds)
+    {
+        fprintf(stderr, "Batch add applied %ld of %ld paths\n", applied, adds);
+        free(pick);
+        return -1;
+    }
+
+    start = now_ns();
+    applied = edit_rules(REFMON_IOC_REMOVE_RULES, remove, remove_len);
+    if (applied == -1)
+        goto err;
+    record(PHASE_REMOVE, start);
+
+    if (applied != removes)
+    {
+        fprintf(stderr, "Batch remove applied %ld of %ld paths\n", applied, removes);
+        free(pick);
+        return -1;
+    }
+
+    for (i = 0; i < targets; i++)
+    {
+        if (pick[i])
+            atomic_store(&blacklisted[i], pick[i] == 1);
+    }
+    atomic_fetch_add(&model_seq, 1);
+
+    start = now_ns();
+    if (set_state(0) == -1)
+        goto err;
+    record(PHASE_ON, start);
+    record(PHASE_CYCLE, begin);
+
+    free(pick);
+    return 0;
+
+err:
+    fprintf(stderr, "Reconfiguration failed: %s\n", strerror(errno));
+    free(pick);
+    return -1;
+}
+
+static void report(enum phase phase)
+{
+    uint64_t *s = samples[phase], sum = 0;
+    long n = sample_count[phase], i;
+
+    if (n == 0)
+        return;
+
+    qsort(s, n, sizeof(*s), compare_u64);
+    for (i = 0; i < n; i++)
+        sum += s[i];
+
+    printf("%-8s %10ld %10.1f %10.1f %10.1f %10.1f\n", phase_names[phase], n, sum / 1e3 / n, s[n / 2] / 1e3,
+           s[n * 99 / 100] / 1e3, s[n - 1] / 1e3);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-t workers] [-d seconds] [-k targets] [-b batch] [-f filler rules] <base dir>\n"
+                    "  the base directory must be on the root file system, the password is read from REFMON_PASSWORD\n",
+            name);
+}
+
+// the files exist before any rule is added, opens never create them
+static void create_files(void)
+{
+    char path[PATH_MAX + 32];
+    const char *prefix;
+    long i;
+    int fd, plain;
+
+    if (mkdir(base, 0755) && errno != EEXIST)
+    {
+        fprintf(stderr, "Cannot create %s: %s\n", base, strerror(errno));
+        exit(2);
+    }
+
+    for (plain = 0; plain < 2; plain++)
+    {
+        prefix = plain ? "plain_" : "target_";
+        for (i = 0; i < targets; i++)
+        {
+            target_path(path, sizeof(path), prefix, i);
+            fd = open(path, O_WRONLY | O_CREAT, 0644);
+            if (fd < 0)
+            {
+                fprintf(stderr, "Cannot create %s: %s\n", path, strerror(errno));
+                exit(2);
+            }
+            close(fd);
+        }
+    }
+}
+
+// filler rules never match a target (or clean them all when remove is set)
+static long filler_rules(long count, int remove)
+{
+    char *buf;
+    size_t len = 0;
+    long i, ret;
+
+    buf = malloc(count * 64 + 1);
+    if (!buf)
+        return -1;
+
+    for (i = 0; i < count; i++)
+        len += sprintf(buf + len, "/refmon_churn_filler/rule_%ld", i) + 1;
+
+    ret = edit_rules(remove ? REFMON_IOC_REMOVE_RULES : REFMON_IOC_ADD_RULES, buf, len);
+    free(buf);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        {"threads", required_argument, NULL, 't'},
+        {"duration", required_argument, NULL, 'd'},
+        {"targets", required_argument, NULL, 'k'},
+        {"batch", required_argument, NULL, 'b'},
+        {"fillers", required_argument, NULL, 'f'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+    struct worker *workers;
+    char path[PATH_MAX + 32];
+    char *add, *remove;
+    uint64_t begin, elapsed, ops = 0, checked = 0, unchecked = 0, wrong = 0;
+    long threads = 0, seconds = DEFAULT_SECONDS, batch = 0, fillers = 0, cycles = 0, i;
+    unsigned int seed = 1;
+    int initial_state, opt, ret = 0;
+
+    while ((opt = getopt_long(argc, argv, "t:d:k:b:f:h", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            threads = strtol(optarg, NULL, 0);
+            break;
+        case 'd':
+            seconds = strtol(optarg, NULL, 0);
+            break;
+        case 'k':
+            targets = strtol(optarg, NULL, 0);
+            break;
+        case 'b':
+            batch = strtol(optarg, NULL, 0);
+            break;
+        case 'f':
+            fillers = strtol(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : 2;
+        }
+    }
+
+    if (threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (batch <= 0)
+        batch = targets / 4 ? targets / 4 : 1;
+
+    if (optind != argc - 1 || seconds < 1 || targets < 1 || batch > targets || fillers < 0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    password = getenv("REFMON_PASSWORD");
+    if (!password)
+    {
+        fprintf(stderr, "Set the password of the reference monitor in REFMON_PASSWORD\n");
+        return 2;
+    }
+
+    if (!realpath(argv[optind], base) && (mkdir(argv[optind], 0755) || !realpath(argv[optind], base)))
+    {
+        fprintf(stderr, "Cannot resolve %s: %s\n", argv[optind], strerror(errno));
+        return 2;
+    }
+
+    device = open(REFMON_DEVICE, O_RDONLY | O_CLOEXEC);
+    if (device < 0)
+    {
+        fprintf(stderr, "Cannot open %s: %s\n", REFMON_DEVICE, strerror(errno));
+        return 2;
+    }
+
+    if (ioctl(device, REFMON_IOC_GET_STATE, &initial_state) == -1)
+    {
+        fprintf(stderr, "REFMON_IOC_GET_STATE: %s\n", strerror(errno));
+        return 2;
+    }
+
+    blacklisted = calloc(targets, sizeof(*blacklisted));
+    workers = aligned_alloc(64, threads * sizeof(*workers));
+    add = malloc(targets * (PATH_MAX + 32));
+    remove = malloc(targets * (PATH_MAX + 32));
+    if (!blacklisted || !workers || !add || !remove)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 2;
+    }
+    for (i = 0; i < NUM_PHASES; i++)
+    {
+        samples[i] = malloc(MAX_SAMPLES * sizeof(uint64_t));
+        if (!samples[i])
+        {
+            fprintf(stderr, "Out of memory\n");
+            return 2;
+        }
+    }
+
+    create_files();
+
+    if (set_state(2) == -1 || (fillers && filler_rules(fillers, 0) == -1) || set_state(0) == -1)
+    {
+        fprintf(stderr, "Cannot prepare the blacklist: %s\n", strerror(errno));
+        return 2;
+    }
+
+    atomic_store(&running, 1);
+    for (i = 0; i < threads; i++)
+    {
+        memset(&workers[i], 0, sizeof(workers[i]));
+        workers[i].seed = i + 1;
+        if (pthread_create(&workers[i].thread, NULL, work, &workers[i]))
+        {
+            fprintf(stderr, "Cannot create worker %ld\n", i);
+            return 2;
+        }
+    }
+
+    begin = now_ns();
+    while (now_ns() - begin < (uint64_t)seconds * 1000000000ULL)
+    {
+        if (cycle(&seed, batch, add, remove))
+        {
+            ret = 2;
+            break;
+        }
+        cycles++;
+    }
+    atomic_store(&running, 0);
+    elapsed = now_ns() - begin;
+
+    for (i = 0; i < threads; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        ops += workers[i].ops;
+        checked += workers[i].checked;
+        unchecked += workers[i].unchecked;
+        wrong += workers[i].wrong;
+    }
+
+    // leave the blacklist as it was
+    set_state(2);
+    for (i = 0; i < targets; i++)
+    {
+        if (atomic_load(&blacklisted[i]))
+        {
+            target_path(path, sizeof(path), "target_", i);
+            edit_rules(REFMON_IOC_REMOVE_RULES, path, strlen(path) + 1);
+        }
+    }
+    if (fillers)
+        filler_rules(fillers, 1);
+    set_state(initial_state);
+
+    printf("workers %ld, targets %ld, batch %ld, fillers %ld, %.1f s\n", threads, targets, batch, fillers, elapsed / 1e9);
+    printf("hook ops/s %.0f (per worker %.0f), reconfigurations/s %.0f\n", ops / (elapsed / 1e9),
+           ops / (elapsed / 1e9) / threads, cycles / (elapsed / 1e9));
+    printf("verdicts checked %llu, unchecked %llu, wrong %llu\n", (unsigned long long)checked,
+           (unsigned long long)unchecked, (unsigned long long)wrong);
+    printf("%-8s %10s %10s %10s %10s %10s\n", "phase", "count", "mean_us", "p50_us", "p99_us", "max_us");
+    for (i = 0; i < NUM_PHASES; i++)
+        report(i);
+
+    if (ret == 0 && wrong)
+        ret = 1;
+
+    return ret;
+}
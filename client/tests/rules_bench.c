@@ -0,0 +1,255 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "../../reference-monitor/utils/rules.h"
+
+/*
+ * Lookups per second of the matcher of the module (reference-monitor/utils/rules.c), built in user
+ * space by make matcher: no module, no syscalls, so a change of the matcher can be measured (or
+ * profiled with perf record ./rules_bench) in seconds.
+ *
+ * Rules look like blacklists of real hosts: files and directories (one in five, ending with '/')
+ * a few levels below /home, /etc, /srv, /var/lib and /opt, grouped under a number of owners that
+ * grows with the rules, so that many of them share long prefixes. Queries are a fixed pool of paths,
+ * hits (files below a random rule, or the rule itself) and misses (siblings of random rules), in the
+ * given proportion (matched_percent is the share of the lookups done that matched a rule). Everything
+ * is generated from the seed, runs with the same seed see the same paths.
+ *
+ * One CSV line per number of rules: rules,queries,hit_percent,lookups_per_sec,ns_per_lookup,matched_percent
+ *
+ * Usage: rules_bench [-n rules] [-q queries] [-p hit percent] [-d seconds] [-s seed] [--header]
+ *        (without -n: 10, 100, 1000, 10000, 100000 and 1000000 rules)
+ */
+
+#define DEFAULT_QUERIES 4096
+#define DEFAULT_HIT_PERCENT 10
+#define DEFAULT_SECONDS 1
+#define PATH_LEN 256
+
+static const char *roots[] = {"/home", "/etc", "/srv", "/var/lib", "/opt"};
+static const char *dirs[] = {"config", "data", "src", "keys", "logs", "backup", "www", "db"};
+
+static uint64_t rng_state;
+
+// xorshift64*, the same sequence on every host
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// rule i: <root>/<owner>/<dir>[/<dir>]/<name>, directories end with '/'
+static void make_rule(char *buf, long i, long owners)
+{
+    long owner = rng() % owners;
+    int len;
+
+    len = snprintf(buf, PATH_LEN, "%s/owner%ld/%s", roots[owner % 5], owner, dirs[rng() % 8]);
+    if (rng() % 2)
+        len += snprintf(buf + len, PATH_LEN - len, "/%s", dirs[rng() % 8]);
+
+    if (rng() % 5 == 0)
+        snprintf(buf + len, PATH_LEN - len, "/dir%ld/", i);
+    else
+        snprintf(buf + len, PATH_LEN - len, "/file%ld.conf", i);
+}
+
+// the rules in insertion order, as the module keeps them (paths are unique by construction)
+static blacklist_node *build_rules(long count, char **paths)
+{
+    blacklist_node *head = NULL, **tail = &head, *node;
+    char buf[PATH_LEN];
+    long owners = 1, i;
+
+    while (owners * owners < count)
+        owners++;
+
+    for (i = 0; i < count; i++)
+    {
+        make_rule(buf, i, owners);
+        node = rules_node_new(buf);
+        if (!node)
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        *tail = node;
+        tail = &node->next;
+        paths[i] = node->path;
+    }
+
+    return head;
+}
+
+static char **build_queries(char **rules, long count, long queries, int hit_percent)
+{
+    char **pool;
+    const char *rule;
+    size_t len;
+    long i;
+
+    pool = malloc(queries * sizeof(*pool));
+    if (!pool)
+        return NULL;
+
+    for (i = 0; i < queries; i++)
+    {
+        rule = rules[rng() % count];
+        len = strlen(rule);
+        pool[i] = malloc(PATH_LEN + 32);
+        if (!pool[i])
+            return NULL;
+
+        if ((long)(rng() % 100) < hit_percent)
+        {
+            if (rule[len - 1] == '/')
+                snprintf(pool[i], PATH_LEN + 32, "%sfile%lu.txt", rule, (unsigned long)(rng() % 1000));
+            else
+                snprintf(pool[i], PATH_LEN + 32, "%s", rule);
+        }
+        else
+        {
+            // same directory as the rule, different name
+            while (len > 0 && rule[len - 1] == '/')
+                len--;
+            while (len > 0 && rule[len - 1] != '/')
+                len--;
+            snprintf(pool[i], PATH_LEN + 32, "%.*sother%lu.txt", (int)len, rule, (unsigned long)(rng() % 1000));
+        }
+    }
+
+    return pool;
+}
+
+static void run(long count, long queries, int hit_percent, long seconds)
+{
+    blacklist_node *head, *next;
+    char **rules, **pool;
+    uint64_t begin, elapsed = 0, lookups = 0, hits = 0;
+    long i;
+
+    rules = malloc(count * sizeof(*rules));
+    if (!rules)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    head = build_rules(count, rules);
+    pool = build_queries(rules, count, queries, hit_percent);
+    if (!pool)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // cycle over the pool until the time is over, with large blacklists a lookup takes milliseconds
+    begin = now_ns();
+    do
+    {
+        hits += rules_match(head, pool[lookups % queries]) != NULL;
+        if (++lookups % 16 == 0 || count >= 10000)
+            elapsed = now_ns() - begin;
+    } while (elapsed < (uint64_t)seconds * 1000000000ULL);
+
+    printf("%ld,%ld,%d,%.0f,%.1f,%.1f\n", count, queries, hit_percent, lookups / (elapsed / 1e9),
+           (double)elapsed / lookups, 100.0 * hits / lookups);
+    fflush(stdout);
+
+    for (; head != NULL; head = next)
+    {
+        next = head->next;
+        rules_node_free(head);
+    }
+    for (i = 0; i < queries; i++)
+        free(pool[i]);
+    free(pool);
+    free(rules);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-n rules] [-q queries] [-p hit percent] [-d seconds] [-s seed] [--header]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        {"rules", required_argument, NULL, 'n'},
+        {"queries", required_argument, NULL, 'q'},
+        {"hits", required_argument, NULL, 'p'},
+        {"duration", required_argument, NULL, 'd'},
+        {"seed", required_argument, NULL, 's'},
+        {"header", no_argument, NULL, 'H'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+    static const long default_counts[] = {10, 100, 1000, 10000, 100000, 1000000};
+    long count = 0, queries = DEFAULT_QUERIES, seconds = DEFAULT_SECONDS;
+    int hit_percent = DEFAULT_HIT_PERCENT, header = 0;
+    uint64_t seed = 1;
+    size_t i;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "n:q:p:d:s:h", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            count = strtol(optarg, NULL, 0);
+            break;
+        case 'q':
+            queries = strtol(optarg, NULL, 0);
+            break;
+        case 'p':
+            hit_percent = strtol(optarg, NULL, 0);
+            break;
+        case 'd':
+            seconds = strtol(optarg, NULL, 0);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'H':
+            header = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (optind != argc || count < 0 || queries < 1 || hit_percent < 0 || hit_percent > 100 || seconds < 0)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (header)
+        printf("rules,queries,hit_percent,lookups_per_sec,ns_per_lookup,matched_percent\n");
+
+    for (i = 0; i < sizeof(default_counts) / sizeof(default_counts[0]); i++)
+    {
+        if (count && i > 0)
+            break;
+
+        // every number of rules starts from the same seed
+        rng_state = seed ? seed : 1;
+        run(count ? count : default_counts[i], queries, hit_percent, seconds);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../../reference-monitor/utils/rules.h"
+
+/*
+ * libFuzzer target of the rule store and matcher of the module (make fuzz, needs clang), checked
+ * against a plain array of rules. The input is a list of lines, the first byte of each one is the
+ * operation and the rest the path: 'a' adds a rule, 'r' removes it, anything else matches the path.
+ * make fuzz-replay builds the same checks with gcc and a main() that runs the inputs given as files
+ * (e.g. the crashes found by the fuzzer).
+ */
+
+#define MAX_RULES 64
+
+struct model
+{
+    char *rules[MAX_RULES];
+    int count;
+};
+
+static int model_find(const struct model *m, const char *path)
+{
+    int i;
+
+    for (i = 0; i < m->count; i++)
+    {
+        if (strcmp(m->rules[i], path) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+// the rule covers the path if it is a prefix of it, or the rule without its trailing '/' is
+static int model_covers(const char *rule, const char *path)
+{
+    size_t rule_len = strlen(rule), path_len = strlen(path);
+
+    if (rule_len <= path_len && memcmp(rule, path, rule_len) == 0)
+        return 1;
+
+    return rule_len > 0 && rule[rule_len - 1] == '/' && rule_len - 1 <= path_len && memcmp(rule, path, rule_len - 1) == 0;
+}
+
+static void check(int condition, const char *what, const char *path)
+{
+    if (!condition)
+    {
+        fprintf(stderr, "Mismatch with the model: %s \"%s\"\n", what, path);
+        abort();
+    }
+}
+
+static void step(blacklist_node **head, struct model *m, char op, const char *path)
+{
+    blacklist_node *node;
+    int i, found = model_find(m, path);
+
+    switch (op)
+    {
+    case 'a':
+        node = rules_node_new(path);
+        if (!node)
+            abort();
+        if (rules_append(head, node) == -EEXIST)
+        {
+            check(found >= 0, "duplicate add of", path);
+            rules_node_free(node);
+        }
+        else
+        {
+            check(found < 0, "add of the existing", path);
+            if (m->count == MAX_RULES)
+            {
+                // the model is full: undo, rules_unlink is checked by the removals
+                check(rules_unlink(head, path) == node, "unlink of the last added", path);
+                rules_node_free(node);
+                break;
+            }
+            m->rules[m->count++] = node->path;
+        }
+        break;
+    case 'r':
+        node = rules_unlink(head, path);
+        check((node != NULL) == (found >= 0), "remove of", path);
+        if (node)
+        {
+            check(strcmp(node->path, path) == 0, "remove returned another rule for", path);
+            memmove(&m->rules[found], &m->rules[found + 1], (m->count - found - 1) * sizeof(m->rules[0]));
+            m->count--;
+            rules_node_free(node);
+        }
+        break;
+    default:
+        node = rules_match(*head, path);
+        for (i = 0; i < m->count && !model_covers(m->rules[i], path); i++)
+            ;
+        check(node == NULL ? i == m->count : i < m->count && node->path == m->rules[i], "match of", path);
+        break;
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    blacklist_node *head = NULL, *next;
+    struct model m = {.count = 0};
+    const uint8_t *end = data + size, *line, *eol;
+    char *path;
+    size_t len;
+
+    for (line = data; line < end; line = eol + 1)
+    {
+        eol = memchr(line, '\n', end - line);
+        if (!eol)
+            eol = end;
+
+        len = eol - line;
+        if (len == 0)
+            continue;
+
+        // paths are C strings in the module too, an embedded NUL ends them
+        path = strndup((const char *)line + 1, len - 1);
+        if (!path)
+            abort();
+        step(&head, &m, line[0], path);
+        free(path);
+    }
+
+    for (; head != NULL; head = next)
+    {
+        next = head->next;
+        rules_node_free(head);
+    }
+
+    return 0;
+}
+
+#ifdef RULES_FUZZ_MAIN
+int main(int argc, char **argv)
+{
+    uint8_t *buf;
+    FILE *fp;
+    long size;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        fp = fopen(argv[i], "rb");
+        if (!fp)
+        {
+            perror(argv[i]);
+            return EXIT_FAILURE;
+        }
+        fseek(fp, 0, SEEK_END);
+        size = ftell(fp);
+        rewind(fp);
+
+        buf = malloc(size ? size : 1);
+        if (!buf || fread(buf, 1, size, fp) != (size_t)size)
+        {
+            perror(argv[i]);
+            return EXIT_FAILURE;
+        }
+        fclose(fp);
+
+        LLVMFuzzerTestOneInput(buf, size);
+        free(buf);
+        printf("%s: ok\n", argv[i]);
+    }
+
+    return EXIT_SUCCESS;
+}
+#endif
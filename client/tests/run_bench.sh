@@ -0,0 +1,44 @@
+#!/bin/bash
+# Syscall overhead of the reference monitor, run from client/ as root:
+#   sudo REFMON_PASSWORD=1234 tests/run_bench.sh [iterations] > bench.csv
+# Configurations: module unloaded (if it is), then monitor OFF and ON with 0, 100, 10000 and 100000
+# rules. The last rule blacklists <base>/protected/, the others are filler paths that never match.
+# The rules are installed with client --sync in REC_OFF state, the CSV goes to stdout.
+
+ITERATIONS=${1:-10000}
+PASSWORD=${REFMON_PASSWORD:-1234}
+BASE=/var/tmp/refmon_bench
+RULES=/tmp/refmon_bench_rules.txt
+
+. tests/bench_lib.sh
+
+gcc -O2 tests/syscall_bench.c -o /tmp/syscall_bench || exit 1
+bench_setup
+BENCH="/tmp/syscall_bench -n $ITERATIONS"
+
+if ! bench_loaded; then
+    bench_run unloaded "" $BENCH --header
+    exit 0
+fi
+
+$SWITCH 3 $PASSWORD > /dev/null || exit 1
+
+: > $RULES
+bench_sync $RULES || exit 1
+bench_run off 1 $BENCH --header
+
+# with the protected directory blacklisted, every operation there must be denied
+for n in 0 100 10000 100000; do
+    expect=
+    if [ $n -gt 0 ]; then
+        seq -f "/tmp/refmon_bench_rules/fill_%.0f" 1 $((n - 1)) > $RULES
+        echo "$BASE/protected/" >> $RULES
+        expect=--expect-denied
+    fi
+    bench_sync $RULES || exit 1
+    bench_run on_$n 0 $BENCH $expect
+done
+
+: > $RULES
+bench_sync $RULES
+rm -f $RULES
@@ -0,0 +1,20 @@
+#!/bin/bash
+# Rule churn during hooked traffic, run from client/ as root (needs /dev/refmon):
+#   sudo REFMON_PASSWORD=1234 tests/run_churn.sh [seconds] [filler rules]
+
+SECONDS_TOTAL=${1:-10}
+FILLERS=${2:-1000}
+BASE=/var/tmp/refmon_churn
+
+export REFMON_PASSWORD=${REFMON_PASSWORD:-1234}
+
+. tests/bench_lib.sh
+
+gcc -O2 -pthread tests/churn_stress.c -o /tmp/churn_stress || exit 1
+bench_check_base || exit 2
+
+rm -rf $BASE
+/tmp/churn_stress -d $SECONDS_TOTAL -f $FILLERS $BASE
+ret=$?
+rm -rf $BASE
+exit $ret
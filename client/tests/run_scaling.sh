@@ -0,0 +1,37 @@
+#!/bin/bash
+# Multi-core scaling of the reference monitor, run from client/ as root:
+#   sudo REFMON_PASSWORD=1234 tests/run_scaling.sh [rules] [seconds] [repeats] > scaling.csv
+# Configurations: module unloaded (if it is), then monitor OFF and ON with the given number of rules
+# (1000 by default): the last one blacklists <base>/protected/, the others are filler paths that never
+# match. For a reproducible curve run it on an idle host with a fixed CPU frequency governor.
+
+RULES_COUNT=${1:-1000}
+SECONDS_PER_POINT=${2:-2}
+REPEATS=${3:-5}
+PASSWORD=${REFMON_PASSWORD:-1234}
+BASE=/var/tmp/refmon_scaling
+RULES=/tmp/refmon_scaling_rules.txt
+
+. tests/bench_lib.sh
+
+gcc -O2 -pthread tests/scaling_bench.c -o /tmp/scaling_bench || exit 1
+bench_setup
+BENCH="/tmp/scaling_bench -d $SECONDS_PER_POINT -r $REPEATS"
+
+if ! bench_loaded; then
+    bench_run unloaded "" $BENCH --header
+    exit 0
+fi
+
+$SWITCH 3 $PASSWORD > /dev/null || exit 1
+
+seq -f "/tmp/refmon_scaling_rules/fill_%.0f" 1 $((RULES_COUNT - 1)) > $RULES
+echo "$BASE/protected/" >> $RULES
+bench_sync $RULES || exit 1
+
+bench_run off 1 $BENCH --header
+bench_run on_$RULES_COUNT 0 $BENCH --expect-denied
+
+: > $RULES
+bench_sync $RULES
+rm -f $RULES
@@ -0,0 +1,307 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+/*
+ * Multi-core scaling of the hooks: N threads (1, 2, 4, ... and the number of online CPUs) loop on
+ * open(O_WRONLY)/write(64 bytes)/close for a fixed time, either on a private file each under
+ * <base dir>/plain/ (never blacklisted) or on a single file shared by all of them under
+ * <base dir>/protected/ (blacklisted by run_scaling.sh, so the opens are denied when the monitor is ON).
+ * Thread i is pinned to the i-th online CPU and all threads start together; each point is measured
+ * -r times and the median is reported, to keep the curve stable between runs. With --wait the
+ * benchmark stops after creating its files until SIGUSR1, as syscall_bench does, and with
+ * --expect-denied it aborts as soon as an open of the shared file is not denied with EACCES.
+ *
+ * One CSV line per workload and thread count:
+ * config,workload,threads,ops_per_sec,ops_per_sec_per_thread,min_ops_per_sec,max_ops_per_sec,errors
+ *
+ * Usage: scaling_bench [-t max threads] [-d seconds] [-r repeats] [-c config] [--header] [--wait] [--expect-denied] <base dir>
+ */
+
+#define DEFAULT_SECONDS 2
+#define DEFAULT_REPEATS 5
+#define WRITE_SIZE 64
+#define DIR_LEN 2048
+#define PATH_LEN (DIR_LEN + 64)
+
+enum workload
+{
+    PRIVATE,
+    SHARED,
+    NUM_WORKLOADS
+};
+
+static const char *workload_names[NUM_WORKLOADS] = {"private", "shared"};
+
+// one per thread, on its own cache line so that counting does not add contention
+struct worker
+{
+    pthread_t thread;
+    int cpu;
+    char path[PATH_LEN];
+    int denied; /* opens of path must fail with EACCES */
+    uint64_t ops;
+    uint64_t errors;
+} __attribute__((aligned(64)));
+
+static atomic_int running;
+static pthread_barrier_t start_barrier;
+
+static void die(const char *what, const char *path)
+{
+    fprintf(stderr, "%s %s: %s\n", what, path, strerror(errno));
+    exit(EXIT_FAILURE);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void *work(void *arg)
+{
+    struct worker *w = arg;
+    char buf[WRITE_SIZE];
+    cpu_set_t set;
+    int fd;
+
+    CPU_ZERO(&set);
+    CPU_SET(w->cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    memset(buf, 'x', sizeof(buf));
+
+    pthread_barrier_wait(&start_barrier);
+    while (atomic_load_explicit(&running, memory_order_relaxed))
+    {
+        fd = open(w->path, O_WRONLY | O_TRUNC);
+        if (w->denied && (fd >= 0 || errno != EACCES))
+        {
+            fprintf(stderr, "open of %s was not denied (%s), are the rules matching it?\n", w->path,
+                    fd >= 0 ? "success" : strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        if (fd < 0 || write(fd, buf, sizeof(buf)) != sizeof(buf))
+            w->errors++;
+        if (fd >= 0)
+            close(fd);
+        w->ops++;
+    }
+
+    return NULL;
+}
+
+// run threads workers for seconds, returning the total operations per second
+static double run(struct worker *workers, int threads, unsigned int seconds, uint64_t *errors)
+{
+    uint64_t begin, ops = 0;
+    int i;
+
+    pthread_barrier_init(&start_barrier, NULL, threads + 1);
+    atomic_store(&running, 1);
+    for (i = 0; i < threads; i++)
+    {
+        workers[i].ops = 0;
+        workers[i].errors = 0;
+        if (pthread_create(&workers[i].thread, NULL, work, &workers[i]))
+        {
+            fprintf(stderr, "Cannot create thread %d\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    begin = now_ns();
+    sleep(seconds);
+    atomic_store(&running, 0);
+
+    for (i = 0; i < threads; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        ops += workers[i].ops;
+        *errors += workers[i].errors;
+    }
+    pthread_barrier_destroy(&start_barrier);
+
+    return ops / ((now_ns() - begin) / 1e9);
+}
+
+static void create_file(const char *path)
+{
+    int fd;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        die("Cannot create", path);
+    close(fd);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-t max threads] [-d seconds] [-r repeats] [-c config] [--header] [--wait] [--expect-denied] <base dir>\n"
+                    "  open/write/close on private files in <base dir>/plain and on a shared one in <base dir>/protected\n",
+            name);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        {"threads", required_argument, NULL, 't'},
+        {"duration", required_argument, NULL, 'd'},
+        {"repeats", required_argument, NULL, 'r'},
+        {"config", required_argument, NULL, 'c'},
+        {"header", no_argument, NULL, 'H'},
+        {"wait", no_argument, NULL, 'w'},
+        {"expect-denied", no_argument, NULL, 'e'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+    struct worker *workers;
+    const char *config = "default";
+    char dir[DIR_LEN];
+    double *samples;
+    uint64_t errors;
+    cpu_set_t online;
+    long max_threads = 0, seconds = DEFAULT_SECONDS, repeats = DEFAULT_REPEATS;
+    int header = 0, wait = 0, expect_denied = 0;
+    int opt, sig, threads, workload, cpu, i, r;
+    sigset_t set;
+
+    while ((opt = getopt_long(argc, argv, "t:d:r:c:h", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            max_threads = strtol(optarg, NULL, 0);
+            break;
+        case 'd':
+            seconds = strtol(optarg, NULL, 0);
+            break;
+        case 'r':
+            repeats = strtol(optarg, NULL, 0);
+            break;
+        case 'c':
+            config = optarg;
+            break;
+        case 'H':
+            header = 1;
+            break;
+        case 'w':
+            wait = 1;
+            break;
+        case 'e':
+            expect_denied = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (sched_getaffinity(0, sizeof(online), &online))
+        die("Cannot get the CPUs of", "the process");
+    if (max_threads <= 0 || max_threads > CPU_COUNT(&online))
+        max_threads = CPU_COUNT(&online);
+
+    if (optind != argc - 1 || seconds < 1 || repeats < 1)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (header)
+        printf("config,workload,threads,ops_per_sec,ops_per_sec_per_thread,min_ops_per_sec,max_ops_per_sec,errors\n");
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &set, NULL);
+
+    workers = aligned_alloc(64, max_threads * sizeof(*workers));
+    samples = malloc(repeats * sizeof(*samples));
+    if (!workers || !samples)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    if (strlen(argv[optind]) + sizeof("/protected") > sizeof(dir))
+    {
+        fprintf(stderr, "Base directory path too long\n");
+        return EXIT_FAILURE;
+    }
+    if (mkdir(argv[optind], 0755) && errno != EEXIST)
+        die("Cannot create", argv[optind]);
+    snprintf(dir, sizeof(dir), "%s/plain", argv[optind]);
+    if (mkdir(dir, 0755) && errno != EEXIST)
+        die("Cannot create", dir);
+    snprintf(dir, sizeof(dir), "%s/protected", argv[optind]);
+    if (mkdir(dir, 0755) && errno != EEXIST)
+        die("Cannot create", dir);
+
+    // the files exist before the rules are enabled, the opens never create them
+    for (i = 0, cpu = 0; i < max_threads; i++, cpu++)
+    {
+        while (!CPU_ISSET(cpu, &online))
+            cpu++;
+        workers[i].cpu = cpu;
+        snprintf(workers[i].path, sizeof(workers[i].path), "%s/plain/thread_%d", argv[optind], i);
+        create_file(workers[i].path);
+    }
+    snprintf(dir, sizeof(dir), "%s/protected/shared", argv[optind]);
+    create_file(dir);
+
+    if (wait)
+    {
+        fprintf(stderr, "ready\n");
+        sigwait(&set, &sig);
+    }
+
+    for (workload = 0; workload < NUM_WORKLOADS; workload++)
+    {
+        for (i = 0; i < max_threads; i++)
+        {
+            if (workload == PRIVATE)
+                snprintf(workers[i].path, sizeof(workers[i].path), "%s/plain/thread_%d", argv[optind], i);
+            else
+                snprintf(workers[i].path, sizeof(workers[i].path), "%s/protected/shared", argv[optind]);
+            workers[i].denied = expect_denied && workload == SHARED;
+        }
+
+        for (threads = 1; threads <= max_threads; threads = threads * 2 > max_threads && threads < max_threads ? max_threads : threads * 2)
+        {
+            errors = 0;
+            for (r = 0; r < repeats; r++)
+                samples[r] = run(workers, threads, seconds, &errors);
+            qsort(samples, repeats, sizeof(*samples), compare_double);
+
+            printf("%s,%s,%d,%.0f,%.0f,%.0f,%.0f,%llu\n", config, workload_names[workload], threads, samples[repeats / 2],
+                   samples[repeats / 2] / threads, samples[0], samples[repeats - 1], (unsigned long long)errors);
+            fflush(stdout);
+        }
+    }
+
+    free(samples);
+    free(workers);
+
+    return EXIT_SUCCESS;
+}
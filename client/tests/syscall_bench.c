@@ -0,0 +1,321 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+
+/*
+ * Latency of the syscalls intercepted by the reference monitor hooks. Every operation runs on two
+ * targets under the base directory: plain/ (never blacklisted) and protected/ (blacklisted by
+ * run_bench.sh), so denied and allowed paths of each hook are measured separately. Files and
+ * directories the operations need are created before measuring; with --wait the benchmark stops
+ * after this setup until SIGUSR1, so that the rules can be enabled meanwhile (a write handle on a
+ * protected file can only be opened while the monitor is off).
+ *
+ * One CSV line per target and operation:
+ * config,target,op,iterations,errors,ops_per_sec,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns
+ * errors counts the calls that failed (EACCES when denied), they are measured as the others.
+ * With --expect-denied every operation on protected/ must fail with EACCES, the benchmark aborts
+ * otherwise (e.g. when the base directory is not where the rules match).
+ *
+ * Usage: syscall_bench [-n iterations] [-c config] [--header] [--wait] [--expect-denied] <base dir>
+ */
+
+#define DEFAULT_ITERATIONS 10000
+#define WRITE_SIZE 4096
+#define DIR_LEN 2048
+#define PATH_LEN (DIR_LEN + 64) /* room for the names of the files under a target */
+
+enum op
+{
+    OP_OPEN,
+    OP_WRITE,
+    OP_LSEEK,
+    OP_RENAME,
+    OP_UNLINK,
+    OP_MKDIR,
+    OP_RMDIR,
+    OP_LINK,
+    OP_SYMLINK,
+    NUM_OPS
+};
+
+static const char *op_names[NUM_OPS] = {"open", "write", "lseek", "rename", "unlink", "mkdir", "rmdir", "link", "symlink"};
+static const char *targets[] = {"plain", "protected"};
+
+struct target
+{
+    char dir[DIR_LEN];
+    int fd; /* write handle on dir/file, opened during the setup */
+    int protected;
+};
+
+static long iterations = DEFAULT_ITERATIONS;
+static int expect_denied;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void path_of(char *buf, size_t size, const struct target *t, const char *prefix, long i)
+{
+    int len;
+
+    if (i < 0)
+        len = snprintf(buf, size, "%s/%s", t->dir, prefix);
+    else
+        len = snprintf(buf, size, "%s/%s%ld", t->dir, prefix, i);
+
+    // cannot happen: dir is at most DIR_LEN bytes and the names are short
+    if (len < 0 || (size_t)len >= size)
+        abort();
+}
+
+static void die(const char *what, const char *path)
+{
+    fprintf(stderr, "%s %s: %s\n", what, path, strerror(errno));
+    exit(EXIT_FAILURE);
+}
+
+// create what the operations consume: the file, the sources of rename, unlink and rmdir
+static void setup(struct target *t)
+{
+    char path[PATH_LEN];
+    long i;
+    int fd;
+
+    if (mkdir(t->dir, 0755) && errno != EEXIST)
+        die("Cannot create", t->dir);
+
+    path_of(path, sizeof(path), t, "file", -1);
+    t->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (t->fd < 0)
+        die("Cannot create", path);
+
+    path_of(path, sizeof(path), t, "rename_a", -1);
+    fd = open(path, O_WRONLY | O_CREAT, 0644);
+    if (fd < 0)
+        die("Cannot create", path);
+    close(fd);
+
+    for (i = 0; i < iterations; i++)
+    {
+        path_of(path, sizeof(path), t, "unlink_", i);
+        fd = open(path, O_WRONLY | O_CREAT, 0644);
+        if (fd < 0)
+            die("Cannot create", path);
+        close(fd);
+
+        path_of(path, sizeof(path), t, "rmdir_", i);
+        if (mkdir(path, 0755) && errno != EEXIST)
+            die("Cannot create", path);
+    }
+}
+
+static int run_op(enum op op, struct target *t, long i, char *buf)
+{
+    char path[PATH_LEN], other[PATH_LEN];
+
+    switch (op)
+    {
+    case OP_OPEN:
+    {
+        int fd;
+
+        path_of(path, sizeof(path), t, "file", -1);
+        fd = open(path, O_WRONLY);
+        if (fd >= 0)
+            close(fd);
+        return fd >= 0 ? 0 : -1;
+    }
+    case OP_WRITE:
+        return write(t->fd, buf, WRITE_SIZE) == WRITE_SIZE ? 0 : -1;
+    case OP_LSEEK:
+        return lseek(t->fd, 0, SEEK_SET) == 0 ? 0 : -1;
+    case OP_RENAME:
+        // back and forth between two names
+        path_of(path, sizeof(path), t, i % 2 ? "rename_b" : "rename_a", -1);
+        path_of(other, sizeof(other), t, i % 2 ? "rename_a" : "rename_b", -1);
+        return rename(path, other);
+    case OP_UNLINK:
+        path_of(path, sizeof(path), t, "unlink_", i);
+        return unlink(path);
+    case OP_MKDIR:
+        path_of(path, sizeof(path), t, "mkdir_", i);
+        return mkdir(path, 0755);
+    case OP_RMDIR:
+        path_of(path, sizeof(path), t, "rmdir_", i);
+        return rmdir(path);
+    case OP_LINK:
+        path_of(path, sizeof(path), t, "file", -1);
+        path_of(other, sizeof(other), t, "link_", i);
+        return link(path, other);
+    case OP_SYMLINK:
+        path_of(other, sizeof(other), t, "symlink_", i);
+        return symlink("file", other);
+    default:
+        return -1;
+    }
+}
+
+static void measure(enum op op, struct target *t, const char *config, const char *target, uint64_t *samples, char *buf)
+{
+    uint64_t start, stop, begin, sum = 0;
+    long i, errors = 0;
+    double elapsed;
+    int ret, denied = expect_denied && t->protected;
+
+    begin = now_ns();
+    for (i = 0; i < iterations; i++)
+    {
+        start = now_ns();
+        ret = run_op(op, t, i, buf);
+        if (ret)
+            errors++;
+        if (denied && (ret == 0 || errno != EACCES))
+        {
+            fprintf(stderr, "%s on %s was not denied (%s), are the rules matching %s?\n", op_names[op], target,
+                    ret ? strerror(errno) : "success", t->dir);
+            exit(EXIT_FAILURE);
+        }
+        stop = now_ns();
+        samples[i] = stop - start;
+        sum += samples[i];
+
+        // keep the file small, outside of the measure
+        if (op == OP_WRITE && i % 256 == 255)
+            lseek(t->fd, 0, SEEK_SET);
+    }
+    elapsed = (now_ns() - begin) / 1e9;
+
+    qsort(samples, iterations, sizeof(*samples), compare_u64);
+    printf("%s,%s,%s,%ld,%ld,%.0f,%.0f,%llu,%llu,%llu,%llu,%llu\n", config, target, op_names[op], iterations, errors,
+           iterations / elapsed, (double)sum / iterations, (unsigned long long)samples[iterations * 50 / 100],
+           (unsigned long long)samples[iterations * 90 / 100], (unsigned long long)samples[iterations * 99 / 100],
+           (unsigned long long)samples[iterations * 999 / 1000], (unsigned long long)samples[iterations - 1]);
+    fflush(stdout);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-n iterations] [-c config] [--header] [--wait] [--expect-denied] <base dir>\n"
+                    "  measures %s on <base dir>/plain and <base dir>/protected\n",
+            name, "open(O_WRONLY), write(4K), lseek, rename, unlink, mkdir, rmdir, link, symlink");
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        {"iterations", required_argument, NULL, 'n'},
+        {"config", required_argument, NULL, 'c'},
+        {"header", no_argument, NULL, 'H'},
+        {"wait", no_argument, NULL, 'w'},
+        {"expect-denied", no_argument, NULL, 'e'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+    struct target t[2];
+    const char *config = "default";
+    uint64_t *samples;
+    char *buf;
+    int header = 0, wait = 0;
+    int opt, sig, i, op;
+    sigset_t set;
+
+    while ((opt = getopt_long(argc, argv, "n:c:h", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            iterations = strtol(optarg, NULL, 0);
+            break;
+        case 'c':
+            config = optarg;
+            break;
+        case 'H':
+            header = 1;
+            break;
+        case 'w':
+            wait = 1;
+            break;
+        case 'e':
+            expect_denied = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (optind != argc - 1 || iterations < 1)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (header)
+        printf("config,target,op,iterations,errors,ops_per_sec,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n");
+
+    // SIGUSR1 is waited for with sigwait, it must not kill the process meanwhile
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &set, NULL);
+
+    samples = malloc(iterations * sizeof(*samples));
+    buf = calloc(1, WRITE_SIZE);
+    if (!samples || !buf)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    if (mkdir(argv[optind], 0755) && errno != EEXIST)
+        die("Cannot create", argv[optind]);
+
+    for (i = 0; i < 2; i++)
+    {
+        if (snprintf(t[i].dir, sizeof(t[i].dir), "%s/%s", argv[optind], targets[i]) >= (int)sizeof(t[i].dir))
+        {
+            fprintf(stderr, "Base directory path too long\n");
+            return EXIT_FAILURE;
+        }
+        t[i].protected = i == 1;
+        setup(&t[i]);
+    }
+
+    if (wait)
+    {
+        fprintf(stderr, "ready\n");
+        sigwait(&set, &sig);
+    }
+
+    for (op = 0; op < NUM_OPS; op++)
+    {
+        for (i = 0; i < 2; i++)
+            measure(op, &t[i], config, targets[i], samples, buf);
+    }
+
+    close(t[0].fd);
+    close(t[1].fd);
+    free(samples);
+    free(buf);
+
+    return EXIT_SUCCESS;
+}
@@ -2,6 +2,6 @@ cd ../reference-monitor/user/
 gcc switch_reconfigure.c -o switch
 ./switch 2 1234
 gcc user.c
-./a.out
+./a.out 1234 $HOME/Desktop/rf/
 gcc remove.c
-./a.out
\ No newline at end of file
+./a.out 1234 $HOME/Desktop/rf/
\ No newline at end of file
@@ -2,6 +2,6 @@ cd ../reference-monitor/user/
 gcc switch_reconfigure.c -o switch
 sudo ./switch 2 1234
 gcc user.c
-sudo ./a.out
+sudo ./a.out 1234 $HOME/Desktop/rf/
 gcc remove.c
-sudo ./a.out
\ No newline at end of file
+sudo ./a.out 1234 $HOME/Desktop/rf/
\ No newline at end of file
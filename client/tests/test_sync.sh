@@ -0,0 +1,8 @@
+cd ../reference-monitor/user/
+gcc switch_reconfigure.c -o switch
+sudo ./switch 2 1234
+cd ../../client/
+make
+printf "%s\n" "$HOME/Desktop/rf/" "$HOME/Desktop/temp.txt" > /tmp/refmon_rules.txt
+sudo REFMON_PASSWORD=1234 ./client --sync /tmp/refmon_rules.txt
+sudo ./client --sync /tmp/refmon_rules.txt
\ No newline at end of file
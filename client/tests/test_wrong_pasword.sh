@@ -2,4 +2,4 @@ cd ../reference-monitor/user/
 gcc switch_reconfigure.c -o switch
 sudo ./switch 2 123
 gcc user.c
-sudo ./a.out
\ No newline at end of file
+sudo ./a.out 123 $HOME/Desktop/rf/
\ No newline at end of file
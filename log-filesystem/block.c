@@ -0,0 +1,295 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/buffer_head.h>
+#include <linux/types.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+#include <linux/file.h>
+#include <linux/sched/signal.h>
+#include <linux/capability.h>
+#include <linux/crc32c.h>
+#include <linux/mutex.h>
+
+#include "file_system.h"
+
+/*
+ * Block access of the file system. Blocks come from the buffer cache of the device or, for a RAM
+ * mount (mount -t singlefilefs -o ram,blocks=<n>[,segment_blocks=<n>|,compressed] none <dir>), from an
+ * in-memory image with the same layout as a device formatted by singlefilemakefs. The image of a
+ * RAM mount lives until unmount, ONEFILEFS_IOC_DUMP saves it to a file that can be mounted later.
+ */
+
+#define SINGLEFILEFS_RAM_DEFAULT_BLOCKS 1024
+
+int onefilefs_bread(struct onefilefs_fs_info *fsi, sector_t block, struct onefilefs_buf *buf)
+{
+    if (fsi->ram)
+    {
+        if (block >= fsi->device_blocks)
+            return -EIO;
+        buf->data = fsi->ram + block * fsi->sb->s_blocksize;
+        buf->bh = NULL;
+        return 0;
+    }
+
+    buf->bh = sb_bread(fsi->sb, block);
+    if (!buf->bh)
+        return -EIO;
+    buf->data = buf->bh->b_data;
+
+    return 0;
+}
+
+// get a block that is going to be fully rewritten: it is not read, its content is cleared
+int onefilefs_bnew(struct onefilefs_fs_info *fsi, sector_t block, struct onefilefs_buf *buf)
+{
+    if (fsi->ram)
+    {
+        if (block >= fsi->device_blocks)
+            return -EIO;
+        buf->data = fsi->ram + block * fsi->sb->s_blocksize;
+        buf->bh = NULL;
+        memset(buf->data, 0, fsi->sb->s_blocksize);
+        return 0;
+    }
+
+    buf->bh = sb_getblk(fsi->sb, block);
+    if (!buf->bh)
+        return -EIO;
+
+    lock_buffer(buf->bh);
+    memset(buf->bh->b_data, 0, buf->bh->b_size);
+    set_buffer_uptodate(buf->bh);
+    unlock_buffer(buf->bh);
+    buf->data = buf->bh->b_data;
+
+    return 0;
+}
+
+void onefilefs_bdirty(struct onefilefs_buf *buf)
+{
+    if (buf->bh)
+        mark_buffer_dirty(buf->bh);
+}
+
+void onefilefs_bsync(struct onefilefs_buf *buf)
+{
+    if (buf->bh)
+        sync_dirty_buffer(buf->bh);
+}
+
+void onefilefs_brelse(struct onefilefs_buf *buf)
+{
+    if (buf->bh)
+        brelse(buf->bh);
+    buf->bh = NULL;
+    buf->data = NULL;
+}
+
+// lay out a new image in memory, as singlefilemakefs does on a device
+static int onefilefs_ram_format(struct onefilefs_fs_info *fsi, uint64_t segment_blocks, int compressed)
+{
+    struct onefilefs_sb_info *sb_disk = (struct onefilefs_sb_info *)fsi->ram;
+    struct onefilefs_inode *file_inode;
+    struct onefilefs_index_entry *entry;
+    struct onefilefs_block_header *block_header;
+    struct onefilefs_frame_header *frame_header;
+    size_t len = strlen(SINGLEFILEFS_LOG_HEADER);
+    uint64_t data_blocks;
+    char *data;
+    int ret;
+
+    ret = singlefilefs_format_sb(sb_disk, fsi->device_blocks, DEFAULT_BLOCK_SIZE, segment_blocks, compressed, &data_blocks);
+    if (ret)
+    {
+        pr_err("%s: [ERROR] Cannot format a RAM image of %llu blocks (error %d)\n", MOD_NAME, fsi->device_blocks, ret);
+        return -EINVAL;
+    }
+
+    // the data region is a single extent
+    file_inode = (struct onefilefs_inode *)(fsi->ram + SINGLEFILEFS_INODES_BLOCK_NUMBER * DEFAULT_BLOCK_SIZE);
+    file_inode->mode = S_IFREG;
+    file_inode->inode_no = SINGLEFILEFS_FILE_INODE_NUMBER;
+    file_inode->file_size = len;
+    file_inode->data_block_number = data_blocks;
+    file_inode->extents_count = 1;
+    file_inode->extents[0].start = sb_disk->data_start;
+    file_inode->extents[0].length = data_blocks;
+
+    // sparse index: the first block holds the header line, not an indexed record
+    entry = (struct onefilefs_index_entry *)(fsi->ram + sb_disk->index_start * DEFAULT_BLOCK_SIZE);
+    entry->records = 1;
+    entry->min_tgid = U32_MAX;
+
+    data = fsi->ram + sb_disk->data_start * DEFAULT_BLOCK_SIZE;
+    if (compressed)
+    {
+        frame_header = (struct onefilefs_frame_header *)data;
+        frame_header->length = len;
+        frame_header->raw_length = len;
+        frame_header->block = 0;
+        memcpy(data + sizeof(*frame_header), SINGLEFILEFS_LOG_HEADER, len);
+        frame_header->crc = onefilefs_frame_crc(fsi, frame_header, data + sizeof(*frame_header));
+    }
+    else
+    {
+        block_header = (struct onefilefs_block_header *)data;
+        block_header->used = len;
+        block_header->seq = 0;
+        memcpy(data + sizeof(*block_header), SINGLEFILEFS_LOG_HEADER, len);
+        block_header->crc = onefilefs_block_crc(fsi, crc32c(~0, data + sizeof(*block_header), len), block_header);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Allocate and format the image of a RAM mount according to the mount options
+ * @return 0 on success, a negative error code otherwise
+ */
+int onefilefs_ram_init(struct onefilefs_fs_info *fsi, char *options)
+{
+    uint64_t blocks = SINGLEFILEFS_RAM_DEFAULT_BLOCKS;
+    uint64_t segment_blocks = 0;
+    int compressed = 0;
+    char *copy, *cursor, *option;
+    int ret = 0;
+
+    copy = kstrdup(options ? options : "", GFP_KERNEL);
+    if (!copy)
+        return -ENOMEM;
+
+    cursor = copy;
+    while ((option = strsep(&cursor, ",")) != NULL)
+    {
+        if (!*option || !strcmp(option, "ram"))
+            continue;
+
+        if (!strncmp(option, "blocks=", 7))
+            ret = kstrtoull(option + 7, 0, &blocks);
+        else if (!strncmp(option, "segment_blocks=", 15))
+            ret = kstrtoull(option + 15, 0, &segment_blocks);
+        else if (!strcmp(option, "compressed"))
+            compressed = 1;
+        else
+            ret = -EINVAL;
+
+        if (ret)
+        {
+            pr_err("%s: [ERROR] Invalid mount option %s\n", MOD_NAME, option);
+            break;
+        }
+    }
+    kfree(copy);
+
+    if (ret)
+        return ret;
+
+    if (compressed && segment_blocks)
+    {
+        pr_err("%s: [ERROR] A compressed log cannot be circular\n", MOD_NAME);
+        return -EINVAL;
+    }
+
+    if (blocks > SIZE_MAX / DEFAULT_BLOCK_SIZE)
+        return -EINVAL;
+
+    fsi->ram = vzalloc(blocks * DEFAULT_BLOCK_SIZE);
+    if (!fsi->ram)
+    {
+        pr_err("%s: [ERROR] Unable to allocate a RAM image of %llu blocks\n", MOD_NAME, blocks);
+        return -ENOMEM;
+    }
+    fsi->device_blocks = blocks;
+
+    ret = onefilefs_ram_format(fsi, segment_blocks, compressed);
+    if (ret)
+        onefilefs_ram_exit(fsi);
+
+    return ret;
+}
+
+void onefilefs_ram_exit(struct onefilefs_fs_info *fsi)
+{
+    vfree(fsi->ram);
+    fsi->ram = NULL;
+}
+
+/**
+ * @brief Write the whole image of the file system to the file descriptor fd, from its beginning
+ * @return 0 on success, a negative error code otherwise
+ */
+long onefilefs_dump(struct onefilefs_fs_info *fsi, int fd)
+{
+    struct onefilefs_buf buf;
+    struct file *file;
+    sector_t block;
+    ssize_t written;
+    loff_t pos = 0;
+    long ret = 0;
+
+    if (!capable(CAP_SYS_ADMIN))
+        return -EPERM;
+
+    file = fget(fd);
+    if (!file)
+        return -EBADF;
+
+    if (!(file->f_mode & FMODE_WRITE))
+    {
+        ret = -EBADF;
+        goto out;
+    }
+
+    /*
+     * No singlefilefs log can receive the image, this one or the one of another mount: appends take the
+     * global lock held while dumping, which keeps the image consistent.
+     */
+    if (file_inode(file)->i_sb->s_type == fsi->sb->s_type)
+    {
+        ret = -EINVAL;
+        goto out;
+    }
+
+    mutex_lock(&mutex);
+
+    // records held in memory by a compressed log are part of the image
+    if (fsi->flags & SINGLEFILEFS_FLAG_COMPRESSED)
+    {
+        ret = onefilefs_compress_flush(fsi);
+        if (ret)
+            goto unlock;
+    }
+
+    for (block = 0; block < fsi->device_blocks; block++)
+    {
+        ret = onefilefs_bread(fsi, block, &buf);
+        if (ret)
+            break;
+
+        written = kernel_write(file, buf.data, fsi->sb->s_blocksize, &pos);
+        onefilefs_brelse(&buf);
+        if (written != fsi->sb->s_blocksize)
+        {
+            ret = written < 0 ? written : -EIO;
+            break;
+        }
+
+        if (fatal_signal_pending(current))
+        {
+            ret = -EINTR;
+            break;
+        }
+    }
+
+    if (!ret)
+        printk("%s: [INFO] Image of %llu blocks dumped\n", MOD_NAME, fsi->device_blocks);
+
+unlock:
+    mutex_unlock(&mutex);
+out:
+    fput(file);
+    return ret;
+}
@@ -0,0 +1,478 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/buffer_head.h>
+#include <linux/types.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/crypto.h>
+#include <linux/workqueue.h>
+#include <linux/mutex.h>
+#include <linux/mm.h>
+#include <linux/crc32c.h>
+
+#include "file_system.h"
+
+/*
+ * Compressed mode of the log. Records accumulate in an in-memory logical block (the stage): when the
+ * block is complete, when the flush interval expires or when the file system is synced, the stage is
+ * compressed with LZ4 and written as a frame at the end of the data region. A partial block is
+ * rewritten in place at each flush, until it is complete (or closed by padding, then written as a whole
+ * block) and the next frame starts right after it.
+ * Frames are checksummed: at mount time the frames following the ones described by the superblock
+ * are scanned, so that the records flushed right before a crash are not lost.
+ */
+
+#define MAP_ENTRIES_PER_BLOCK(fsi) ((fsi)->block_size / sizeof(uint64_t))
+
+MODULE_SOFTDEP("pre: lz4");
+
+// copy len bytes from/to the data region starting at byte offset pos, crossing blocks if needed
+static int onefilefs_data_io(struct onefilefs_fs_info *fsi, uint64_t pos, char *buf, size_t len, int write)
+{
+    struct onefilefs_buf block_buf;
+    sector_t block;
+    size_t offset, chunk;
+    int ret;
+
+    while (len)
+    {
+        block = onefilefs_device_block(fsi, pos / fsi->block_size);
+        offset = pos % fsi->block_size;
+        chunk = min_t(size_t, len, fsi->block_size - offset);
+
+        // frames are appended: bytes after the one being written are not used yet
+        if (write && offset == 0)
+            ret = onefilefs_bnew(fsi, block, &block_buf);
+        else
+            ret = onefilefs_bread(fsi, block, &block_buf);
+        if (ret)
+            return ret;
+
+        if (write)
+        {
+            memcpy(block_buf.data + offset, buf, chunk);
+            onefilefs_bdirty(&block_buf);
+        }
+        else
+        {
+            memcpy(buf, block_buf.data + offset, chunk);
+        }
+        onefilefs_brelse(&block_buf);
+
+        pos += chunk;
+        buf += chunk;
+        len -= chunk;
+    }
+
+    return 0;
+}
+
+static int onefilefs_map_get(struct onefilefs_fs_info *fsi, uint64_t logical_block, uint64_t *frame)
+{
+    struct onefilefs_buf buf;
+    int ret;
+
+    ret = onefilefs_bread(fsi, SINGLEFILEFS_DATA_BLOCK_NUMBER + logical_block / MAP_ENTRIES_PER_BLOCK(fsi), &buf);
+    if (ret)
+        return ret;
+
+    *frame = ((uint64_t *)buf.data)[logical_block % MAP_ENTRIES_PER_BLOCK(fsi)];
+    onefilefs_brelse(&buf);
+
+    return 0;
+}
+
+static int onefilefs_map_set(struct onefilefs_fs_info *fsi, uint64_t logical_block, uint64_t frame)
+{
+    struct onefilefs_buf buf;
+    int ret;
+
+    ret = onefilefs_bread(fsi, SINGLEFILEFS_DATA_BLOCK_NUMBER + logical_block / MAP_ENTRIES_PER_BLOCK(fsi), &buf);
+    if (ret)
+        return ret;
+
+    ((uint64_t *)buf.data)[logical_block % MAP_ENTRIES_PER_BLOCK(fsi)] = frame;
+    onefilefs_bdirty(&buf);
+    onefilefs_brelse(&buf);
+
+    return 0;
+}
+
+// CRC32C of a frame, see struct onefilefs_frame_header
+uint32_t onefilefs_frame_crc(struct onefilefs_fs_info *fsi, const struct onefilefs_frame_header *header, const char *payload)
+{
+    uint32_t crc = crc32c(~0, payload, header->length);
+
+    crc = crc32c(crc, &header->block, sizeof(header->block));
+    crc = crc32c(crc, &header->raw_length, sizeof(header->raw_length));
+    crc = crc32c(crc, &header->length, sizeof(header->length));
+    if (fsi->format_id)
+        crc = crc32c(crc, &fsi->format_id, sizeof(fsi->format_id));
+    return crc;
+}
+
+/*
+ * Decompress the frame of logical_block at data region offset frame into dst (a whole logical block).
+ * Returns -EBADMSG if there is no valid frame of that block there.
+ */
+static int onefilefs_load_frame(struct onefilefs_fs_info *fsi, uint64_t frame, uint64_t logical_block, char *dst,
+                                uint64_t *frame_len, uint64_t *raw_length)
+{
+    struct onefilefs_frame_header *header = (struct onefilefs_frame_header *)fsi->scratch;
+    unsigned int dlen = fsi->block_size;
+    int ret;
+
+    if (frame + sizeof(*header) > fsi->segment_blocks * fsi->block_size)
+        return -EBADMSG;
+
+    ret = onefilefs_data_io(fsi, frame, fsi->scratch, sizeof(*header), 0);
+    if (ret)
+        return ret;
+
+    if (header->raw_length == 0 || header->raw_length > fsi->block_size || header->length > header->raw_length ||
+        header->block != (uint32_t)logical_block ||
+        frame + sizeof(*header) + header->length > fsi->segment_blocks * fsi->block_size)
+        return -EBADMSG;
+
+    ret = onefilefs_data_io(fsi, frame + sizeof(*header), fsi->scratch + sizeof(*header), header->length, 0);
+    if (ret)
+        return ret;
+
+    if (header->crc != onefilefs_frame_crc(fsi, header, fsi->scratch + sizeof(*header)))
+        return -EBADMSG;
+
+    memset(dst, 0, fsi->block_size);
+
+    if (header->length == header->raw_length)
+    {
+        memcpy(dst, fsi->scratch + sizeof(*header), header->length);
+    }
+    else
+    {
+        ret = crypto_comp_decompress(fsi->comp_tfm, fsi->scratch + sizeof(*header), header->length, dst, &dlen);
+        if (ret || dlen != header->raw_length)
+        {
+            pr_err("%s: [ERROR] Failed to decompress the frame at offset %llu\n", MOD_NAME, frame);
+            return -EIO;
+        }
+    }
+
+    if (frame_len)
+        *frame_len = sizeof(*header) + header->length;
+    if (raw_length)
+        *raw_length = header->raw_length;
+
+    return 0;
+}
+
+// write the first raw_length bytes of the stage as the frame of its logical block
+static int onefilefs_compress_write(struct onefilefs_fs_info *fsi, uint64_t raw_length)
+{
+    struct onefilefs_frame_header *header = (struct onefilefs_frame_header *)fsi->scratch;
+    unsigned int dlen = fsi->block_size;
+    int ret;
+
+    // incompressible blocks are stored as they are
+    ret = crypto_comp_compress(fsi->comp_tfm, fsi->stage, raw_length, fsi->scratch + sizeof(*header), &dlen);
+    if (ret || dlen >= raw_length)
+    {
+        memcpy(fsi->scratch + sizeof(*header), fsi->stage, raw_length);
+        dlen = raw_length;
+    }
+
+    header->length = dlen;
+    header->raw_length = raw_length;
+    header->block = (uint32_t)fsi->stage_block;
+    header->crc = onefilefs_frame_crc(fsi, header, fsi->scratch + sizeof(*header));
+
+    if (fsi->stage_frame + sizeof(*header) + dlen > fsi->segment_blocks * fsi->block_size)
+    {
+        pr_err("%s: [ERROR] No space left in the data region for a new frame\n", MOD_NAME);
+        return -ENOSPC;
+    }
+
+    ret = onefilefs_data_io(fsi, fsi->stage_frame, fsi->scratch, sizeof(*header) + dlen, 1);
+    if (ret)
+        return ret;
+
+    if (fsi->stage_frame_len == 0)
+    {
+        ret = onefilefs_map_set(fsi, fsi->stage_block, fsi->stage_frame);
+        if (ret)
+            return ret;
+    }
+
+    fsi->stage_frame_len = sizeof(*header) + dlen;
+    fsi->stage_dirty = false;
+
+    // the superblock only describes what has reached the frames
+    fsi->disk_sb->tail_bytes = fsi->stage_block * fsi->block_size + raw_length;
+    fsi->disk_sb->frame_bytes = fsi->stage_frame + fsi->stage_frame_len;
+    onefilefs_bdirty(&fsi->sb_buf);
+
+    // the cache may hold an older copy of the stage
+    if (fsi->cached_block == fsi->stage_block)
+        fsi->cached_block = U64_MAX;
+
+    return 0;
+}
+
+/**
+ * @brief Write the stage as the frame of its logical block (call with the fs mutex held)
+ */
+int onefilefs_compress_flush(struct onefilefs_fs_info *fsi)
+{
+    if (!fsi->stage_dirty)
+        return 0;
+
+    return onefilefs_compress_write(fsi, min_t(uint64_t, fsi->tail_bytes - fsi->stage_block * fsi->block_size,
+                                               fsi->block_size));
+}
+
+static void onefilefs_flush_work(struct work_struct *work)
+{
+    struct onefilefs_fs_info *fsi = container_of(to_delayed_work(work), struct onefilefs_fs_info, flush_work);
+
+    mutex_lock(&mutex);
+    if (onefilefs_compress_flush(fsi))
+        pr_err("%s: [ERROR] Deferred flush of the compressed block failed\n", MOD_NAME);
+    mutex_unlock(&mutex);
+}
+
+/**
+ * @brief Append len bytes at logical offset pos (call with the fs mutex held)
+ * @return 0 on success, a negative error code otherwise
+ */
+int onefilefs_compress_append(struct onefilefs_fs_info *fsi, uint64_t pos, const char *data, size_t len)
+{
+    uint64_t logical_block = pos / fsi->block_size;
+    uint64_t staged = fsi->tail_bytes - fsi->stage_block * fsi->block_size;
+    int ret;
+
+    if (logical_block != fsi->stage_block)
+    {
+        /*
+         * The stage block is complete: its frame becomes final and the next one starts after it. A block
+         * closed by padding is written again as a whole, the padding being zeros, so that only the last
+         * frame of the log can be partial.
+         */
+        if (staged && staged < fsi->block_size)
+            fsi->stage_dirty = true;
+        if (fsi->stage_dirty)
+        {
+            ret = onefilefs_compress_write(fsi, fsi->block_size);
+            if (ret)
+                return ret;
+        }
+
+        fsi->stage_frame += fsi->stage_frame_len;
+        fsi->stage_frame_len = 0;
+        fsi->stage_block = logical_block;
+        memset(fsi->stage, 0, fsi->block_size);
+    }
+
+    memcpy(fsi->stage + pos % fsi->block_size, data, len);
+    fsi->stage_dirty = true;
+
+    return 0;
+}
+
+// called after the boundaries have been updated: flush complete blocks, defer partial ones
+void onefilefs_compress_schedule(struct onefilefs_fs_info *fsi)
+{
+    if (fsi->tail_bytes % fsi->block_size == 0)
+    {
+        if (onefilefs_compress_flush(fsi))
+            pr_err("%s: [ERROR] Flush of the compressed block failed\n", MOD_NAME);
+        return;
+    }
+
+    schedule_delayed_work(&fsi->flush_work, SINGLEFILEFS_FLUSH_INTERVAL);
+}
+
+/**
+ * @brief Read at most up to the end of the logical block holding off (call with the fs mutex held)
+ */
+ssize_t onefilefs_compress_read(struct onefilefs_fs_info *fsi, char __user *buf, size_t len, loff_t off)
+{
+    uint64_t logical_block = off / fsi->block_size;
+    uint64_t frame;
+    char *source;
+    int ret;
+
+    if (logical_block == fsi->stage_block)
+    {
+        source = fsi->stage;
+    }
+    else
+    {
+        if (fsi->cached_block != logical_block)
+        {
+            ret = onefilefs_map_get(fsi, logical_block, &frame);
+            if (ret)
+                return ret;
+
+            ret = onefilefs_load_frame(fsi, frame, logical_block, fsi->cache, NULL, NULL);
+            if (ret)
+            {
+                if (ret == -EBADMSG)
+                {
+                    pr_err("%s: [ERROR] Corrupted frame of block %llu at offset %llu\n", MOD_NAME, logical_block, frame);
+                    ret = -EIO;
+                }
+                fsi->cached_block = U64_MAX;
+                return ret;
+            }
+            fsi->cached_block = logical_block;
+        }
+        source = fsi->cache;
+    }
+
+    return len - copy_to_user(buf, source + off % fsi->block_size, len);
+}
+
+/*
+ * Rebuild the stage from the frames on the device. The superblock tells where the last flushed frame
+ * was: a partial block is rewritten in place, so its frame is checked again, then complete blocks may
+ * be followed by frames that reached the device after the superblock. The scan stops at the first
+ * position without a valid frame of the next block, or at a partial frame not followed by one.
+ */
+static int onefilefs_compress_recover(struct onefilefs_fs_info *fsi)
+{
+    uint64_t logical_block = fsi->tail_bytes / fsi->block_size;
+    uint64_t frame = fsi->disk_sb->frame_bytes;
+    uint64_t hint = fsi->tail_bytes;
+    uint64_t frame_len, raw_length, mapped;
+    int ret;
+
+    if (fsi->tail_bytes % fsi->block_size)
+    {
+        ret = onefilefs_map_get(fsi, logical_block, &frame);
+        if (ret)
+            return ret;
+    }
+
+    fsi->stage_block = logical_block;
+    fsi->stage_frame = frame;
+    fsi->stage_frame_len = 0;
+    fsi->tail_bytes = logical_block * fsi->block_size;
+
+    while (fsi->tail_bytes < fsi->segment_bytes)
+    {
+        ret = onefilefs_load_frame(fsi, frame, logical_block, fsi->stage, &frame_len, &raw_length);
+        if (ret == -EBADMSG)
+            break;
+        if (ret)
+            return ret;
+
+        ret = onefilefs_map_get(fsi, logical_block, &mapped);
+        if (!ret && mapped != frame)
+            ret = onefilefs_map_set(fsi, logical_block, frame);
+        if (ret)
+            return ret;
+        onefilefs_index_rebuild(fsi, logical_block, fsi->stage, raw_length);
+
+        fsi->tail_bytes = logical_block * fsi->block_size + raw_length;
+        if (raw_length < fsi->block_size)
+        {
+            // images written before blocks closed by padding got whole frames may continue after a partial one
+            ret = onefilefs_load_frame(fsi, frame + frame_len, logical_block + 1, fsi->cache, NULL, NULL);
+            if (ret && ret != -EBADMSG)
+                return ret;
+            if (ret)
+            {
+                // the last partial block goes back to the stage and will be rewritten in place
+                fsi->stage_frame_len = frame_len;
+                break;
+            }
+            fsi->tail_bytes = (logical_block + 1) * fsi->block_size;
+        }
+
+        logical_block++;
+        frame += frame_len;
+        fsi->stage_block = logical_block;
+        fsi->stage_frame = frame;
+    }
+
+    if (fsi->stage_frame_len == 0)
+        memset(fsi->stage, 0, fsi->block_size);
+
+    fsi->file_size = fsi->tail_bytes;
+    if (fsi->tail_bytes != hint)
+    {
+        printk("%s: [INFO] Compressed log tail recovered at byte %llu (hint was byte %llu)\n", MOD_NAME,
+               fsi->tail_bytes, hint);
+        fsi->disk_sb->tail_bytes = fsi->tail_bytes;
+        fsi->disk_sb->frame_bytes = fsi->stage_frame + fsi->stage_frame_len;
+        onefilefs_bdirty(&fsi->sb_buf);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Allocate the LZ4 transform and the buffers, and reload the last partial block in the stage
+ */
+int onefilefs_compress_init(struct super_block *sb, struct onefilefs_fs_info *fsi)
+{
+    int ret;
+
+    fsi->cached_block = U64_MAX;
+    INIT_DELAYED_WORK(&fsi->flush_work, onefilefs_flush_work);
+
+    fsi->comp_tfm = crypto_alloc_comp("lz4", 0, 0);
+    if (IS_ERR(fsi->comp_tfm))
+    {
+        pr_err("%s: [ERROR] Failed to allocate the lz4 transform\n", MOD_NAME);
+        ret = PTR_ERR(fsi->comp_tfm);
+        fsi->comp_tfm = NULL;
+        return ret;
+    }
+
+    fsi->stage = kvzalloc(fsi->block_size, GFP_KERNEL);
+    fsi->cache = kvmalloc(fsi->block_size, GFP_KERNEL);
+    // room for blocks that do not compress
+    fsi->scratch = kvmalloc(sizeof(struct onefilefs_frame_header) + 2 * fsi->block_size, GFP_KERNEL);
+    if (!fsi->stage || !fsi->cache || !fsi->scratch)
+    {
+        ret = -ENOMEM;
+        goto fail;
+    }
+
+    ret = onefilefs_compress_recover(fsi);
+    if (ret)
+        goto fail;
+
+    return 0;
+
+fail:
+    onefilefs_compress_exit(fsi);
+    return ret;
+}
+
+/**
+ * @brief Flush the stage and release the compressed mode state
+ */
+void onefilefs_compress_exit(struct onefilefs_fs_info *fsi)
+{
+    if (fsi->stage)
+    {
+        cancel_delayed_work_sync(&fsi->flush_work);
+
+        mutex_lock(&mutex);
+        if (onefilefs_compress_flush(fsi))
+            pr_err("%s: [ERROR] Final flush of the compressed block failed, last records are lost\n", MOD_NAME);
+        mutex_unlock(&mutex);
+    }
+
+    kvfree(fsi->stage);
+    kvfree(fsi->cache);
+    kvfree(fsi->scratch);
+    fsi->stage = fsi->cache = fsi->scratch = NULL;
+
+    if (fsi->comp_tfm)
+        crypto_free_comp(fsi->comp_tfm);
+    fsi->comp_tfm = NULL;
+}
@@ -11,11 +11,11 @@
 
 #include "file_system.h"
 
-// this iterate function just returns 3 entries: . and .. and then the name of the unique file of the file system
+// this iterate function just returns 4 entries: . and .. and then the names of the unique file of the file system and of its index
 static int onefilefs_iterate(struct file *file, struct dir_context *ctx)
 {
-	if (ctx->pos >= (2 + 1))
-		return 0; // we cannot return more than . and .. and the unique file entry
+	if (ctx->pos >= (2 + 2))
+		return 0; // we cannot return more than . and .. and the unique file and index entries
 
 	if (ctx->pos == 0)
 	{
@@ -43,7 +43,18 @@ static int onefilefs_iterate(struct file *file, struct dir_context *ctx)
 	}
 	if (ctx->pos == 2)
 	{
-		if (!dir_emit(ctx, UNIQUE_FILE_NAME, FILENAME_MAXLEN, SINGLEFILEFS_FILE_INODE_NUMBER, DT_UNKNOWN))
+		if (!dir_emit(ctx, UNIQUE_FILE_NAME, strlen(UNIQUE_FILE_NAME), SINGLEFILEFS_FILE_INODE_NUMBER, DT_UNKNOWN))
+		{
+			return 0;
+		}
+		else
+		{
+			ctx->pos++;
+		}
+	}
+	if (ctx->pos == 3)
+	{
+		if (!dir_emit(ctx, INDEX_FILE_NAME, strlen(INDEX_FILE_NAME), SINGLEFILEFS_INDEX_INODE_NUMBER, DT_UNKNOWN))
 		{
 			return 0;
 		}
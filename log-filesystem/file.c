@@ -10,54 +10,140 @@
 #include <linux/version.h>
 #include <linux/uio.h>
 #include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
 
 #define DEF_LOCK
 #include "file_system.h"
 
+/*
+ * Map a logical offset of the unique file onto the block of the data region holding it. The file
+ * starts at the head segment and, in circular mode, wraps around the ring of segments.
+ */
+uint64_t onefilefs_region_block_of(struct onefilefs_fs_info *fsi, loff_t off)
+{
+    uint64_t segment = (fsi->head_segment + off / fsi->segment_bytes) % fsi->segments_count;
+    uint64_t block = (off % fsi->segment_bytes) / fsi->block_payload;
+
+    return segment * fsi->segment_blocks + block;
+}
+
+// Map a block of the data region onto its device block through the extent table of the file
+sector_t onefilefs_device_block(struct onefilefs_fs_info *fsi, uint64_t region_block)
+{
+    uint64_t i;
+
+    for (i = 0; i < fsi->extents_count; i++)
+    {
+        if (region_block < fsi->extents[i].length)
+            return fsi->extents[i].start + region_block;
+        region_block -= fsi->extents[i].length;
+    }
+
+    // out of the data region: the buffer cache refuses the block and the caller gets -EIO
+    return (sector_t)-1;
+}
+
+// state of a reader following the log (file private data), released with the file
+struct onefilefs_follower {
+    bool enabled;
+    uint64_t dropped_bytes; // fsi->dropped_bytes when the offset of the reader was last adjusted
+};
+
+// Publish the log boundaries in the pinned superblock (legacy images keep the original layout)
+static void onefilefs_sync_boundaries(struct onefilefs_fs_info *fsi)
+{
+    if (fsi->disk_sb->version == SINGLEFILEFS_LEGACY_VERSION)
+        return;
+
+    fsi->disk_sb->head_segment = fsi->head_segment;
+    fsi->disk_sb->tail_segment = fsi->tail_segment;
+    fsi->disk_sb->tail_bytes = fsi->tail_bytes;
+    fsi->disk_sb->tail_seq = fsi->tail_seq;
+    onefilefs_bdirty(&fsi->sb_buf);
+}
+
 ssize_t onefilefs_read(struct file *filp, char __user *buf, size_t len, loff_t *off)
 {
 
-    struct buffer_head *bh = NULL;
+    struct onefilefs_buf block_buf;
     struct inode *the_inode = filp->f_inode;
-    uint64_t file_size = the_inode->i_size;
+    struct onefilefs_fs_info *fsi = ONEFILEFS_SB(the_inode->i_sb);
+    struct onefilefs_follower *follower = filp->private_data;
+    uint64_t file_size, dropped;
     int ret;
     loff_t offset;
-    int block_to_read; // index of the block to be read from device
-
-    printk("%s: [INFO] Read operation called with len %ld - and offset %lld (the current file size is %lld)", MOD_NAME, len, *off, file_size);
+    sector_t block_to_read; // index of the block to be read from device
 
     mutex_lock(&mutex);
 
+retry:
+    // the head of a circular log may move forward, size and mapping are read under the lock
+    file_size = i_size_read(the_inode);
+
+    if (follower && follower->enabled && follower->dropped_bytes != fsi->dropped_bytes)
+    {
+        // keep a follower on the same record when the head of the log moves forward
+        dropped = fsi->dropped_bytes - follower->dropped_bytes;
+        *off = *off > dropped ? *off - dropped : 0;
+        follower->dropped_bytes = fsi->dropped_bytes;
+    }
+
+    printk("%s: [INFO] Read operation called with len %ld - and offset %lld (the current file size is %lld)", MOD_NAME, len, *off, file_size);
+
     // check that *off is within boundaries
     if (*off >= file_size)
     {
         mutex_unlock(&mutex);
-        return 0;
+
+        if (!follower || !follower->enabled || (filp->f_flags & O_NONBLOCK))
+            return 0;
+
+        // a follower at the end of the file sleeps until onefile_write publishes new bytes
+        dropped = follower->dropped_bytes;
+        ret = wait_event_interruptible(fsi->append_wq,
+                                       READ_ONCE(fsi->file_size) > *off || READ_ONCE(fsi->dropped_bytes) != dropped ||
+                                       !READ_ONCE(follower->enabled));
+        if (ret)
+            return ret;
+
+        mutex_lock(&mutex);
+        goto retry;
     }
     else if (*off + len > file_size)
         len = file_size - *off;
 
     // determine the block level offset for the operation
-    offset = *off % DEFAULT_BLOCK_SIZE;
+    offset = *off % fsi->block_payload;
     // just read stuff in a single block - residuals will be managed at the applicatin level
-    if (offset + len > DEFAULT_BLOCK_SIZE)
-        len = DEFAULT_BLOCK_SIZE - offset;
+    if (offset + len > fsi->block_payload)
+        len = fsi->block_payload - offset;
+
+    if (fsi->flags & SINGLEFILEFS_FLAG_COMPRESSED)
+    {
+        // logical blocks are decompressed on the fly
+        ret = onefilefs_compress_read(fsi, buf, len, *off);
+        if (ret > 0)
+            *off += ret;
+        mutex_unlock(&mutex);
+        return ret;
+    }
 
     // compute the actual index of the the block to be read from device
-    block_to_read = *off / DEFAULT_BLOCK_SIZE + 2; // the value 2 accounts for superblock and file-inode on device
+    block_to_read = onefilefs_device_block(fsi, onefilefs_region_block_of(fsi, *off));
 
-    printk("%s: [INFO] Read operation must access block %d of the device", MOD_NAME, block_to_read);
+    printk("%s: [INFO] Read operation must access block %llu of the device", MOD_NAME, (unsigned long long)block_to_read);
 
-    bh = (struct buffer_head *)sb_bread(filp->f_path.dentry->d_inode->i_sb, block_to_read);
-    if (!bh)
+    ret = onefilefs_bread(fsi, block_to_read, &block_buf);
+    if (ret)
     {
         mutex_unlock(&mutex);
-        return -EIO;
+        return ret;
     }
 
-    ret = copy_to_user(buf, bh->b_data + offset, len);
+    ret = copy_to_user(buf, block_buf.data + fsi->block_header + offset, len);
     *off += (len - ret);
-    brelse(bh);
+    onefilefs_brelse(&block_buf);
 
     mutex_unlock(&mutex);
     return len - ret;
@@ -66,91 +152,214 @@ ssize_t onefilefs_read(struct file *filp, char __user *buf, size_t len, loff_t *
 ssize_t onefile_write(struct kiocb *iocb, struct iov_iter *from)
 {
 
-    loff_t block_offset, offset;
-    int block_to_write;
-    struct buffer_head *bh = NULL;
+    loff_t block_offset;
+    sector_t block_to_write;
+    struct onefilefs_buf block_buf;
     size_t copied_bytes;
     size_t payload;
     struct file *file;
     struct inode *the_inode;
+    struct onefilefs_fs_info *fsi;
     uint64_t file_size;
+    uint64_t head_segment, tail_segment, tail_bytes;
+    uint64_t dropped_bytes;
+    uint64_t region_block;
+    uint64_t tail_seq;
+    uint32_t tail_crc;
+    struct onefilefs_block_header *header;
+    ssize_t ret;
     char *data;
 
-    mutex_lock(&mutex);
-
     file = iocb->ki_filp;
     the_inode = file->f_inode;
-    offset = file->f_pos;
-    file_size = i_size_read(the_inode);
+    fsi = ONEFILEFS_SB(the_inode->i_sb);
 
     // byte size of the payload
-    payload = from->count;
+    payload = iov_iter_count(from);
+    if (payload == 0)
+        return 0;
+
+    // a record never straddles two blocks
+    if (payload > fsi->block_payload)
+        return -EFBIG;
 
     data = kmalloc(payload, GFP_KERNEL);
     if (!data)
     {
         pr_err("%s: [ERROR] Error in kmalloc allocation\n", MOD_NAME);
-        mutex_unlock(&mutex);
-        return 0;
+        return -ENOMEM;
     }
 
     copied_bytes = _copy_from_iter((void *)data, payload, from);
     if (copied_bytes != payload)
     {
         pr_err("%s: [ERROR] Failed to copy %ld bytes from iov_iter\n", MOD_NAME, payload);
-        mutex_unlock(&mutex);
-        return 0;
+        kfree(data);
+        return -EFAULT;
     }
 
-    pr_info("%s: [INFO] Trying to write string: %s", MOD_NAME, data);
+    pr_info("%s: [INFO] Trying to write string: %.*s", MOD_NAME, (int)payload, data);
 
-    offset = file_size;
-
-    // Append only
-    block_offset = offset % DEFAULT_BLOCK_SIZE;
-    block_to_write = offset / DEFAULT_BLOCK_SIZE + 2; // + superblock + inode
+    mutex_lock(&mutex);
 
-    if (4096 - block_offset < payload)
+    file_size = i_size_read(the_inode);
+    head_segment = fsi->head_segment;
+    tail_segment = fsi->tail_segment;
+    tail_bytes = fsi->tail_bytes;
+    tail_seq = fsi->tail_seq;
+    tail_crc = fsi->tail_crc;
+    dropped_bytes = fsi->dropped_bytes;
+
+    // Append only: skip the residual of the tail block if the record does not fit in it
+    block_offset = tail_bytes % fsi->block_payload;
+    if (block_offset && fsi->block_payload - block_offset < payload)
     {
-        block_to_write++;
-        offset += (4096 - block_offset);
+        tail_bytes += fsi->block_payload - block_offset;
+        file_size += fsi->block_payload - block_offset;
         block_offset = 0;
     }
 
-    bh = sb_bread(file->f_path.dentry->d_inode->i_sb, block_to_write);
-    if (!bh)
+    if (tail_bytes == fsi->segment_bytes)
     {
-        mutex_unlock(&mutex);
-        return -EIO;
+        // a linear log has no retention policy
+        if (!(fsi->flags & SINGLEFILEFS_FLAG_CIRCULAR))
+        {
+            ret = -ENOSPC;
+            goto out;
+        }
+
+        // move to the next segment, recycling the oldest one when the tail wraps onto it
+        tail_segment = (tail_segment + 1) % fsi->segments_count;
+        if (tail_segment == head_segment)
+        {
+            head_segment = (head_segment + 1) % fsi->segments_count;
+            file_size -= fsi->segment_bytes;
+            dropped_bytes += fsi->segment_bytes;
+        }
+        tail_bytes = 0;
+    }
+
+    if (fsi->flags & SINGLEFILEFS_FLAG_COMPRESSED)
+    {
+        // the record goes to the in-memory block, the device is written when the block is flushed
+        ret = onefilefs_compress_append(fsi, tail_bytes, data, payload);
+        if (ret)
+            goto out;
+        onefilefs_index_update(fsi, tail_bytes / fsi->block_size, block_offset == 0, data, payload);
+        goto published;
+    }
+
+    region_block = tail_segment * fsi->segment_blocks + tail_bytes / fsi->block_payload;
+    block_to_write = onefilefs_device_block(fsi, region_block);
+
+    if (block_offset == 0)
+    {
+        // fresh (or recycled) block: no need to read it, stale bytes are cleared
+        tail_seq++;
+        tail_crc = ~0;
+        ret = onefilefs_bnew(fsi, block_to_write, &block_buf);
+    }
+    else
+    {
+        ret = onefilefs_bread(fsi, block_to_write, &block_buf);
+    }
+
+    if (ret)
+        goto out;
+
+    memcpy(block_buf.data + fsi->block_header + block_offset, data, payload);
+
+    if (fsi->block_header)
+    {
+        // the payload CRC is extended with the new record, the header is sealed again
+        header = (struct onefilefs_block_header *)block_buf.data;
+        tail_crc = crc32c(tail_crc, data, payload);
+        header->used = block_offset + payload;
+        header->seq = tail_seq;
+        header->crc = onefilefs_block_crc(fsi, tail_crc, header);
     }
 
-    memcpy(bh->b_data + block_offset, data, payload);
+    onefilefs_bdirty(&block_buf);
+    onefilefs_brelse(&block_buf);
+
+    onefilefs_index_update(fsi, region_block, block_offset == 0, data, payload);
+
+published:
+    tail_bytes += payload;
+    file_size += payload;
 
-    mark_buffer_dirty(bh);
+    fsi->head_segment = head_segment;
+    fsi->tail_segment = tail_segment;
+    fsi->tail_bytes = tail_bytes;
+    fsi->tail_seq = tail_seq;
+    fsi->tail_crc = tail_crc;
+    fsi->file_size = file_size;
+    fsi->dropped_bytes = dropped_bytes;
 
-    if (offset + payload > file_size)
-        i_size_write(the_inode, offset + payload);
+    if (fsi->flags & SINGLEFILEFS_FLAG_COMPRESSED)
+        onefilefs_compress_schedule(fsi);
+    else
+        onefilefs_sync_boundaries(fsi);
 
-    brelse(bh);
+    i_size_write(the_inode, file_size);
+    onefilefs_index_resize(fsi);
+    iocb->ki_pos = file_size;
 
-    offset += payload;
+    // readers following the log (fsnotify modify events are generated by the VFS for every write)
+    wake_up_interruptible_all(&fsi->append_wq);
 
+    ret = payload;
+
+out:
     mutex_unlock(&mutex);
     kfree(data);
 
-    return payload;
+    return ret;
 }
 
 struct dentry *onefilefs_lookup(struct inode *parent_inode, struct dentry *child_dentry, unsigned int flags)
 {
 
-    struct onefilefs_inode *FS_specific_inode;
     struct super_block *sb = parent_inode->i_sb;
-    struct buffer_head *bh = NULL;
     struct inode *the_inode = NULL;
 
     printk("%s: running the lookup inode-function for name %s", MOD_NAME, child_dentry->d_name.name);
 
+    if (!strcmp(child_dentry->d_name.name, INDEX_FILE_NAME))
+    {
+        the_inode = iget_locked(sb, SINGLEFILEFS_INDEX_INODE_NUMBER);
+        if (!the_inode)
+            return ERR_PTR(-ENOMEM);
+
+        if (!(the_inode->i_state & I_NEW))
+        {
+            return child_dentry;
+        }
+
+#if LINUX_VERSION_CODE <= KERNEL_VERSION(5, 12, 0)
+        inode_init_owner(the_inode, NULL, S_IFREG);
+#elif LINUX_VERSION_CODE < KERNEL_VERSION(6, 3, 0)
+        inode_init_owner(&init_user_ns, the_inode, NULL, S_IFREG);
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+        inode_init_owner(&nop_mnt_idmap, the_inode, NULL, S_IFREG);
+#endif
+        // the index is maintained by the file system, it is read-only for everybody
+        the_inode->i_mode = S_IFREG | S_IRUSR | S_IRGRP | S_IROTH;
+        the_inode->i_fop = &onefilefs_index_operations;
+        the_inode->i_op = &onefilefs_inode_ops;
+        // then kept in step with the log by the write path
+        the_inode->i_size = onefilefs_index_size(ONEFILEFS_SB(sb));
+
+        set_nlink(the_inode, 1);
+
+        d_add(child_dentry, the_inode);
+        dget(child_dentry);
+
+        unlock_new_inode(the_inode);
+
+        return child_dentry;
+    }
+
     if (!strcmp(child_dentry->d_name.name, UNIQUE_FILE_NAME))
     {
 
@@ -180,16 +389,8 @@ struct dentry *onefilefs_lookup(struct inode *parent_inode, struct dentry *child
         // just one link for this file
         set_nlink(the_inode, 1);
 
-        // now we retrieve the file size via the FS specific inode, putting it into the generic inode
-        bh = (struct buffer_head *)sb_bread(sb, SINGLEFILEFS_INODES_BLOCK_NUMBER);
-        if (!bh)
-        {
-            iput(the_inode);
-            return ERR_PTR(-EIO);
-        }
-        FS_specific_inode = (struct onefilefs_inode *)bh->b_data;
-        the_inode->i_size = FS_specific_inode->file_size;
-        brelse(bh);
+        // the file size is tracked with the log boundaries in the in-memory superblock
+        the_inode->i_size = ONEFILEFS_SB(sb)->file_size;
 
         d_add(child_dentry, the_inode);
         dget(child_dentry);
@@ -203,6 +404,78 @@ struct dentry *onefilefs_lookup(struct inode *parent_inode, struct dentry *child
     return NULL;
 }
 
+// readable as soon as records follow the offset of the file, the log is always writable
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 16, 0)
+static __poll_t onefilefs_poll(struct file *filp, poll_table *wait)
+{
+    __poll_t mask = EPOLLOUT | EPOLLWRNORM;
+#else
+static unsigned int onefilefs_poll(struct file *filp, poll_table *wait)
+{
+    unsigned int mask = POLLOUT | POLLWRNORM;
+#endif
+    struct onefilefs_fs_info *fsi = ONEFILEFS_SB(filp->f_inode->i_sb);
+    struct onefilefs_follower *follower = filp->private_data;
+
+    poll_wait(filp, &fsi->append_wq, wait);
+
+    if (READ_ONCE(filp->f_pos) < READ_ONCE(fsi->file_size) ||
+        (follower && follower->enabled && follower->dropped_bytes != READ_ONCE(fsi->dropped_bytes)))
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 16, 0)
+        mask |= EPOLLIN | EPOLLRDNORM;
+#else
+        mask |= POLLIN | POLLRDNORM;
+#endif
+
+    return mask;
+}
+
+static long onefilefs_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    struct onefilefs_fs_info *fsi = ONEFILEFS_SB(filp->f_inode->i_sb);
+    struct onefilefs_follower *follower;
+
+    if (cmd == ONEFILEFS_IOC_DUMP)
+        return onefilefs_dump(fsi, (int)arg);
+
+    if (cmd != ONEFILEFS_IOC_FOLLOW)
+        return -ENOTTY;
+
+    mutex_lock(&mutex);
+
+    follower = filp->private_data;
+    if (!follower && arg)
+    {
+        // kept until release: a reader may be sleeping on it
+        follower = kzalloc(sizeof(*follower), GFP_KERNEL);
+        if (!follower)
+        {
+            mutex_unlock(&mutex);
+            return -ENOMEM;
+        }
+        filp->private_data = follower;
+    }
+
+    if (follower)
+    {
+        follower->enabled = arg != 0;
+        follower->dropped_bytes = fsi->dropped_bytes;
+    }
+
+    mutex_unlock(&mutex);
+
+    // sleeping readers re-check the mode
+    wake_up_interruptible_all(&fsi->append_wq);
+
+    return 0;
+}
+
+static int onefilefs_release(struct inode *inode, struct file *filp)
+{
+    kfree(filp->private_data);
+    return 0;
+}
+
 // look up goes in the inode operations
 const struct inode_operations onefilefs_inode_ops = {
     .lookup = onefilefs_lookup,
@@ -212,4 +485,8 @@ const struct file_operations onefilefs_file_operations = {
     .owner = THIS_MODULE,
     .read = onefilefs_read,
     .write_iter = onefile_write,
+    .poll = onefilefs_poll,
+    .unlocked_ioctl = onefilefs_ioctl,
+    .compat_ioctl = onefilefs_ioctl,
+    .release = onefilefs_release,
 };
@@ -9,6 +9,8 @@
 #include <linux/string.h>
 #include <linux/version.h>
 #include <linux/mutex.h>
+#include <linux/log2.h>
+#include <linux/blkdev.h>
 
 #define DEF_LOCK
 #include "file_system.h"
@@ -21,44 +23,362 @@ MODULE_DESCRIPTION("Single file file-system");
 
 struct mutex mutex;
 
-static struct super_operations singlefilefs_super_ops = {};
+static void singlefilefs_put_super(struct super_block *sb)
+{
+    struct onefilefs_fs_info *fsi = ONEFILEFS_SB(sb);
+
+    if (!fsi)
+        return;
+
+    if (fsi->flags & SINGLEFILEFS_FLAG_COMPRESSED)
+        onefilefs_compress_exit(fsi);
+
+    // make the log boundaries durable before releasing the pinned superblock
+    onefilefs_bsync(&fsi->sb_buf);
+    onefilefs_brelse(&fsi->sb_buf);
+    onefilefs_ram_exit(fsi);
+    kfree(fsi);
+    sb->s_fs_info = NULL;
+}
+
+static int singlefilefs_sync_fs(struct super_block *sb, int wait)
+{
+    struct onefilefs_fs_info *fsi = ONEFILEFS_SB(sb);
+    int ret = 0;
+
+    // records still held in the in-memory block reach the device on sync
+    if (fsi->flags & SINGLEFILEFS_FLAG_COMPRESSED)
+    {
+        mutex_lock(&mutex);
+        ret = onefilefs_compress_flush(fsi);
+        mutex_unlock(&mutex);
+    }
+
+    if (wait)
+        onefilefs_bsync(&fsi->sb_buf);
+
+    return ret;
+}
+
+static struct super_operations singlefilefs_super_ops = {
+    .put_super = singlefilefs_put_super,
+    .sync_fs = singlefilefs_sync_fs,
+};
 
 static struct dentry_operations singlefilefs_dentry_ops = {};
 
-int singlefilefs_fill_super(struct super_block *sb, void *data, int silent)
+static uint64_t singlefilefs_device_blocks(struct super_block *sb)
 {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 16, 0)
+    return bdev_nr_bytes(sb->s_bdev) >> sb->s_blocksize_bits;
+#else
+    return i_size_read(sb->s_bdev->bd_inode) >> sb->s_blocksize_bits;
+#endif
+}
 
-    struct inode *root_inode;
-    struct buffer_head *bh;
+/*
+ * Check the superblock of the device and switch the buffer cache to the block size chosen at mkfs
+ * time. Block sizes above the page size need large block size support from the running kernel.
+ */
+static int singlefilefs_open_device(struct super_block *sb, struct onefilefs_fs_info *fsi)
+{
     struct onefilefs_sb_info *sb_disk;
-    struct timespec64 curr_time;
-    uint64_t magic;
+    struct buffer_head *bh;
+    uint64_t block_size;
 
-    // Unique identifier of the filesystem
-    sb->s_magic = MAGIC;
+    // the superblock is found with the smallest block size, whatever the one chosen at mkfs time
+    if (!sb_set_blocksize(sb, SINGLEFILEFS_MIN_BLOCK_SIZE))
+    {
+        return -EINVAL;
+    }
 
     bh = sb_bread(sb, SB_BLOCK_NUMBER);
-    if (!sb)
+    if (!bh)
     {
         return -EIO;
     }
     sb_disk = (struct onefilefs_sb_info *)bh->b_data;
-    magic = sb_disk->magic;
-    brelse(bh);
 
     // check on the expected magic number
-    if (magic != sb->s_magic)
+    if (sb_disk->magic != sb->s_magic)
     {
+        brelse(bh);
         return -EBADF;
     }
 
-    sb->s_fs_info = NULL;               // FS specific data (the magic number) already reported into the generic superblock
+    block_size = sb_disk->version == SINGLEFILEFS_LEGACY_VERSION ? DEFAULT_BLOCK_SIZE : sb_disk->block_size;
+    brelse(bh);
+
+    if (block_size != SINGLEFILEFS_MIN_BLOCK_SIZE)
+    {
+        if (block_size > SINGLEFILEFS_MAX_BLOCK_SIZE || !is_power_of_2(block_size))
+        {
+            pr_err("%s: [ERROR] Unsupported block size %llu\n", MOD_NAME, block_size);
+            return -EINVAL;
+        }
+
+        if (!sb_set_blocksize(sb, block_size))
+        {
+            pr_err("%s: [ERROR] Block size %llu not supported by the device or the kernel\n", MOD_NAME, block_size);
+            return -EINVAL;
+        }
+    }
+
+    fsi->device_blocks = singlefilefs_device_blocks(sb);
+
+    return 0;
+}
+
+// a RAM mount is requested with the "ram" option: mount -t singlefilefs -o ram[,...] none <dir>
+static bool singlefilefs_ram_requested(const char *options)
+{
+    size_t len;
+
+    while (*options)
+    {
+        len = strcspn(options, ",");
+        if (len == 3 && !strncmp(options, "ram", 3))
+            return true;
+        options += len;
+        if (*options == ',')
+            options++;
+    }
+
+    return false;
+}
+
+// Load the extent table of the data region from the file inode and check it against the device
+static int singlefilefs_load_extents(struct super_block *sb, struct onefilefs_fs_info *fsi)
+{
+    struct onefilefs_inode *FS_specific_inode;
+    struct onefilefs_buf buf;
+    uint64_t device_blocks = fsi->device_blocks;
+    uint64_t next_start = fsi->data_start;
+    uint64_t i, total = 0;
+    int ret;
+
+    ret = onefilefs_bread(fsi, SINGLEFILEFS_INODES_BLOCK_NUMBER, &buf);
+    if (ret)
+        return ret;
+    FS_specific_inode = (struct onefilefs_inode *)buf.data;
+
+    fsi->data_blocks = FS_specific_inode->data_block_number;
+    fsi->extents_count = FS_specific_inode->extents_count;
+    if (fsi->extents_count == 0 || fsi->extents_count > SINGLEFILEFS_MAX_EXTENTS)
+    {
+        ret = -EINVAL;
+        goto out;
+    }
+
+    // extents are sorted, disjoint and lie between the metadata and the end of the device
+    for (i = 0; i < fsi->extents_count; i++)
+    {
+        fsi->extents[i] = FS_specific_inode->extents[i];
+        if (fsi->extents[i].length == 0 || fsi->extents[i].start < next_start ||
+            fsi->extents[i].length > device_blocks - min(fsi->extents[i].start, device_blocks))
+        {
+            ret = -EINVAL;
+            goto out;
+        }
+        next_start = fsi->extents[i].start + fsi->extents[i].length;
+        total += fsi->extents[i].length;
+    }
+
+    if (total != fsi->data_blocks)
+        ret = -EINVAL;
+
+out:
+    onefilefs_brelse(&buf);
+    if (ret)
+        pr_err("%s: [ERROR] Corrupted extent table of the data region (device of %llu blocks)\n", MOD_NAME, device_blocks);
+    return ret;
+}
+
+/*
+ * Load the data region geometry and the log boundaries from the on-disk superblock.
+ * Version 1 images carry no geometry: they are handled as an unbounded linear log whose
+ * size is kept in the file inode, as done by the original layout.
+ */
+static int singlefilefs_load_geometry(struct super_block *sb, struct onefilefs_fs_info *fsi)
+{
+    struct onefilefs_sb_info *sb_disk = fsi->disk_sb;
+    struct onefilefs_inode *FS_specific_inode;
+    struct onefilefs_buf buf;
+    int ret;
+
+    if (sb_disk->version == SINGLEFILEFS_LEGACY_VERSION)
+    {
+        ret = onefilefs_bread(fsi, SINGLEFILEFS_INODES_BLOCK_NUMBER, &buf);
+        if (ret)
+            return ret;
+        FS_specific_inode = (struct onefilefs_inode *)buf.data;
+        fsi->file_size = FS_specific_inode->file_size;
+        onefilefs_brelse(&buf);
+
+        fsi->flags = 0;
+        fsi->block_size = DEFAULT_BLOCK_SIZE;
+        fsi->block_payload = fsi->block_size;
+        fsi->segments_count = 1;
+        fsi->segment_blocks = U32_MAX;
+        fsi->segment_bytes = fsi->segment_blocks * fsi->block_payload;
+        fsi->head_segment = 0;
+        fsi->tail_segment = 0;
+        fsi->tail_bytes = fsi->file_size;
+        fsi->data_start = SINGLEFILEFS_DATA_BLOCK_NUMBER;
+        // the data region runs up to the end of the device
+        fsi->data_blocks = fsi->segment_blocks;
+        fsi->extents_count = 1;
+        fsi->extents[0].start = fsi->data_start;
+        fsi->extents[0].length = fsi->data_blocks;
+        return 0;
+    }
+
+    if (sb_disk->version != SINGLEFILEFS_VERSION)
+    {
+        pr_err("%s: [ERROR] Unsupported on-disk version %llu\n", MOD_NAME, sb_disk->version);
+        return -EINVAL;
+    }
+
+    if (sb_disk->segment_blocks == 0 || sb_disk->segments_count == 0 ||
+        sb_disk->head_segment >= sb_disk->segments_count || sb_disk->tail_segment >= sb_disk->segments_count ||
+        sb_disk->index_start != SINGLEFILEFS_DATA_BLOCK_NUMBER + sb_disk->map_blocks ||
+        sb_disk->data_start != sb_disk->index_start + sb_disk->index_blocks)
+    {
+        pr_err("%s: [ERROR] Corrupted log geometry in the superblock\n", MOD_NAME);
+        return -EINVAL;
+    }
+
+    fsi->flags = sb_disk->flags;
+    fsi->block_size = sb_disk->block_size;
+    // the blocks of a plain checksummed log start with their header, frames carry their own checksum
+    if ((fsi->flags & SINGLEFILEFS_FLAG_CHECKSUM) && !(fsi->flags & SINGLEFILEFS_FLAG_COMPRESSED))
+        fsi->block_header = sizeof(struct onefilefs_block_header);
+    fsi->block_payload = fsi->block_size - fsi->block_header;
+    fsi->segment_blocks = sb_disk->segment_blocks;
+    fsi->segments_count = sb_disk->segments_count;
+    fsi->segment_bytes = fsi->segment_blocks * fsi->block_payload;
+    fsi->head_segment = sb_disk->head_segment;
+    fsi->tail_segment = sb_disk->tail_segment;
+    fsi->tail_bytes = sb_disk->tail_bytes;
+    fsi->tail_seq = sb_disk->tail_seq;
+    fsi->format_id = sb_disk->format_id;
+    fsi->data_start = sb_disk->data_start;
+    fsi->map_blocks = sb_disk->map_blocks;
+    fsi->index_start = sb_disk->index_start;
+    fsi->index_blocks = sb_disk->index_blocks;
+
+    if (fsi->block_size != sb->s_blocksize)
+    {
+        pr_err("%s: [ERROR] Block size %llu does not match the device block size %lu\n", MOD_NAME, fsi->block_size, sb->s_blocksize);
+        return -EINVAL;
+    }
+
+    ret = singlefilefs_load_extents(sb, fsi);
+    if (ret)
+        return ret;
+
+    // the segments (the frames in compressed mode) must fit into the data region
+    if (fsi->segment_blocks > fsi->data_blocks ||
+        fsi->segments_count > fsi->data_blocks / fsi->segment_blocks)
+    {
+        pr_err("%s: [ERROR] Log geometry exceeds the data region of %llu blocks\n", MOD_NAME, fsi->data_blocks);
+        return -EINVAL;
+    }
+
+    if (fsi->flags & SINGLEFILEFS_FLAG_COMPRESSED)
+    {
+        // frames are packed in a single linear region, the file can grow as far as the map allows
+        if ((fsi->flags & SINGLEFILEFS_FLAG_CIRCULAR) || !(fsi->flags & SINGLEFILEFS_FLAG_CHECKSUM) ||
+            fsi->segments_count != 1 || fsi->map_blocks == 0 || sb_disk->frame_bytes > fsi->segment_blocks * fsi->block_size)
+        {
+            pr_err("%s: [ERROR] Corrupted compressed log geometry in the superblock\n", MOD_NAME);
+            return -EINVAL;
+        }
+        fsi->segment_bytes = fsi->map_blocks * (fsi->block_size / sizeof(uint64_t)) * fsi->block_size;
+    }
+
+    if (fsi->tail_bytes > fsi->segment_bytes)
+    {
+        pr_err("%s: [ERROR] Corrupted log boundaries in the superblock\n", MOD_NAME);
+        return -EINVAL;
+    }
+
+    // the boundaries are only a hint for checksummed logs, the frames of a compressed one are scanned later
+    if (fsi->block_header)
+    {
+        ret = onefilefs_recover_tail(fsi);
+        if (ret)
+            return ret;
+    }
+
+    // every segment from head to tail (excluded) is full
+    fsi->file_size = ((fsi->tail_segment + fsi->segments_count - fsi->head_segment) % fsi->segments_count) * fsi->segment_bytes + fsi->tail_bytes;
+
+    return 0;
+}
+
+int singlefilefs_fill_super(struct super_block *sb, void *data, int silent)
+{
+
+    struct inode *root_inode;
+    struct onefilefs_fs_info *fsi;
+    struct timespec64 curr_time;
+    int ret;
+
+    // Unique identifier of the filesystem
+    sb->s_magic = MAGIC;
+
+    fsi = kzalloc(sizeof(struct onefilefs_fs_info), GFP_KERNEL);
+    if (!fsi)
+    {
+        return -ENOMEM;
+    }
+    fsi->sb = sb;
+    init_waitqueue_head(&fsi->append_wq);
+
+    if (sb->s_bdev)
+    {
+        ret = singlefilefs_open_device(sb, fsi);
+    }
+    else
+    {
+        // RAM mount: the image is formatted in memory with the default block size
+        sb->s_blocksize = DEFAULT_BLOCK_SIZE;
+        sb->s_blocksize_bits = blksize_bits(DEFAULT_BLOCK_SIZE);
+        ret = onefilefs_ram_init(fsi, data);
+    }
+    if (ret)
+        goto free_fsi;
+
+    // the superblock buffer stays pinned: appends update the log boundaries in place
+    ret = onefilefs_bread(fsi, SB_BLOCK_NUMBER, &fsi->sb_buf);
+    if (ret)
+        goto free_fsi;
+    fsi->disk_sb = (struct onefilefs_sb_info *)fsi->sb_buf.data;
+
+    ret = singlefilefs_load_geometry(sb, fsi);
+    if (ret)
+        goto release_sb;
+
+    if (fsi->flags & SINGLEFILEFS_FLAG_COMPRESSED)
+    {
+        ret = onefilefs_compress_init(sb, fsi);
+        if (ret)
+            goto release_sb;
+    }
+
+    printk("%s: [INFO] Log geometry: %llu segment(s) of %llu blocks of %llu bytes, %s%s mode, file size %llu\n", MOD_NAME,
+           fsi->segments_count, fsi->segment_blocks, fsi->block_size, (fsi->flags & SINGLEFILEFS_FLAG_CIRCULAR) ? "circular" : "linear",
+           (fsi->flags & SINGLEFILEFS_FLAG_COMPRESSED) ? " compressed" : "", fsi->file_size);
+
+    sb->s_fs_info = fsi;
     sb->s_op = &singlefilefs_super_ops; // set our own operations
 
     root_inode = iget_locked(sb, SINGLEFILEFS_ROOT_INODE_NUMBER); // get a root inode from cache
     if (!root_inode)
     {
-        return -ENOMEM;
+        ret = -ENOMEM;
+        goto release_fsi;
     }
 
 #if LINUX_VERSION_CODE <= KERNEL_VERSION(5, 12, 0)
@@ -91,7 +411,10 @@ int singlefilefs_fill_super(struct super_block *sb, void *data, int silent)
 
     sb->s_root = d_make_root(root_inode);
     if (!sb->s_root)
-        return -ENOMEM;
+    {
+        ret = -ENOMEM;
+        goto release_fsi;
+    }
 
     sb->s_root->d_op = &singlefilefs_dentry_ops; // set our dentry operations
 
@@ -99,11 +422,26 @@ int singlefilefs_fill_super(struct super_block *sb, void *data, int silent)
     unlock_new_inode(root_inode);
 
     return 0;
+
+release_fsi:
+    // put_super is not invoked without a root dentry
+    sb->s_fs_info = NULL;
+    if (fsi->flags & SINGLEFILEFS_FLAG_COMPRESSED)
+        onefilefs_compress_exit(fsi);
+release_sb:
+    onefilefs_brelse(&fsi->sb_buf);
+free_fsi:
+    onefilefs_ram_exit(fsi);
+    kfree(fsi);
+    return ret;
 }
 
 static void singlefilefs_kill_superblock(struct super_block *s)
 {
-    kill_block_super(s);
+    if (s->s_bdev)
+        kill_block_super(s);
+    else
+        kill_anon_super(s);
     printk(KERN_INFO "%s: [INFO] Singlefilefs unmount succesful.\n", MOD_NAME);
     return;
 }
@@ -114,7 +452,10 @@ struct dentry *singlefilefs_mount(struct file_system_type *fs_type, int flags, c
 
     struct dentry *ret;
 
-    ret = mount_bdev(fs_type, flags, dev_name, data, singlefilefs_fill_super);
+    if (data && singlefilefs_ram_requested(data))
+        ret = mount_nodev(fs_type, flags, data, singlefilefs_fill_super);
+    else
+        ret = mount_bdev(fs_type, flags, dev_name, data, singlefilefs_fill_super);
 
     if (unlikely(IS_ERR(ret)))
         pr_err("%s: [ERROR] Error mounting onefilefs", MOD_NAME);
@@ -4,32 +4,91 @@
 #include <linux/types.h>
 #include <linux/fs.h>
 
+#ifdef __KERNEL__
+#include <linux/workqueue.h>
+#include <linux/crypto.h>
+#include <linux/crc32c.h>
+#include <linux/wait.h>
+#include <linux/string.h>
+#else
+#include <string.h>
+#endif
+
 #define MOD_NAME "SINGLE FILE FS"
 
 #define MAGIC 0x42424242
 #define DEFAULT_BLOCK_SIZE 4096
+// admissible block sizes (a power of two), the superblock always lives in the first 4K of block 0
+#define SINGLEFILEFS_MIN_BLOCK_SIZE 4096
+#define SINGLEFILEFS_MAX_BLOCK_SIZE 65536
 #define SB_BLOCK_NUMBER 0
 #define DEFAULT_FILE_INODE_BLOCK 1
 
+// on-disk format versions (version 1 images have no geometry in the superblock)
+#define SINGLEFILEFS_LEGACY_VERSION 1
+#define SINGLEFILEFS_VERSION 2
+
+// superblock flags, chosen at mkfs time
+#define SINGLEFILEFS_FLAG_CIRCULAR 0x1 // data region is a ring of fixed size segments
+#define SINGLEFILEFS_FLAG_COMPRESSED 0x2 // data region holds LZ4 frames addressed by a block map
+#define SINGLEFILEFS_FLAG_CHECKSUM 0x4 // data blocks (frames in compressed mode) carry a CRC32C, see below
+
+// compressed mode: a map entry is reserved for SINGLEFILEFS_MAP_RATIO logical blocks per data block
+#define SINGLEFILEFS_MAP_RATIO 16
+// compressed mode: longest time an appended record may stay in the in-memory block (jiffies)
+#define SINGLEFILEFS_FLUSH_INTERVAL (5 * HZ)
+
 #define FILENAME_MAXLEN 255
 
 #define SINGLEFILEFS_ROOT_INODE_NUMBER 10
 #define SINGLEFILEFS_FILE_INODE_NUMBER 1
+#define SINGLEFILEFS_INDEX_INODE_NUMBER 2
 
 #define SINGLEFILEFS_INODES_BLOCK_NUMBER 1
+#define SINGLEFILEFS_DATA_BLOCK_NUMBER 2
 
 #define UNIQUE_FILE_NAME "ref_monitor_log.txt"
+#define INDEX_FILE_NAME "ref_monitor_log.idx"
+
+/*
+ * ioctl on the log file: with a non zero argument, reads at the end of the file block until new
+ * records are appended (unless the file is non-blocking); the offset of the reader also follows
+ * the head of a circular log when a segment is recycled. A zero argument restores plain reads.
+ */
+#define ONEFILEFS_IOC_FOLLOW _IO('o', 1)
+// ioctl on the log file (CAP_SYS_ADMIN): write the whole image to the file descriptor passed as argument
+#define ONEFILEFS_IOC_DUMP _IO('o', 2)
+
+// first line of a new log
+#define SINGLEFILEFS_LOG_HEADER "TIMESTAMP, TID, TGID, UID, EUID, Offending program path, Fingerprint\n"
+
+// errors of singlefilefs_format_sb()
+#define SINGLEFILEFS_FORMAT_TOO_SMALL 1		// no room for the data region
+#define SINGLEFILEFS_FORMAT_NO_METADATA 2	// no room for the map and the index
+#define SINGLEFILEFS_FORMAT_FEW_SEGMENTS 3	// a circular log needs at least 2 segments
+
+#define SINGLEFILEFS_MAX_EXTENTS 16
+
+// a run of contiguous device blocks of the data region
+struct onefilefs_extent {
+	uint64_t start;			// first device block
+	uint64_t length;		// number of blocks
+};
 
 //inode definition
 struct onefilefs_inode {
 	mode_t mode;//not exploited
 	uint64_t inode_no;
-	uint64_t data_block_number;//not exploited
+	uint64_t data_block_number;	// blocks of the data region
 
 	union {
 		uint64_t file_size;
 		uint64_t dir_children_count;
 	};
+
+	// extent table of the data region (version 2 images), in data region order
+	uint64_t extents_count;
+	struct onefilefs_extent extents[SINGLEFILEFS_MAX_EXTENTS];
 };
 
 //dir definition (how the dir datablock is organized)
@@ -47,17 +106,255 @@ struct onefilefs_sb_info {
 	uint64_t inodes_count;//not exploited
 	uint64_t free_blocks;//not exploited
 
+	// data region geometry: a linear log is a single segment spanning the whole data region
+	uint64_t flags;
+	uint64_t segment_blocks;	// blocks per segment
+	uint64_t segments_count;	// segments in the data region
+
+	// log boundaries, kept here so that mount time does not depend on the log size
+	uint64_t head_segment;		// oldest retained segment
+	uint64_t tail_segment;		// segment receiving appends
+	uint64_t tail_bytes;		// bytes already used in the tail segment
+
+	uint64_t data_start;		// first block of the data region
+	uint64_t map_blocks;		// blocks of the frame map, placed right after the file inode (compressed mode)
+	uint64_t frame_bytes;		// bytes of the data region used by the flushed frames (compressed mode)
+
+	uint64_t index_start;		// first block of the sparse index, placed right before the data region
+	uint64_t index_blocks;		// blocks of the sparse index, 0 if the image has no index
+
+	uint64_t tail_seq;		// sequence number of the tail block (checksummed images)
+	uint64_t format_id;		// random, drawn at mkfs time (0 for RAM images and older ones)
+
 	//padding to fit into a single block
-	char padding[ (4 * 1024) - (5 * sizeof(uint64_t))];
+	char padding[ (4 * 1024) - (18 * sizeof(uint64_t))];
+};
+
+/*
+ * Checksummed images: every block of the data region starts with this header, the rest of the block
+ * holds the bytes of the file. Blocks get increasing sequence numbers as the log moves forward, so a
+ * recycled block left over from a previous lap is told apart from the one following the tail.
+ * The CRC32C (seed ~0, no final inversion, as the kernel crc32c()) covers the used payload bytes,
+ * then seq and used, in this order, then the format ID of the superblock if it is not 0: sequence
+ * numbers restart at every mkfs, the ID keeps the blocks left on a reused device from validating.
+ */
+struct onefilefs_block_header {
+	uint32_t used;			// payload bytes holding records, the rest of the block is padding
+	uint32_t crc;
+	uint64_t seq;
 };
 
+/*
+ * Sparse index: one entry per block of the data region (per logical block in compressed mode),
+ * describing the records appended into it. Records are lines starting with "<timestamp>, <tid>, <tgid>,".
+ */
+struct onefilefs_index_entry {
+	uint64_t first_timestamp;	// timestamp of the first record of the block, 0 if none
+	uint64_t last_timestamp;	// timestamp of the last record of the block
+	uint32_t min_tgid;
+	uint32_t max_tgid;
+	uint32_t records;		// records appended into the block
+	uint32_t reserved;
+};
+
+// content of INDEX_FILE_NAME: a record for each block of the log file, in file order
+struct onefilefs_index_record {
+	uint64_t offset;		// offset of the block in the log file
+	uint64_t first_timestamp;
+	uint64_t last_timestamp;
+	uint32_t min_tgid;
+	uint32_t max_tgid;
+	uint32_t records;
+	uint32_t reserved;
+};
+
+/*
+ * Compressed mode: the file is cut in logical blocks of the file system block size, each one stored as
+ * a frame (header + payload) packed back to back in the data region. The map keeps, for every
+ * logical block, the byte offset of its frame in the data region (uint64_t entries).
+ */
+struct onefilefs_frame_header {
+	uint32_t length;		// bytes of payload following the header
+	uint32_t raw_length;		// bytes of the logical block held by the frame, payload stored as is if equal to length
+	uint32_t crc;			// CRC32C of the payload, then block, raw_length, length and format ID (if not 0)
+	uint32_t block;			// logical block held by the frame (lower 32 bits)
+};
+
+/*
+ * Pack the superblock of a new image of device_blocks blocks, shared by mkfs and the RAM mounts.
+ * segment_blocks is 0 for a linear log. The data region takes data_blocks blocks from data_start up
+ * to the end of the image, the log starts with the header line. Returns 0 or SINGLEFILEFS_FORMAT_*.
+ */
+static inline int singlefilefs_format_sb(struct onefilefs_sb_info *sb, uint64_t device_blocks, uint64_t block_size,
+					 uint64_t segment_blocks, int compressed, uint64_t *data_blocks)
+{
+	uint64_t map_entries = block_size / sizeof(uint64_t);
+	uint64_t index_entries = block_size / sizeof(struct onefilefs_index_entry);
+	uint64_t map_blocks = 0, index_blocks;
+
+	if (device_blocks <= SINGLEFILEFS_DATA_BLOCK_NUMBER)
+		return SINGLEFILEFS_FORMAT_TOO_SMALL;
+	*data_blocks = device_blocks - SINGLEFILEFS_DATA_BLOCK_NUMBER;
+
+	if (compressed) {
+		// the map addresses up to SINGLEFILEFS_MAP_RATIO logical blocks per remaining data block,
+		// each one of them with its own index entry
+		map_blocks = (*data_blocks * SINGLEFILEFS_MAP_RATIO + map_entries + SINGLEFILEFS_MAP_RATIO +
+			      SINGLEFILEFS_MAP_RATIO * map_entries / index_entries - 1) /
+			     (map_entries + SINGLEFILEFS_MAP_RATIO + SINGLEFILEFS_MAP_RATIO * map_entries / index_entries);
+		index_blocks = map_blocks * map_entries / index_entries;
+	} else {
+		// an index entry for each remaining data block
+		index_blocks = (*data_blocks + index_entries) / (index_entries + 1);
+	}
+
+	if (map_blocks + index_blocks >= *data_blocks)
+		return SINGLEFILEFS_FORMAT_NO_METADATA;
+	*data_blocks -= map_blocks + index_blocks;
+
+	memset(sb, 0, sizeof(*sb));
+	sb->version = SINGLEFILEFS_VERSION;
+	sb->magic = MAGIC;
+	sb->block_size = block_size;
+	sb->flags = SINGLEFILEFS_FLAG_CHECKSUM;
+
+	if (segment_blocks) {
+		if (*data_blocks / segment_blocks < 2)
+			return SINGLEFILEFS_FORMAT_FEW_SEGMENTS;
+		sb->flags |= SINGLEFILEFS_FLAG_CIRCULAR;
+		sb->segment_blocks = segment_blocks;
+		sb->segments_count = *data_blocks / segment_blocks;
+	} else {
+		sb->segment_blocks = *data_blocks;
+		sb->segments_count = 1;
+	}
+
+	if (compressed) {
+		sb->flags |= SINGLEFILEFS_FLAG_COMPRESSED;
+		sb->map_blocks = map_blocks;
+		// the header line is the first frame, stored uncompressed
+		sb->frame_bytes = sizeof(struct onefilefs_frame_header) + strlen(SINGLEFILEFS_LOG_HEADER);
+	}
+	sb->index_start = SINGLEFILEFS_DATA_BLOCK_NUMBER + map_blocks;
+	sb->index_blocks = index_blocks;
+	sb->data_start = sb->index_start + index_blocks;
+
+	// the log starts with the header line in the first segment, in the block of sequence number 0
+	sb->head_segment = 0;
+	sb->tail_segment = 0;
+	sb->tail_bytes = strlen(SINGLEFILEFS_LOG_HEADER);
+	sb->tail_seq = 0;
+
+	return 0;
+}
+
+#ifdef __KERNEL__
+// a block of the file system, from the buffer cache of the device or from the memory of a RAM mount
+struct onefilefs_buf {
+	char *data;
+	struct buffer_head *bh;			// NULL for RAM mounts
+};
+
+// in-memory superblock information (sb->s_fs_info)
+struct onefilefs_fs_info {
+	struct super_block *sb;
+	struct onefilefs_buf sb_buf;		// on-disk superblock, pinned for the whole mount
+	struct onefilefs_sb_info *disk_sb;
+	char *ram;				// image of a RAM mount (NULL if the file system lives on a device)
+	uint64_t device_blocks;			// blocks of the device (of the image of a RAM mount)
+	uint64_t block_size;
+	uint64_t block_header;			// bytes of the block header, 0 if the image is not checksummed
+	uint64_t block_payload;			// bytes of the file held by a block of the data region
+	uint64_t flags;
+	uint64_t segment_blocks;
+	uint64_t segments_count;
+	uint64_t segment_bytes;
+	uint64_t head_segment;
+	uint64_t tail_segment;
+	uint64_t tail_bytes;
+	uint64_t tail_seq;			// sequence number of the tail block
+	uint64_t format_id;			// mixed into the block and frame CRCs
+	uint32_t tail_crc;			// CRC32C of the used payload of the tail block
+	uint64_t file_size;			// logical size of the unique file
+	uint64_t dropped_bytes;			// bytes of the file recycled since mount (circular mode)
+	wait_queue_head_t append_wq;		// readers waiting for new records
+	uint64_t data_start;
+	uint64_t map_blocks;
+	uint64_t index_start;
+	uint64_t index_blocks;
+	uint64_t data_blocks;
+	uint64_t extents_count;
+	struct onefilefs_extent extents[SINGLEFILEFS_MAX_EXTENTS];
+
+	// compressed mode state
+	struct crypto_comp *comp_tfm;
+	char *stage;				// logical block receiving appends
+	char *cache;				// last logical block read back from a frame
+	char *scratch;				// frame being compressed or decompressed
+	uint64_t stage_block;			// logical block held by the stage
+	uint64_t stage_frame;			// data region offset of the stage frame
+	uint64_t stage_frame_len;		// bytes of the last frame written for the stage, 0 if none
+	uint64_t cached_block;			// logical block held by the cache, U64_MAX if none
+	bool stage_dirty;
+	struct delayed_work flush_work;
+};
+
+#define ONEFILEFS_SB(sb) ((struct onefilefs_fs_info *)(sb)->s_fs_info)
+
+// seal a block header given the CRC32C of its used payload
+static inline uint32_t onefilefs_block_crc(const struct onefilefs_fs_info *fsi, uint32_t payload_crc,
+					   const struct onefilefs_block_header *header)
+{
+	payload_crc = crc32c(payload_crc, &header->seq, sizeof(header->seq));
+	payload_crc = crc32c(payload_crc, &header->used, sizeof(header->used));
+	if (fsi->format_id)
+		payload_crc = crc32c(payload_crc, &fsi->format_id, sizeof(fsi->format_id));
+	return payload_crc;
+}
+#endif
+
 // file.c
 extern const struct inode_operations onefilefs_inode_ops;
 extern const struct file_operations onefilefs_file_operations; 
+#ifdef __KERNEL__
+uint64_t onefilefs_region_block_of(struct onefilefs_fs_info *fsi, loff_t off);
+sector_t onefilefs_device_block(struct onefilefs_fs_info *fsi, uint64_t region_block);
+#endif
 
 // dir.c
 extern const struct file_operations onefilefs_dir_operations;
 
+#ifdef __KERNEL__
+// compress.c
+int onefilefs_compress_init(struct super_block *sb, struct onefilefs_fs_info *fsi);
+void onefilefs_compress_exit(struct onefilefs_fs_info *fsi);
+int onefilefs_compress_flush(struct onefilefs_fs_info *fsi);
+int onefilefs_compress_append(struct onefilefs_fs_info *fsi, uint64_t pos, const char *data, size_t len);
+void onefilefs_compress_schedule(struct onefilefs_fs_info *fsi);
+ssize_t onefilefs_compress_read(struct onefilefs_fs_info *fsi, char __user *buf, size_t len, loff_t off);
+uint32_t onefilefs_frame_crc(struct onefilefs_fs_info *fsi, const struct onefilefs_frame_header *header, const char *payload);
+
+// index.c
+extern const struct file_operations onefilefs_index_operations;
+void onefilefs_index_update(struct onefilefs_fs_info *fsi, uint64_t slot, int fresh, const char *record, size_t len);
+void onefilefs_index_rebuild(struct onefilefs_fs_info *fsi, uint64_t slot, const char *payload, size_t len);
+loff_t onefilefs_index_size(struct onefilefs_fs_info *fsi);
+void onefilefs_index_resize(struct onefilefs_fs_info *fsi);
+
+// recovery.c
+int onefilefs_recover_tail(struct onefilefs_fs_info *fsi);
+
+// block.c
+int onefilefs_bread(struct onefilefs_fs_info *fsi, sector_t block, struct onefilefs_buf *buf);
+int onefilefs_bnew(struct onefilefs_fs_info *fsi, sector_t block, struct onefilefs_buf *buf);
+void onefilefs_bdirty(struct onefilefs_buf *buf);
+void onefilefs_bsync(struct onefilefs_buf *buf);
+void onefilefs_brelse(struct onefilefs_buf *buf);
+int onefilefs_ram_init(struct onefilefs_fs_info *fsi, char *options);
+void onefilefs_ram_exit(struct onefilefs_fs_info *fsi);
+long onefilefs_dump(struct onefilefs_fs_info *fsi, int fd);
+#endif
+
 
 extern struct mutex mutex;
 #endif
\ No newline at end of file
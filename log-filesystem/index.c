@@ -0,0 +1,225 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/buffer_head.h>
+#include <linux/types.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/ctype.h>
+#include <linux/mutex.h>
+
+#include "file_system.h"
+
+/*
+ * Sparse index of the log. Each block of the data region (each logical block in compressed mode)
+ * owns an entry with the time span and the TGID range of its records: tools read the companion
+ * file to find the blocks they are interested in and then read only that range of the log.
+ */
+
+#define INDEX_ENTRIES_PER_BLOCK(fsi) ((fsi)->block_size / sizeof(struct onefilefs_index_entry))
+
+// parse an unsigned decimal field followed by a comma, skipping leading blanks
+static const char *onefilefs_parse_field(const char *p, const char *end, uint64_t *value)
+{
+    const char *start;
+
+    while (p < end && *p == ' ')
+        p++;
+
+    start = p;
+    *value = 0;
+    while (p < end && isdigit(*p))
+        *value = *value * 10 + (*p++ - '0');
+
+    if (p == start || p == end || *p != ',')
+        return NULL;
+
+    return p + 1;
+}
+
+// records start with "<timestamp>, <tid>, <tgid>," - anything else (e.g. the header line) is not indexed
+static int onefilefs_parse_record(const char *record, size_t len, uint64_t *timestamp, uint32_t *tgid)
+{
+    const char *end = record + len;
+    uint64_t tid, value;
+
+    record = onefilefs_parse_field(record, end, timestamp);
+    if (record)
+        record = onefilefs_parse_field(record, end, &tid);
+    if (record)
+        record = onefilefs_parse_field(record, end, &value);
+    if (!record)
+        return -EINVAL;
+
+    *tgid = (uint32_t)value;
+    return 0;
+}
+
+static int onefilefs_index_entry_of(struct onefilefs_fs_info *fsi, uint64_t slot, struct onefilefs_buf *buf,
+                                    struct onefilefs_index_entry **entry)
+{
+    int ret;
+
+    if (slot >= fsi->index_blocks * INDEX_ENTRIES_PER_BLOCK(fsi))
+        return -EINVAL;
+
+    ret = onefilefs_bread(fsi, fsi->index_start + slot / INDEX_ENTRIES_PER_BLOCK(fsi), buf);
+    if (ret)
+        return ret;
+
+    *entry = (struct onefilefs_index_entry *)buf->data + slot % INDEX_ENTRIES_PER_BLOCK(fsi);
+    return 0;
+}
+
+/**
+ * @brief Account a record appended into the block owning the index entry slot (call with the fs mutex held)
+ * @param fresh non zero if the record is the first one of the block (the entry of a recycled block is reset)
+ */
+void onefilefs_index_update(struct onefilefs_fs_info *fsi, uint64_t slot, int fresh, const char *record, size_t len)
+{
+    struct onefilefs_index_entry *entry;
+    struct onefilefs_buf buf;
+    uint64_t timestamp;
+    uint32_t tgid;
+
+    if (fsi->index_blocks == 0)
+        return;
+
+    if (onefilefs_index_entry_of(fsi, slot, &buf, &entry))
+    {
+        pr_err("%s: [ERROR] Unable to update the index entry %llu\n", MOD_NAME, slot);
+        return;
+    }
+
+    if (fresh)
+    {
+        memset(entry, 0, sizeof(*entry));
+        entry->min_tgid = U32_MAX;
+    }
+
+    entry->records++;
+
+    if (onefilefs_parse_record(record, len, &timestamp, &tgid) == 0)
+    {
+        if (entry->first_timestamp == 0)
+            entry->first_timestamp = timestamp;
+        entry->last_timestamp = timestamp;
+        entry->min_tgid = min(entry->min_tgid, tgid);
+        entry->max_tgid = max(entry->max_tgid, tgid);
+    }
+
+    onefilefs_bdirty(&buf);
+    onefilefs_brelse(&buf);
+}
+
+/**
+ * @brief Rebuild the index entry slot from the records of its block, one per line (call with the fs mutex held)
+ */
+void onefilefs_index_rebuild(struct onefilefs_fs_info *fsi, uint64_t slot, const char *payload, size_t len)
+{
+    const char *end, *eol;
+    int fresh = 1;
+
+    // a logical block of a compressed log may end with padding
+    end = memchr(payload, '\0', len);
+    if (!end)
+        end = payload + len;
+
+    while (payload < end)
+    {
+        eol = memchr(payload, '\n', end - payload);
+        len = eol ? eol - payload + 1 : end - payload;
+        onefilefs_index_update(fsi, slot, fresh, payload, len);
+        payload += len;
+        fresh = 0;
+    }
+}
+
+/**
+ * @brief Size of the companion file: a record for each block of the log file, none if the image has no index
+ */
+loff_t onefilefs_index_size(struct onefilefs_fs_info *fsi)
+{
+    if (fsi->index_blocks == 0)
+        return 0;
+
+    return DIV_ROUND_UP(fsi->file_size, fsi->block_payload) * sizeof(struct onefilefs_index_record);
+}
+
+/**
+ * @brief Follow the size of the log with the one of the companion file, if its inode is cached (call with the fs mutex held)
+ */
+void onefilefs_index_resize(struct onefilefs_fs_info *fsi)
+{
+    struct inode *inode;
+
+    // an inode not looked up yet gets its size at lookup time
+    inode = ilookup(fsi->sb, SINGLEFILEFS_INDEX_INODE_NUMBER);
+    if (!inode)
+        return;
+
+    i_size_write(inode, onefilefs_index_size(fsi));
+    iput(inode);
+}
+
+// the companion file holds a record for each block of the log file, starting from its first one
+static ssize_t onefilefs_index_read(struct file *filp, char __user *buf, size_t len, loff_t *off)
+{
+    struct onefilefs_fs_info *fsi = ONEFILEFS_SB(filp->f_inode->i_sb);
+    struct onefilefs_index_record record;
+    struct onefilefs_index_entry *entry;
+    struct onefilefs_buf entry_buf;
+    uint64_t block, slot, index_size;
+    size_t skip, chunk, copied = 0;
+
+    mutex_lock(&mutex);
+
+    index_size = onefilefs_index_size(fsi);
+
+    while (copied < len && *off < index_size)
+    {
+        block = *off / sizeof(record);
+        skip = *off % sizeof(record);
+
+        // compressed logs index logical blocks, the other ones the blocks of the data region
+        if (fsi->flags & SINGLEFILEFS_FLAG_COMPRESSED)
+            slot = block;
+        else
+            slot = onefilefs_region_block_of(fsi, block * fsi->block_payload);
+
+        if (onefilefs_index_entry_of(fsi, slot, &entry_buf, &entry))
+        {
+            mutex_unlock(&mutex);
+            return copied ? copied : -EIO;
+        }
+
+        record.offset = block * fsi->block_payload;
+        record.first_timestamp = entry->first_timestamp;
+        record.last_timestamp = entry->last_timestamp;
+        record.min_tgid = entry->min_tgid;
+        record.max_tgid = entry->max_tgid;
+        record.records = entry->records;
+        record.reserved = 0;
+        onefilefs_brelse(&entry_buf);
+
+        chunk = min_t(size_t, len - copied, sizeof(record) - skip);
+        if (copy_to_user(buf + copied, (char *)&record + skip, chunk))
+        {
+            mutex_unlock(&mutex);
+            return copied ? copied : -EFAULT;
+        }
+
+        copied += chunk;
+        *off += chunk;
+    }
+
+    mutex_unlock(&mutex);
+    return copied;
+}
+
+const struct file_operations onefilefs_index_operations = {
+    .owner = THIS_MODULE,
+    .read = onefilefs_index_read,
+    .llseek = default_llseek,
+};
@@ -0,0 +1,110 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/buffer_head.h>
+#include <linux/types.h>
+#include <linux/string.h>
+#include <linux/crc32c.h>
+#include <linux/mutex.h>
+
+#include "file_system.h"
+
+/*
+ * Crash recovery of a checksummed log. The boundaries in the superblock are only a hint: they may
+ * lag behind the data blocks that reached the device, or run ahead of a block torn by a crash.
+ * The scan starts from the block holding the hinted tail and moves forward as long as blocks carry
+ * the expected sequence number and a valid CRC, so its cost depends on the data written after the
+ * superblock, not on the size of the log.
+ */
+
+// check the header and the CRC of a data block, returning the CRC32C of its used payload
+static int onefilefs_block_valid(struct onefilefs_fs_info *fsi, const char *block, uint64_t seq, uint32_t *payload_crc)
+{
+    const struct onefilefs_block_header *header = (const struct onefilefs_block_header *)block;
+
+    if (header->seq != seq || header->used == 0 || header->used > fsi->block_payload)
+        return 0;
+
+    *payload_crc = crc32c(~0, block + fsi->block_header, header->used);
+
+    return header->crc == onefilefs_block_crc(fsi, *payload_crc, header);
+}
+
+/**
+ * @brief Move the log boundaries to the last valid block following the hint (called at mount time)
+ * @return 0 on success, a negative error code if the device cannot be read
+ */
+int onefilefs_recover_tail(struct onefilefs_fs_info *fsi)
+{
+    struct onefilefs_block_header *header;
+    struct onefilefs_buf buf;
+    uint64_t segment = fsi->tail_segment;
+    uint64_t head = fsi->head_segment;
+    uint64_t bytes, seq, region_block, scanned = 0;
+    uint64_t hint = fsi->tail_bytes;
+    uint32_t payload_crc;
+    int ret;
+
+    // the block holding the last hinted byte is checked again: later records may have reached it
+    bytes = fsi->tail_bytes ? (fsi->tail_bytes - 1) / fsi->block_payload * fsi->block_payload : 0;
+    seq = fsi->tail_seq;
+
+    // if even the hinted block is not valid, the log resumes at its beginning
+    fsi->tail_bytes = bytes;
+    fsi->tail_seq = seq - 1;
+    fsi->tail_crc = ~0;
+
+    for (;;)
+    {
+        if (bytes == fsi->segment_bytes)
+        {
+            if (!(fsi->flags & SINGLEFILEFS_FLAG_CIRCULAR))
+                break;
+
+            // blocks of the next segment follow the tail as the write path would do
+            segment = (segment + 1) % fsi->segments_count;
+            if (segment == head)
+                head = (head + 1) % fsi->segments_count;
+            bytes = 0;
+        }
+
+        region_block = segment * fsi->segment_blocks + bytes / fsi->block_payload;
+        ret = onefilefs_bread(fsi, onefilefs_device_block(fsi, region_block), &buf);
+        if (ret)
+            return ret;
+
+        if (!onefilefs_block_valid(fsi, buf.data, seq, &payload_crc))
+        {
+            onefilefs_brelse(&buf);
+            break;
+        }
+
+        header = (struct onefilefs_block_header *)buf.data;
+        onefilefs_index_rebuild(fsi, region_block, buf.data + fsi->block_header, header->used);
+
+        fsi->head_segment = head;
+        fsi->tail_segment = segment;
+        fsi->tail_bytes = bytes + header->used;
+        fsi->tail_seq = seq;
+        fsi->tail_crc = payload_crc;
+        onefilefs_brelse(&buf);
+
+        bytes += fsi->block_payload;
+        seq++;
+        scanned++;
+    }
+
+    if (fsi->tail_bytes != hint || fsi->tail_segment != fsi->disk_sb->tail_segment)
+    {
+        printk("%s: [INFO] Log tail recovered at segment %llu, byte %llu (hint was byte %llu, %llu block(s) scanned)\n",
+               MOD_NAME, fsi->tail_segment, fsi->tail_bytes, hint, scanned);
+
+        fsi->disk_sb->head_segment = fsi->head_segment;
+        fsi->disk_sb->tail_segment = fsi->tail_segment;
+        fsi->disk_sb->tail_bytes = fsi->tail_bytes;
+        fsi->disk_sb->tail_seq = fsi->tail_seq;
+        onefilefs_bdirty(&fsi->sb_buf);
+    }
+
+    return 0;
+}
@@ -0,0 +1,51 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+
+#include "file_system.h"
+
+/*
+	Save the image of a mounted singlefilefs (e.g. a RAM mount) into a file, that can be
+	mounted later through a loop device as an image formatted by singlefilemakefs.
+
+	Usage: singlefiledump <mount point>/ref_monitor_log.txt <image>
+*/
+
+int main(int argc, char *argv[])
+{
+	int log_fd, image_fd;
+
+	if (argc != 3) {
+		printf("Usage: singlefiledump <log file> <image>\n");
+		return -1;
+	}
+
+	log_fd = open(argv[1], O_RDONLY);
+	if (log_fd == -1) {
+		perror("Error opening the log file");
+		return -1;
+	}
+
+	image_fd = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (image_fd == -1) {
+		perror("Error opening the image");
+		close(log_fd);
+		return -1;
+	}
+
+	if (ioctl(log_fd, ONEFILEFS_IOC_DUMP, image_fd) == -1) {
+		perror("Error dumping the file system");
+		close(image_fd);
+		close(log_fd);
+		return -1;
+	}
+
+	printf("File system image written succesfully to %s\n", argv[2]);
+
+	close(image_fd);
+	close(log_fd);
+
+	return 0;
+}
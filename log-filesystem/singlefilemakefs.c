@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <stdio.h>
 #include <sys/types.h>
@@ -6,6 +7,10 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/random.h>
+#include <linux/falloc.h>
 
 #include "file_system.h"
 
@@ -14,48 +19,226 @@
 	- BLOCK 0, superblock;
 	- BLOCK 1, inode of the unique file (the inode for root is volatile);
 	- BLOCK 2, ..., datablocks of the unique file 
+
+	With -c <segment_blocks> the data region is formatted as a circular log made of
+	fixed size segments: the oldest segment is recycled when the tail wraps onto it.
+
+	With -z the log is compressed: BLOCK 2, ... keep the frame map, followed by the
+	data region holding the LZ4 frames of the logical blocks of the file.
+
+	The blocks right before the data region keep the sparse index of the log, with an
+	entry for each data block (for each logical block addressed by the map if compressed).
+
+	With -b <block_size> the file system uses blocks of a power of two size between 4K
+	and 64K instead of 4K ones. With -p the blocks of the data region are allocated and
+	zeroed at mkfs time, so that appends never wait for the allocation of a block.
+	The data region is described by the extent table kept in the file inode.
+
+	Blocks of the data region start with a header carrying a CRC32C of the records they hold
+	(frames carry their own CRC32C in compressed mode), so that the log tail can be recovered
+	at mount time after a crash. The CRCs include a random format ID, different from the one
+	of the image found on the device, so that the blocks of a previous log never look valid.
 */
 
+// CRC32C as computed by the kernel crc32c(): reflected, no final inversion
+static uint32_t crc32c(uint32_t crc, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	int bit;
+
+	while (len--) {
+		crc ^= *p++;
+		for (bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (0x82F63B78 & -(crc & 1));
+	}
+
+	return crc;
+}
+
+// Draw the format ID of the new image: random, not 0 and not the one of the image being replaced
+static int draw_format_id(int fd, uint64_t *format_id)
+{
+	struct onefilefs_sb_info old;
+	uint64_t old_id = 0;
+
+	if (pread(fd, &old, sizeof(old), 0) == sizeof(old) && old.magic == MAGIC)
+		old_id = old.format_id;
+
+	do {
+		if (getrandom(format_id, sizeof(*format_id), 0) != sizeof(*format_id))
+			return -1;
+	} while (*format_id == 0 || *format_id == old_id);
+
+	return 0;
+}
+
+static int write_block_padding(int fd, size_t nbytes)
+{
+	char *block_padding;
+	ssize_t ret;
+
+	if (nbytes == 0)
+		return 0;
+
+	block_padding = calloc(1, nbytes);
+	if (!block_padding)
+		return -1;
+	ret = write(fd, block_padding, nbytes);
+	free(block_padding);
+
+	return ret == (ssize_t)nbytes ? 0 : -1;
+}
+
+// Allocate and zero [start, start + length) of the device, whatever its kind (image file or block device)
+static int preallocate(int fd, off_t start, off_t length, uint64_t block_size)
+{
+	uint64_t range[2] = {start, length};
+	char *zeros;
+	off_t done;
+
+	if (fallocate(fd, FALLOC_FL_ZERO_RANGE, start, length) == 0)
+		return 0;
+
+	// a plain allocation keeps the blocks already allocated as they are: free the range first
+	if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, start, length) == 0 &&
+	    fallocate(fd, 0, start, length) == 0)
+		return 0;
+
+	if (ioctl(fd, BLKZEROOUT, range) == 0)
+		return 0;
+
+	// neither the file system of the image nor the device can do it: write the zeros
+	zeros = calloc(1, block_size);
+	if (!zeros || lseek(fd, start, SEEK_SET) == -1) {
+		free(zeros);
+		return -1;
+	}
+	for (done = 0; done < length; done += block_size) {
+		if (write(fd, zeros, block_size) != (ssize_t)block_size) {
+			free(zeros);
+			return -1;
+		}
+	}
+	free(zeros);
+
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
-	int fd, nbytes;
+	int fd, nbytes, opt;
 	ssize_t ret;
+	off_t device_size;
+	uint64_t data_blocks;
+	uint64_t segment_blocks = 0;
+	uint64_t map_blocks = 0;
+	uint64_t index_blocks, i;
+	struct onefilefs_index_entry *index_block;
+	int compressed = 0;
+	int prealloc = 0;
+	uint64_t block_size = DEFAULT_BLOCK_SIZE;
+	struct onefilefs_frame_header frame_header;
+	struct onefilefs_block_header block_header;
+	uint32_t crc;
+	char *map_block;
 	struct onefilefs_sb_info sb;
 	struct onefilefs_inode root_inode;
 	struct onefilefs_inode file_inode;
-	char *block_padding;
-	char *file_body = "TID, TGID, UID, EUID, Offending program path, Fingerprint\n"; 
+	char *file_body = SINGLEFILEFS_LOG_HEADER;
+
+	while ((opt = getopt(argc, argv, "b:c:pz")) != -1) {
+		switch (opt) {
+		case 'c':
+			segment_blocks = strtoull(optarg, NULL, 0);
+			if (segment_blocks == 0) {
+				printf("The segment size must be at least one block.\n");
+				return -1;
+			}
+			break;
+		case 'b':
+			block_size = strtoull(optarg, NULL, 0);
+			if (block_size < SINGLEFILEFS_MIN_BLOCK_SIZE || block_size > SINGLEFILEFS_MAX_BLOCK_SIZE ||
+			    (block_size & (block_size - 1))) {
+				printf("The block size must be a power of two between %d and %d bytes.\n",
+				       SINGLEFILEFS_MIN_BLOCK_SIZE, SINGLEFILEFS_MAX_BLOCK_SIZE);
+				return -1;
+			}
+			break;
+		case 'p':
+			prealloc = 1;
+			break;
+		case 'z':
+			compressed = 1;
+			break;
+		default:
+			printf("Usage: mkfs-singlefilefs [-b <block_size>] [-p] [-c <segment_blocks> | -z] <device>\n");
+			return -1;
+		}
+	}
 
-	if (argc != 2) {
-		printf("Usage: mkfs-singlefilefs <device>\n");
+	if (optind != argc - 1 || (compressed && segment_blocks)) {
+		printf("Usage: mkfs-singlefilefs [-b <block_size>] [-p] [-c <segment_blocks> | -z] <device>\n");
 		return -1;
 	}
 
-	fd = open(argv[1], O_RDWR);
+	fd = open(argv[optind], O_RDWR);
 	if (fd == -1) {
 		perror("Error opening the device");
 		return -1;
 	}
 
+	device_size = lseek(fd, 0, SEEK_END);
+	if (device_size == -1 || lseek(fd, 0, SEEK_SET) == -1) {
+		perror("Error computing the device size");
+		close(fd);
+		return -1;
+	}
+
 	//pack the superblock
-	sb.version = 1;//file system version
-	sb.magic = MAGIC;
-	sb.block_size = DEFAULT_BLOCK_SIZE;
+	switch (singlefilefs_format_sb(&sb, device_size / block_size, block_size, segment_blocks, compressed, &data_blocks)) {
+	case SINGLEFILEFS_FORMAT_TOO_SMALL:
+		printf("The device is too small, at least %d blocks are needed.\n", SINGLEFILEFS_DATA_BLOCK_NUMBER + 1);
+		close(fd);
+		return -1;
+	case SINGLEFILEFS_FORMAT_NO_METADATA:
+		printf("The device is too small for the %slog metadata.\n", compressed ? "compressed " : "");
+		close(fd);
+		return -1;
+	case SINGLEFILEFS_FORMAT_FEW_SEGMENTS:
+		printf("A circular log needs at least 2 segments of %lu blocks (%lu data blocks available).\n",
+		       segment_blocks, data_blocks);
+		close(fd);
+		return -1;
+	}
+	map_blocks = sb.map_blocks;
+	index_blocks = sb.index_blocks;
+
+	if (draw_format_id(fd, &sb.format_id)) {
+		perror("Error drawing the format ID");
+		close(fd);
+		return -1;
+	}
 
 	ret = write(fd, (char *)&sb, sizeof(sb));
 
-	if (ret != DEFAULT_BLOCK_SIZE) {
+	if (ret != DEFAULT_BLOCK_SIZE || write_block_padding(fd, block_size - sizeof(sb))) {
 		printf("Bytes written [%d] are not equal to the default block size.\n", (int)ret);
 		close(fd);
 		return ret;
 	}
 
-	printf("Super block written succesfully\n");
+	printf("Super block written succesfully (%lu segment(s) of %lu blocks of %lu bytes%s)\n", sb.segments_count,
+	       sb.segment_blocks, block_size, compressed ? ", compressed" : "");
 
-	// write file inode
+	// write file inode: the data region is a single extent
+	memset(&file_inode, 0, sizeof(file_inode));
 	file_inode.mode = S_IFREG;
 	file_inode.inode_no = SINGLEFILEFS_FILE_INODE_NUMBER;
 	file_inode.file_size = strlen(file_body);
+	file_inode.data_block_number = data_blocks;
+	file_inode.extents_count = 1;
+	file_inode.extents[0].start = sb.data_start;
+	file_inode.extents[0].length = data_blocks;
 	printf("File size is %ld\n",file_inode.file_size);
 	fflush(stdout);
 	ret = write(fd, (char *)&file_inode, sizeof(file_inode));
@@ -69,18 +252,95 @@ int main(int argc, char *argv[])
 	printf("File inode written succesfully.\n");
 	
 	//padding for block 1
-	nbytes = DEFAULT_BLOCK_SIZE - sizeof(file_inode);
-	block_padding = malloc(nbytes);
-
-	ret = write(fd, block_padding, nbytes);
+	nbytes = block_size - sizeof(file_inode);
 
-	if (ret != nbytes) {
+	if (write_block_padding(fd, nbytes)) {
 		printf("The padding bytes are not written properly. Retry your mkfs\n");
 		close(fd);
 		return -1;
 	}
 	printf("Padding in the inode block written sucessfully.\n");
 
+	if (compressed) {
+		// frame map: the first logical block is the frame at the beginning of the data region
+		map_block = calloc(1, block_size);
+		for (i = 0; i < map_blocks; i++) {
+			ret = write(fd, map_block, block_size);
+			if (ret != (ssize_t)block_size) {
+				printf("Writing the frame map has failed.\n");
+				close(fd);
+				return -1;
+			}
+		}
+		free(map_block);
+		printf("Frame map (%lu blocks) written succesfully.\n", map_blocks);
+	}
+
+	// sparse index: the first block holds the header line, not an indexed record
+	index_block = calloc(1, block_size);
+	index_block[0].records = 1;
+	index_block[0].min_tgid = UINT32_MAX;
+	for (i = 0; i < index_blocks; i++) {
+		ret = write(fd, (char *)index_block, block_size);
+		if (ret != (ssize_t)block_size) {
+			printf("Writing the sparse index has failed.\n");
+			close(fd);
+			return -1;
+		}
+		index_block[0].records = 0;
+		index_block[0].min_tgid = 0;
+	}
+	free(index_block);
+	printf("Sparse index (%lu blocks) written succesfully.\n", index_blocks);
+
+	if (prealloc) {
+		if (preallocate(fd, sb.data_start * block_size, data_blocks * block_size, block_size)) {
+			perror("Preallocating the data region has failed");
+			close(fd);
+			return -1;
+		}
+		printf("Data region (%lu blocks) preallocated succesfully.\n", data_blocks);
+	}
+
+	if (lseek(fd, sb.data_start * block_size, SEEK_SET) == -1) {
+		perror("Error seeking the data region");
+		close(fd);
+		return -1;
+	}
+
+	if (compressed) {
+
+		frame_header.length = strlen(file_body);
+		frame_header.raw_length = strlen(file_body);
+		frame_header.block = 0;
+		crc = crc32c(~0, file_body, frame_header.length);
+		crc = crc32c(crc, &frame_header.block, sizeof(frame_header.block));
+		crc = crc32c(crc, &frame_header.raw_length, sizeof(frame_header.raw_length));
+		crc = crc32c(crc, &frame_header.length, sizeof(frame_header.length));
+		frame_header.crc = crc32c(crc, &sb.format_id, sizeof(sb.format_id));
+		ret = write(fd, (char *)&frame_header, sizeof(frame_header));
+		if (ret != sizeof(frame_header)) {
+			printf("Writing the first frame header has failed.\n");
+			close(fd);
+			return -1;
+		}
+	} else {
+
+		// the header line is the first block of the log (sequence number 0, as the tail hint)
+		block_header.used = strlen(file_body);
+		block_header.seq = 0;
+		crc = crc32c(~0, file_body, block_header.used);
+		crc = crc32c(crc, &block_header.seq, sizeof(block_header.seq));
+		crc = crc32c(crc, &block_header.used, sizeof(block_header.used));
+		block_header.crc = crc32c(crc, &sb.format_id, sizeof(sb.format_id));
+		ret = write(fd, (char *)&block_header, sizeof(block_header));
+		if (ret != sizeof(block_header)) {
+			printf("Writing the first block header has failed.\n");
+			close(fd);
+			return -1;
+		}
+	}
+
 	//write file datablock
 	nbytes = strlen(file_body);
 	ret = write(fd, file_body, nbytes);
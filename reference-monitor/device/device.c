@@ -0,0 +1,318 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/errno.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/cred.h>
+#include <linux/build_bug.h>
+
+#include "device.h"
+#include "../refmon_ioctl.h"
+#include "../stack_reference_monitor.h"
+#include "../utils/utils.h"
+#include "../utils/blacklist.h"
+#include "../stats/stats.h"
+
+/*
+ * /dev/refmon control plane: the operations of the syscalls are also available as ioctl commands,
+ * with stable numbers, so that the module can be used without patching the syscall table
+ * (install_syscalls=0). Blacklist edits are batched: a single call carries many paths and checks
+ * the credentials once.
+ */
+
+static long refmon_set_state(struct refmon_state_req __user *arg)
+{
+    int state;
+
+    if (get_user(state, &arg->state))
+        return -EFAULT;
+
+    return switch_rf_state(state, arg->password);
+}
+
+static long refmon_edit_rules(struct refmon_batch_req __user *arg, int remove)
+{
+    struct refmon_batch_req req;
+    char *paths, *path, *end;
+    size_t len;
+    long ret;
+
+    if (copy_from_user(&req, arg, sizeof(req)))
+        return -EFAULT;
+
+    // Check if the reference monitor is in reconfiguration state
+    ret = is_rf_rec(&reference_monitor);
+    if (ret != 0)
+        return ret;
+
+    // Check the password, or the token of the reconfiguration session
+    ret = rec_credentials_check(arg->credentials, &reference_monitor);
+    if (ret != 0)
+        return ret;
+
+    // Check if the user is running as root
+    ret = euid_check(current_euid());
+    if (ret != 0)
+        return ret;
+
+    if (req.len == 0 || req.len > REFMON_BATCH_MAX_BYTES)
+        return -EINVAL;
+
+    paths = kvmalloc(req.len + 1, GFP_KERNEL);
+    if (!paths)
+    {
+        pr_err("%s: [ERROR] Error in kvmalloc allocation of a batch of %llu bytes\n", MODNAME, req.len);
+        return -ENOMEM;
+    }
+
+    if (copy_from_user(paths, u64_to_user_ptr(req.paths), req.len))
+    {
+        kvfree(paths);
+        return -EFAULT;
+    }
+    // the last path may lack its terminator
+    paths[req.len] = '\0';
+
+    req.applied = 0;
+    req.failed = 0;
+    end = paths + req.len;
+    for (path = paths; path < end; path += len + 1)
+    {
+        len = strlen(path);
+        if (len == 0)
+            continue;
+
+        if (len >= PATH_MAX)
+            ret = -ENAMETOOLONG;
+        else if (remove)
+            ret = blacklist_delete(path, &reference_monitor);
+        else
+            ret = blacklist_insert(path, &reference_monitor);
+
+        if (ret == -ENOMEM)
+            break;
+
+        if (ret == 0)
+            req.applied++;
+        else
+            req.failed++;
+        ret = 0;
+    }
+    kvfree(paths);
+
+    if (req.applied > 0)
+        refresh_hooks();
+
+    printk("%s: [INFO] Batch of %u paths %s blacklist (%u failed)\n", MODNAME, req.applied,
+           remove ? "removed from" : "added to", req.failed);
+
+    if (put_user(req.applied, &arg->applied) || put_user(req.failed, &arg->failed))
+        return -EFAULT;
+
+    return ret;
+}
+
+static long refmon_dump(struct refmon_dump_req __user *arg)
+{
+    struct refmon_dump_req req;
+    long ret;
+
+    if (copy_from_user(&req, arg, sizeof(req)))
+        return -EFAULT;
+
+    ret = dump_blacklist(u64_to_user_ptr(req.buf), req.len, (unsigned long __user *)&arg->cursor, &reference_monitor);
+    if (ret < 0)
+        return ret;
+
+    if (put_user((__u64)ret, &arg->count))
+        return -EFAULT;
+
+    return 0;
+}
+
+static long refmon_stats(struct refmon_stats __user *arg)
+{
+    struct refmon_stats stats;
+
+    memset(&stats, 0, sizeof(stats));
+
+    spin_lock(&reference_monitor.lock);
+    stats.state = reference_monitor.state;
+    stats.rules = reference_monitor.blacklist_size;
+    stats.rule_bytes = reference_monitor.blacklist_bytes;
+    stats.generation = reference_monitor.blacklist_generation;
+    spin_unlock(&reference_monitor.lock);
+    stats.syscalls_installed = install_syscalls ? 1 : 0;
+
+    if (copy_to_user(arg, &stats, sizeof(stats)))
+        return -EFAULT;
+
+    return 0;
+}
+
+// preflight check of many paths, available in any state: it only reads the blacklist and the armed hooks
+static long refmon_query(struct refmon_query_req __user *arg)
+{
+    struct refmon_query_req req;
+    char *paths = NULL;
+    u8 *ops = NULL;
+    u64 *verdicts = NULL;
+    size_t words;
+    u32 i, denied = 0;
+    unsigned int armed;
+    long ret;
+
+    BUILD_BUG_ON(REFMON_OP_OPEN != HOOK_OPEN || REFMON_OP_UNLINK != HOOK_UNLINK || REFMON_OP_CREATE != HOOK_CREATE ||
+                 REFMON_OP_MKDIR != HOOK_MKDIR || REFMON_OP_RENAME != HOOK_RENAME || REFMON_OP_RMDIR != HOOK_RMDIR ||
+                 REFMON_OP_LINK != HOOK_LINK || REFMON_OP_SYMLINK != HOOK_SYMLINK || REFMON_OP_WRITE != HOOK_WRITE ||
+                 REFMON_OP_LSEEK != HOOK_LSEEK || REFMON_OP_READ != NUM_KRETPROBES);
+
+    if (copy_from_user(&req, arg, sizeof(req)))
+        return -EFAULT;
+
+    if (req.len == 0 || req.len > REFMON_BATCH_MAX_BYTES || req.count == 0 || req.count > req.len)
+        return -EINVAL;
+
+    words = DIV_ROUND_UP(req.count, 64);
+    paths = kvmalloc(req.len + 1, GFP_KERNEL);
+    ops = kvmalloc(req.count, GFP_KERNEL);
+    verdicts = kvzalloc(words * sizeof(u64), GFP_KERNEL);
+    if (!paths || !ops || !verdicts)
+    {
+        pr_err("%s: [ERROR] Error in kvmalloc allocation of a query of %u paths\n", MODNAME, req.count);
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    if (copy_from_user(paths, u64_to_user_ptr(req.paths), req.len) ||
+        copy_from_user(ops, u64_to_user_ptr(req.ops), req.count))
+    {
+        ret = -EFAULT;
+        goto out;
+    }
+    // the last path may lack its terminator
+    paths[req.len] = '\0';
+
+    for (i = 0; i < req.count; i++)
+    {
+        if (ops[i] > REFMON_OP_READ)
+        {
+            ret = -EINVAL;
+            goto out;
+        }
+    }
+
+    // a match denies the operation only if its hook is armed (none in OFF/REC_OFF state, see refresh_hooks())
+    armed = armed_kprobes();
+    ret = query_blacklist(paths, req.len, req.count, verdicts, &req.generation, &reference_monitor);
+    if (ret < 0)
+        goto out;
+
+    // the matcher does not depend on the hook, the accesses that no armed hook checks are never denied
+    for (i = 0; i < req.count; i++)
+    {
+        if (ops[i] == REFMON_OP_READ || !(armed & BIT(ops[i])))
+            verdicts[i / 64] &= ~(1ULL << (i % 64));
+        else if (verdicts[i / 64] & (1ULL << (i % 64)))
+            denied++;
+    }
+
+    if (copy_to_user(u64_to_user_ptr(req.verdicts), verdicts, words * sizeof(u64)) ||
+        put_user(denied, &arg->denied) || put_user(req.generation, &arg->generation))
+    {
+        ret = -EFAULT;
+        goto out;
+    }
+
+    ret = 0;
+
+out:
+    kvfree(verdicts);
+    kvfree(ops);
+    kvfree(paths);
+    return ret;
+}
+
+static long refmon_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    void __user *argp = (void __user *)arg;
+
+    switch (cmd)
+    {
+    case REFMON_IOC_GET_STATE:
+        return put_user(READ_ONCE(reference_monitor.state), (__s32 __user *)argp);
+    case REFMON_IOC_SET_STATE:
+        return refmon_set_state(argp);
+    case REFMON_IOC_OPEN_SESSION:
+        return open_rec_session(((struct refmon_session_req __user *)argp)->password,
+                                ((struct refmon_session_req __user *)argp)->token);
+    case REFMON_IOC_ADD_RULES:
+        return refmon_edit_rules(argp, 0);
+    case REFMON_IOC_REMOVE_RULES:
+        return refmon_edit_rules(argp, 1);
+    case REFMON_IOC_DUMP:
+        return refmon_dump(argp);
+    case REFMON_IOC_STATS:
+        return refmon_stats(argp);
+    case REFMON_IOC_QUERY:
+        return refmon_query(argp);
+    default:
+        return -ENOTTY;
+    }
+}
+
+// read-only status page, see struct refmon_shared
+static int refmon_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    return stats_mmap(vma);
+}
+
+static const struct file_operations refmon_fops = {
+    .owner = THIS_MODULE,
+    .unlocked_ioctl = refmon_ioctl,
+    .compat_ioctl = refmon_ioctl,
+    .mmap = refmon_mmap,
+};
+
+static struct miscdevice refmon_device = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = "refmon",
+    .fops = &refmon_fops,
+    .mode = 0600,
+};
+
+static int refmon_device_registered;
+
+int refmon_device_init(void)
+{
+    int ret;
+
+    BUILD_BUG_ON(PASSW_LEN > REFMON_SECRET_LEN);
+    BUILD_BUG_ON(REC_TOKEN_LEN > REFMON_SECRET_LEN);
+
+    ret = misc_register(&refmon_device);
+    if (ret)
+    {
+        pr_err("%s: [ERROR] Cannot register %s (error %d)\n", MODNAME, REFMON_DEVICE, ret);
+        return ret;
+    }
+    refmon_device_registered = 1;
+
+    AUDIT
+    {
+        printk("%s: [INFO] Control device %s registered\n", MODNAME, REFMON_DEVICE);
+    }
+
+    return 0;
+}
+
+void refmon_device_clean(void)
+{
+    if (refmon_device_registered)
+        misc_deregister(&refmon_device);
+    refmon_device_registered = 0;
+}
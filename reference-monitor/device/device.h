@@ -0,0 +1,6 @@
+#ifndef REFMON_DEVICE_MODULE
+#define REFMON_DEVICE_MODULE
+
+int refmon_device_init(void);
+void refmon_device_clean(void);
+#endif
@@ -2,11 +2,18 @@
 #include <linux/kprobes.h>
 #include <linux/errno.h>
 #include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/bits.h>
+#include <linux/bitops.h>
+#include <linux/jump_label.h>
+#include <linux/sched/clock.h>
+#include <linux/dcache.h>
 
 #include "kprobes.h"
 #include "../stack_reference_monitor.h"
 #include "../utils/utils.h"
 #include "../log/logger.h"
+#include "../trace/refmon_trace.h"
 
 // kretprobes structs
 struct kretprobe file_open;
@@ -19,29 +26,113 @@ struct kretprobe file_link;
 struct kretprobe file_symlink;
 struct kretprobe file_write;
 struct kretprobe file_lseek;
+// armed with the open hook, whose counters it shares (see file_receive_entry_handler())
+struct kretprobe file_receive;
 
 // kretprobes array
 struct kretprobe **kprobe_array;
 
+// per-CPU counters of each hook, summed when read (see stats/stats.c)
+DEFINE_PER_CPU(struct hook_stats, hook_stats[NUM_KRETPROBES]);
+
+#define HOOK_INC(hook, field) this_cpu_inc(hook_stats[hook].field)
+
+const char *hook_names[NUM_KRETPROBES] = {"open", "unlink", "create", "mkdir", "rename", "rmdir", "link", "symlink", "write", "lseek"};
+
+// per-CPU log2 histograms of the time spent in each phase of the hooks, timed only while enabled (see stats/stats.c)
+DEFINE_STATIC_KEY_FALSE(hook_latency_enabled);
+DEFINE_PER_CPU(struct hook_latency, hook_latency[NUM_KRETPROBES][NUM_PHASES]);
+
+const char *phase_names[NUM_PHASES] = {"resolve", "match", "log"};
+
+static inline u64 latency_start(void)
+{
+    return static_branch_unlikely(&hook_latency_enabled) ? local_clock() : 0;
+}
+
+// a phase started before the histograms were enabled (start is 0) is not counted
+static inline void latency_end(int hook, int phase, u64 start)
+{
+    u64 delta;
+    int bucket;
+
+    if (!static_branch_unlikely(&hook_latency_enabled) || start == 0)
+        return;
+
+    delta = local_clock() - start;
+    bucket = delta ? min(fls64(delta) - 1, LATENCY_BUCKETS - 1) : 0;
+    this_cpu_inc(hook_latency[hook][phase].buckets[bucket]);
+}
+
+static void hook_enter(int hook)
+{
+    HOOK_INC(hook, calls);
+    trace_refmon_hook_entry(hook);
+}
+
+static char *resolve_path(int hook, struct dentry *dentry)
+{
+    u64 start = latency_start();
+    char *path;
+
+    HOOK_INC(hook, resolutions);
+    path = get_path_from_dentry(dentry);
+    latency_end(hook, PHASE_RESOLVE, start);
+
+    return path;
+}
+
+// match the path resolved from dentry, timed for the histograms and for the verdict tracepoint
+static int match_path(char *path, int hook, struct dentry *dentry)
+{
+    u64 start = 0;
+    u32 rule = 0;
+    int ret;
+
+    if (static_branch_unlikely(&hook_latency_enabled) || trace_refmon_verdict_enabled())
+        start = local_clock();
+
+    ret = is_blacklisted(path, hook, &rule);
+    latency_end(hook, PHASE_MATCH, start);
+
+    if (trace_refmon_verdict_enabled())
+        trace_refmon_verdict(hook, dentry && d_really_is_positive(dentry) ? d_inode(dentry)->i_ino : 0, rule,
+                             start ? local_clock() - start : 0, ret == 1);
+
+    return ret;
+}
+
+/**
+ * @brief Instances of the hook that were missed because its kretprobe pool was empty
+ */
+unsigned long hook_nmissed(int hook)
+{
+    if (kprobe_array == NULL)
+    {
+        return 0;
+    }
+
+    return kprobe_array[hook]->nmissed;
+}
+
 /* Registers saved on stack as arguments are rdx,rsi,rcx,r8.r9, ... in x86 */
 
 
 static int ret_handler(struct kretprobe_instance *ri, struct pt_regs *regs)
 {
     struct probe_data *probe_data = (struct probe_data *)ri->data;
-    pr_err("%s", probe_data->error_message);
+    u64 start;
 
     regs->ax = -EACCES;
+    start = latency_start();
     write_on_log();
-
-    kfree(probe_data->error_message);
+    latency_end(probe_data->hook, PHASE_LOG, start);
 
     return 0;
 }
 
 static int open_entry_handler(struct kretprobe_instance *ri, struct pt_regs *regs)
 {
-    char error_message[256];
     struct probe_data *probe_data;
     struct path path;
     struct dentry *dentry;
@@ -49,6 +140,7 @@ static int open_entry_handler(struct kretprobe_instance *ri, struct pt_regs *reg
     char *full_path;
     int flags;
 
+    hook_enter(HOOK_OPEN);
 
     file = (struct file *)regs->di;
 
@@ -59,12 +151,12 @@ static int open_entry_handler(struct kretprobe_instance *ri, struct pt_regs *reg
     // Check if the file is opened WRITE-ONLY or READ-WRITE
     if (flags & O_WRONLY || flags & O_RDWR || flags & O_CREAT || flags & O_APPEND || flags & O_TRUNC)
     {
-        full_path = get_path_from_dentry(dentry);
-        if (is_blacklisted(full_path) == 1)
+        full_path = resolve_path(HOOK_OPEN, dentry);
+        if (match_path(full_path, HOOK_OPEN, dentry) == 1)
         {
             probe_data = (struct probe_data *)ri->data;
-            sprintf(error_message, "%s: [ERROR] vfs open on file %s blocked\n", MODNAME, full_path);
-            probe_data->error_message = kstrdup(error_message, GFP_KERNEL);
+            probe_data->hook = HOOK_OPEN;
+            HOOK_INC(HOOK_OPEN, matches);
             return 0;
         }
     }
@@ -72,31 +164,65 @@ static int open_entry_handler(struct kretprobe_instance *ri, struct pt_regs *reg
     return 1;
 }
 
+/*
+ * A file received over a unix socket (or with pidfd_getfd) is checked like it was opened by the receiver:
+ * a writable one opened before its rule was added could otherwise reach a process after the open files
+ * were scanned, with write/lseek disarmed.
+ */
+static int file_receive_entry_handler(struct kretprobe_instance *ri, struct pt_regs *regs)
+{
+    struct probe_data *probe_data;
+    struct dentry *dentry;
+    struct file *file;
+    char *full_path;
+
+    hook_enter(HOOK_OPEN);
+
+    file = (struct file *)regs->di;
+    if (!(file->f_mode & FMODE_WRITE))
+    {
+        return 1;
+    }
+
+    dentry = file->f_path.dentry;
+    full_path = resolve_path(HOOK_OPEN, dentry);
+    if (match_path(full_path, HOOK_OPEN, dentry) == 1)
+    {
+        probe_data = (struct probe_data *)ri->data;
+        probe_data->hook = HOOK_OPEN;
+        HOOK_INC(HOOK_OPEN, matches);
+        return 0;
+    }
+
+    return 1;
+}
+
 static int inode_link_entry_handler(struct kretprobe_instance *ri, struct pt_regs *regs)
 {
-    char error_message[256];
     struct probe_data *probe_data;
     struct dentry *old_dentry;
     struct dentry *dentry;
     char *full_old_path;
     char *full_path;
 
+    hook_enter(HOOK_LINK);
+
     old_dentry = (struct dentry *)regs->di;
     dentry = (struct dentry *)regs->dx;
 
-    full_old_path = get_path_from_dentry(old_dentry);
-    full_path = get_path_from_dentry(dentry);
+    full_old_path = resolve_path(HOOK_LINK, old_dentry);
+    full_path = resolve_path(HOOK_LINK, dentry);
 
-    if (is_blacklisted(full_old_path) == 1)
+    if (match_path(full_old_path, HOOK_LINK, old_dentry) == 1)
     {
         probe_data = (struct probe_data *)ri->data;
-        sprintf(error_message, "%s: [ERROR] Link on dir %s blocked\n", MODNAME, full_old_path);
-        probe_data->error_message = kstrdup(error_message, GFP_KERNEL);
+        probe_data->hook = HOOK_LINK;
+        HOOK_INC(HOOK_LINK, matches);
         return 0;
-    }else if(is_blacklisted(full_path) == 1){
+    }else if(match_path(full_path, HOOK_LINK, dentry) == 1){
         probe_data = (struct probe_data *)ri->data;
-        sprintf(error_message, "%s: [ERROR] Link on dir %s blocked\n", MODNAME, full_path);
-        probe_data->error_message = kstrdup(error_message, GFP_KERNEL);
+        probe_data->hook = HOOK_LINK;
+        HOOK_INC(HOOK_LINK, matches);
         return 0;
     }
 
@@ -105,20 +231,21 @@ static int inode_link_entry_handler(struct kretprobe_instance *ri, struct pt_reg
 
 static int inode_symlink_entry_handler(struct kretprobe_instance *ri, struct pt_regs *regs)
 {
-    char error_message[256];
     struct probe_data *probe_data;
     struct dentry *dentry;
     char *full_path;
 
+    hook_enter(HOOK_SYMLINK);
+
     dentry = (struct dentry *)regs->si;
 
-    full_path = get_path_from_dentry(dentry);
+    full_path = resolve_path(HOOK_SYMLINK, dentry);
 
-    if (is_blacklisted(full_path) == 1)
+    if (match_path(full_path, HOOK_SYMLINK, dentry) == 1)
     {
         probe_data = (struct probe_data *)ri->data;
-        sprintf(error_message, "%s: [ERROR] Unlink on dir %s blocked\n", MODNAME, full_path);
-        probe_data->error_message = kstrdup(error_message, GFP_KERNEL);
+        probe_data->hook = HOOK_SYMLINK;
+        HOOK_INC(HOOK_SYMLINK, matches);
         return 0;
     }
 
@@ -127,20 +254,21 @@ static int inode_symlink_entry_handler(struct kretprobe_instance *ri, struct pt_
 
 static int inode_unlink_entry_handler(struct kretprobe_instance *ri, struct pt_regs *regs)
 {
-    char error_message[256];
     struct probe_data *probe_data;
     struct dentry *dentry;
     char *full_path;
 
+    hook_enter(HOOK_UNLINK);
+
     dentry = (struct dentry *)regs->si;
 
-    full_path = get_path_from_dentry(dentry);
+    full_path = resolve_path(HOOK_UNLINK, dentry);
 
-    if (is_blacklisted(full_path) == 1)
+    if (match_path(full_path, HOOK_UNLINK, dentry) == 1)
     {
         probe_data = (struct probe_data *)ri->data;
-        sprintf(error_message, "%s: [ERROR] Unlink on dir %s blocked\n", MODNAME, full_path);
-        probe_data->error_message = kstrdup(error_message, GFP_KERNEL);
+        probe_data->hook = HOOK_UNLINK;
+        HOOK_INC(HOOK_UNLINK, matches);
         return 0;
     }
 
@@ -151,18 +279,19 @@ static int inode_create_entry_handler(struct kretprobe_instance *ri, struct pt_r
 {
     struct dentry *dentry;
     char *full_path;
-    char error_message[256];
     struct probe_data *probe_data;
 
+    hook_enter(HOOK_CREATE);
+
     dentry = (struct dentry *)regs->si;
 
-    full_path = get_path_from_dentry(dentry);
+    full_path = resolve_path(HOOK_CREATE, dentry);
 
-    if (is_blacklisted(full_path) == 1)
+    if (match_path(full_path, HOOK_CREATE, dentry) == 1)
     {
         probe_data = (struct probe_data *)ri->data;
-        sprintf(error_message, "%s: [ERROR] Create on file %s blocked\n", MODNAME, full_path);
-        probe_data->error_message = kstrdup(error_message, GFP_KERNEL);
+        probe_data->hook = HOOK_CREATE;
+        HOOK_INC(HOOK_CREATE, matches);
         return 0;
     }
 
@@ -174,19 +303,20 @@ static int inode_mkdir_entry_handler(struct kretprobe_instance *ri, struct pt_re
     struct dentry *dentry;
     struct dentry *parent_dentry;
     char *full_path;
-    char error_message[256];
     struct probe_data *probe_data;
 
+    hook_enter(HOOK_MKDIR);
+
     dentry = (struct dentry *)regs->si;
 
     parent_dentry = dentry->d_parent;
-    full_path = get_path_from_dentry(dentry);
+    full_path = resolve_path(HOOK_MKDIR, dentry);
 
-    if (is_blacklisted(full_path) == 1)
+    if (match_path(full_path, HOOK_MKDIR, dentry) == 1)
     {
         probe_data = (struct probe_data *)ri->data;
-        sprintf(error_message, "%s: [ERROR] Mkdir on file %s blocked\n", MODNAME, full_path);
-        probe_data->error_message = kstrdup(error_message, GFP_KERNEL);
+        probe_data->hook = HOOK_MKDIR;
+        HOOK_INC(HOOK_MKDIR, matches);
         return 0;
     }
 
@@ -195,31 +325,32 @@ static int inode_mkdir_entry_handler(struct kretprobe_instance *ri, struct pt_re
 
 static int inode_rename_entry_handler(struct kretprobe_instance *ri, struct pt_regs *regs)
 {
-    char error_message[256];
     struct probe_data *probe_data;
     struct dentry *old_dentry;
     struct dentry *dentry;
     char *full_old_path;
     char *full_path;
 
+    hook_enter(HOOK_RENAME);
+
     old_dentry = (struct dentry *)regs->si;
     dentry = (struct dentry *)regs->cx;
 
 
-    full_old_path = get_path_from_dentry(old_dentry);
-    full_path = get_path_from_dentry(dentry);   
+    full_old_path = resolve_path(HOOK_RENAME, old_dentry);
+    full_path = resolve_path(HOOK_RENAME, dentry);   
 
 
-    if (is_blacklisted(full_old_path) == 1)
+    if (match_path(full_old_path, HOOK_RENAME, old_dentry) == 1)
     {
         probe_data = (struct probe_data *)ri->data;
-        sprintf(error_message, "%s: [ERROR] Rename on dir %s blocked\n", MODNAME, full_old_path);
-        probe_data->error_message = kstrdup(error_message, GFP_KERNEL);
+        probe_data->hook = HOOK_RENAME;
+        HOOK_INC(HOOK_RENAME, matches);
         return 0;
-    }else if(is_blacklisted(full_path) == 1){
+    }else if(match_path(full_path, HOOK_RENAME, dentry) == 1){
         probe_data = (struct probe_data *)ri->data;
-        sprintf(error_message, "%s: [ERROR] Link on dir %s blocked\n", MODNAME, full_path);
-        probe_data->error_message = kstrdup(error_message, GFP_KERNEL);
+        probe_data->hook = HOOK_RENAME;
+        HOOK_INC(HOOK_RENAME, matches);
         return 0;
     }
 
@@ -233,19 +364,20 @@ static int inode_rmdir_entry_handler(struct kretprobe_instance *ri, struct pt_re
     struct dentry *dentry;
     struct dentry *parent_dentry;
     char *full_path;
-    char error_message[256];
     struct probe_data *probe_data;
 
+    hook_enter(HOOK_RMDIR);
+
     dentry = (struct dentry *)regs->si;
 
     parent_dentry = dentry->d_parent;
-    full_path = get_path_from_dentry(dentry);
+    full_path = resolve_path(HOOK_RMDIR, dentry);
 
-    if (is_blacklisted(full_path) == 1 || is_blacklisted(get_path_from_dentry(parent_dentry)) == 1)
+    if (match_path(full_path, HOOK_RMDIR, dentry) == 1 || match_path(resolve_path(HOOK_RMDIR, parent_dentry), HOOK_RMDIR, parent_dentry) == 1)
     {
         probe_data = (struct probe_data *)ri->data;
-        sprintf(error_message, "%s: [ERROR] Rmdir on file %s blocked\n", MODNAME, full_path);
-        probe_data->error_message = kstrdup(error_message, GFP_KERNEL);
+        probe_data->hook = HOOK_RMDIR;
+        HOOK_INC(HOOK_RMDIR, matches);
         return 0;
     }
 
@@ -257,22 +389,23 @@ static int vfs_write_entry_handler(struct kretprobe_instance *ri, struct pt_regs
     struct dentry *dentry;
     struct file *file;
     char *full_path;
-    char error_message[256];
     struct probe_data *probe_data;
     struct path path;
 
+    hook_enter(HOOK_WRITE);
+
     file = (struct file *)regs->di;
 
     path = file->f_path;
     dentry = path.dentry;
 
-    full_path = get_path_from_dentry(dentry);
+    full_path = resolve_path(HOOK_WRITE, dentry);
 
-    if (is_blacklisted(full_path) == 1)
+    if (match_path(full_path, HOOK_WRITE, dentry) == 1)
     {
         probe_data = (struct probe_data *)ri->data;
-        sprintf(error_message, "%s: [ERROR] Write on file %s blocked\n", MODNAME, full_path);
-        probe_data->error_message = kstrdup(error_message, GFP_KERNEL);
+        probe_data->hook = HOOK_WRITE;
+        HOOK_INC(HOOK_WRITE, matches);
         return 0;
     }
 
@@ -284,22 +417,23 @@ static int vfs_lseek_entry_handler(struct kretprobe_instance *ri, struct pt_regs
     struct dentry *dentry;
     struct file *file;
     char *full_path;
-    char error_message[256];
     struct probe_data *probe_data;
     struct path path;
 
+    hook_enter(HOOK_LSEEK);
+
     file = (struct file *)regs->di;
 
     path = file->f_path;
     dentry = path.dentry;
 
-    full_path = get_path_from_dentry(dentry);
+    full_path = resolve_path(HOOK_LSEEK, dentry);
 
-    if (is_blacklisted(full_path) == 1)
+    if (match_path(full_path, HOOK_LSEEK, dentry) == 1)
     {
         probe_data = (struct probe_data *)ri->data;
-        sprintf(error_message, "%s: [ERROR] Lseek on file %s blocked\n", MODNAME, full_path);
-        probe_data->error_message = kstrdup(error_message, GFP_KERNEL);
+        probe_data->hook = HOOK_LSEEK;
+        HOOK_INC(HOOK_LSEEK, matches);
         return 0;
     }
 
@@ -316,46 +450,67 @@ void set_kretprobe(struct kretprobe *krp, char *symbol_name, kretprobe_handler_t
     krp->data_size = sizeof(struct probe_data);
 }
 
-void enable_kprobes()
+// hooks currently enabled, one bit per kretprobe (callers of arm_kprobes serialize)
+static unsigned int armed_hooks;
+
+/**
+ * @brief Enable the kretprobes of the hooks in mask (bit i for kprobe_array[i]) and disable the others
+ */
+void arm_kprobes(unsigned int mask)
 {
     int i, ret;
 
     if (kprobe_array == NULL)
     {
         pr_err("%s: [ERROR] Probe array is null", MODNAME);
+        return;
     }
+
     for (i = 0; i < NUM_KRETPROBES; i++)
     {
-        ret = enable_kretprobe(kprobe_array[i]);
-        if (ret == -1)
+        if ((mask & BIT(i)) && !(armed_hooks & BIT(i)))
         {
-            pr_err("%s: [ERROR] Kretprobe enabling failed\n", MODNAME);
+            ret = enable_kretprobe(kprobe_array[i]);
+            if (ret == 0 && i == HOOK_OPEN)
+            {
+                ret = enable_kretprobe(&file_receive);
+                if (ret != 0)
+                {
+                    disable_kretprobe(kprobe_array[i]);
+                }
+            }
+            if (ret != 0)
+            {
+                pr_err("%s: [ERROR] Kretprobe %s enabling failed\n", MODNAME, hook_names[i]);
+                continue;
+            }
+            armed_hooks |= BIT(i);
+        }
+        else if (!(mask & BIT(i)) && (armed_hooks & BIT(i)))
+        {
+            ret = disable_kretprobe(kprobe_array[i]);
+            if (ret == 0 && i == HOOK_OPEN)
+            {
+                ret = disable_kretprobe(&file_receive);
+            }
+            if (ret != 0)
+            {
+                pr_err("%s: [ERROR] Kretprobe %s disabling failed\n", MODNAME, hook_names[i]);
+                continue;
+            }
+            armed_hooks &= ~BIT(i);
         }
     }
 
     AUDIT
     {
-        printk("%s: [INFO] Kretprobes enabled\n", MODNAME);
+        printk("%s: [INFO] Kretprobes armed: mask 0x%03x\n", MODNAME, armed_hooks);
     }
 }
 
-void disable_kprobes()
+unsigned int armed_kprobes(void)
 {
-    int i, ret;
-
-    for (i = 0; i < NUM_KRETPROBES; i++)
-    {
-        ret = disable_kretprobe(kprobe_array[i]);
-        if (ret == -1)
-        {
-            pr_err("%s: [ERROR] Kretprobe disabling failed\n", MODNAME);
-        }
-    }
-
-    AUDIT
-    {
-        printk("%s: [INFO] Kretprobes disabled\n", MODNAME);
-    }
+    return READ_ONCE(armed_hooks);
 }
 
 int kretprobe_init()
@@ -375,6 +530,7 @@ int kretprobe_init()
 
     set_kretprobe(&file_write, "vfs_write", (kretprobe_handler_t)vfs_write_entry_handler);
     set_kretprobe(&file_lseek, "vfs_llseek", (kretprobe_handler_t)vfs_lseek_entry_handler);
+    set_kretprobe(&file_receive, "security_file_receive", (kretprobe_handler_t)file_receive_entry_handler);
 
     /* kretprobes array allocation */
     kprobe_array = kmalloc(NUM_KRETPROBES * sizeof(struct kretprobe *), GFP_KERNEL);
@@ -401,6 +557,14 @@ int kretprobe_init()
         pr_err("%s: [ERROR] Kretprobes registration failed, returned %d\n", MODNAME, ret);
         return ret;
     }
+
+    ret = register_kretprobe(&file_receive);
+    if (ret != 0)
+    {
+        pr_err("%s: [ERROR] Kretprobe registration on security_file_receive failed, returned %d\n", MODNAME, ret);
+        unregister_kretprobes(kprobe_array, NUM_KRETPROBES);
+        return ret;
+    }
     AUDIT
     {
         printk("%s: [INFO] Kretprobes correctly installed\n", MODNAME);
@@ -411,6 +575,7 @@ int kretprobe_init()
 
 void kretprobe_clean()
 {
+    unregister_kretprobe(&file_receive);
     unregister_kretprobes(kprobe_array, NUM_KRETPROBES);
 
     AUDIT
@@ -2,14 +2,67 @@
 #define KRET_MODULE
 #define NUM_KRETPROBES 10
 
+#include <linux/percpu.h>
+#include <linux/types.h>
+#include <linux/bits.h>
+#include <linux/jump_label.h>
+
+// hooks, in the order of the kretprobes array
+enum rf_hook {
+        HOOK_OPEN,
+        HOOK_UNLINK,
+        HOOK_CREATE,
+        HOOK_MKDIR,
+        HOOK_RENAME,
+        HOOK_RMDIR,
+        HOOK_LINK,
+        HOOK_SYMLINK,
+        HOOK_WRITE,
+        HOOK_LSEEK,
+};
+
+#define ALL_HOOKS       ((1U << NUM_KRETPROBES) - 1)
+// hooks needed by any non empty blacklist, the others depend on the open files (see blacklist_hooks())
+#define BASE_HOOKS      (ALL_HOOKS & ~WRITE_HOOKS)
+#define WRITE_HOOKS     (BIT(HOOK_WRITE) | BIT(HOOK_LSEEK))
+
+struct hook_stats {
+        u64 calls;              /**< entry handler invocations */
+        u64 matches;            /**< operations denied */
+        u64 resolutions;        /**< paths resolved from a dentry */
+};
+
+DECLARE_PER_CPU(struct hook_stats, hook_stats[NUM_KRETPROBES]);
+extern const char *hook_names[NUM_KRETPROBES];
+
+// timed phases of a hook: path resolution and matching in the entry handler, log scheduling on denials
+enum rf_phase {
+        PHASE_RESOLVE,
+        PHASE_MATCH,
+        PHASE_LOG,
+        NUM_PHASES
+};
+
+// bucket i counts the durations in [2^i, 2^(i+1)) ns, the last one also the longer ones
+#define LATENCY_BUCKETS 32
+
+struct hook_latency {
+        u64 buckets[LATENCY_BUCKETS];
+};
+
+DECLARE_STATIC_KEY_FALSE(hook_latency_enabled);
+DECLARE_PER_CPU(struct hook_latency, hook_latency[NUM_KRETPROBES][NUM_PHASES]);
+extern const char *phase_names[NUM_PHASES];
+
 
 struct probe_data {
-        char *error_message;
+        int hook;               /**< hook that denied the operation */
 };
 
 
 int kretprobe_init(void);
 void kretprobe_clean(void);
-void enable_kprobes(void);
-void disable_kprobes(void);
+void arm_kprobes(unsigned int mask);
+unsigned int armed_kprobes(void);
+unsigned long hook_nmissed(int hook);
 #endif
\ No newline at end of file
@@ -13,10 +13,12 @@
 #include <linux/mm.h>
 #include <linux/errno.h>
 #include <linux/uaccess.h>
+#include <linux/timekeeping.h>
 
 #include "logger.h"
 #include "../stack_reference_monitor.h"
 #include "../utils/utils.h"
+#include "../trace/refmon_trace.h"
 
 spinlock_t def_work_lock;
 
@@ -41,24 +43,22 @@ void deferred_work(unsigned long data)
         hash = encrypt_password((const char *)log_data->exe_path);
         
 
-        /* string to be written to the log */
-        snprintf(row, 256, "%d, %d, %u, %u, %s, %s\n", log_data->tid, log_data->tgid,
+        /* string to be written to the log (the leading timestamp and TGID are indexed by the log file system) */
+        snprintf(row, 256, "%lld, %d, %d, %u, %u, %s, %s\n", (long long)log_data->timestamp, log_data->tid, log_data->tgid,
                  log_data->uid, log_data->euid, log_data->exe_path, hash);
+        kfree(hash);
 
 
         file = filp_open(LOG_FILE, O_WRONLY, 0644);
         if (IS_ERR(file))
         {
                 pr_err("Error in opening log file (maybe the VFS is not mounted): %ld\n", PTR_ERR(file));
+                trace_refmon_log_dequeue(log_data->tid, PTR_ERR(file));
                 return;
         }
 
         ret = kernel_write(file, row, strlen(row), &file->f_pos);
-
-        AUDIT
-        {
-                pr_info("%s: written %ld bytes on log\n", MODNAME, ret);
-        }
+        trace_refmon_log_dequeue(log_data->tid, ret);
 
         filp_close(file, NULL);
 
@@ -93,6 +93,7 @@ void write_on_log(void)
         exe_path = get_path_from_dentry(exe_dentry);
 
         log_data->exe_path = kstrdup(exe_path, GFP_ATOMIC);
+        log_data->timestamp = ktime_get_real_seconds();
         log_data->tid = current->pid;
         log_data->tgid = task_tgid_vnr(current);
         log_data->uid = current_uid().val;
@@ -112,6 +113,7 @@ void write_on_log(void)
 
         __INIT_WORK(&(def_work->the_work), (void *)deferred_work, (unsigned long)(&(def_work->the_work)));
 
+        trace_refmon_log_enqueue(log_data->tid, log_data->exe_path);
         schedule_work(&def_work->the_work);
 
 }
\ No newline at end of file
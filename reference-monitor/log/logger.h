@@ -2,8 +2,10 @@
 #define LOG_MODULE
 
 #include <linux/workqueue.h>
+#include <linux/time64.h>
 
 struct log_data {
+        time64_t timestamp;
         int tid;
         int tgid;
         unsigned int uid;
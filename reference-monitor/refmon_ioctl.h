@@ -0,0 +1,113 @@
+#ifndef REFMON_IOCTL
+#define REFMON_IOCTL
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/*
+ * ioctl interface of the /dev/refmon misc device, an alternative to the syscalls installed in the
+ * syscall table: its numbers do not depend on the free entries found at module load. Structures
+ * have a fixed layout, user addresses are carried in 64 bit fields. Shared with user space.
+ */
+
+#define REFMON_DEVICE           "/dev/refmon"
+#define REFMON_IOC_MAGIC        'R'
+
+// room for the password (PASSW_LEN) or for a reconfiguration session token, NUL terminated
+#define REFMON_SECRET_LEN       32
+
+struct refmon_state_req {
+        __s32 state;                            /**< RF_ON, RF_OFF, RF_REC_ON or RF_REC_OFF */
+        __u32 reserved;
+        char password[REFMON_SECRET_LEN];
+};
+
+struct refmon_session_req {
+        char password[REFMON_SECRET_LEN];
+        char token[REFMON_SECRET_LEN];          /**< out: token of the reconfiguration session */
+};
+
+struct refmon_batch_req {
+        char credentials[REFMON_SECRET_LEN];    /**< password or token of the reconfiguration session */
+        __u64 paths;                            /**< address of NUL terminated paths, one after the other */
+        __u64 len;                              /**< bytes at paths, at most REFMON_BATCH_MAX_BYTES */
+        __u32 applied;                          /**< out: paths added (removed) */
+        __u32 failed;                           /**< out: paths already (not) in the blacklist, or too long */
+};
+
+#define REFMON_BATCH_MAX_BYTES  (16 << 20)
+
+// entries are packed as for the dump_blacklist syscall: a 32 bit length followed by the path
+struct refmon_dump_req {
+        __u64 buf;
+        __u64 len;
+        __u64 cursor;                           /**< in/out: 0 to start, then the cursor returned by the last call */
+        __u64 count;                            /**< out: entries copied to buf, 0 at the end of the blacklist */
+};
+
+struct refmon_stats {
+        __s32 state;
+        __u32 rules;                            /**< paths in the blacklist */
+        __u64 rule_bytes;                       /**< total length of the blacklisted paths */
+        __u32 generation;                       /**< incremented at each change of the blacklist */
+        __u32 syscalls_installed;               /**< 1 if the syscalls were also installed in the syscall table */
+};
+
+/*
+ * Operations of a query, in the order of the hooks (and of the hooks file in debugfs). An open is
+ * checked only when it asks for writing, REFMON_OP_READ stands for the other accesses, never denied.
+ * As for the real operations, a path is denied only if the hook of the operation is armed.
+ */
+#define REFMON_OP_OPEN          0
+#define REFMON_OP_UNLINK        1
+#define REFMON_OP_CREATE        2
+#define REFMON_OP_MKDIR         3
+#define REFMON_OP_RENAME        4
+#define REFMON_OP_RMDIR         5
+#define REFMON_OP_LINK          6
+#define REFMON_OP_SYMLINK       7
+#define REFMON_OP_WRITE         8
+#define REFMON_OP_LSEEK         9
+#define REFMON_OP_READ          10
+
+// paths are packed as for a batch, all of them are matched against the same version of the blacklist
+struct refmon_query_req {
+        __u64 paths;                            /**< address of NUL terminated paths, one after the other */
+        __u64 len;                              /**< bytes at paths, at most REFMON_BATCH_MAX_BYTES */
+        __u64 ops;                              /**< address of count __u8, the REFMON_OP_* intended on each path */
+        __u64 verdicts;                         /**< out: address of (count + 63) / 64 __u64, bit i set if op i would be denied */
+        __u32 count;                            /**< paths at paths */
+        __u32 denied;                           /**< out: bits set in verdicts */
+        __u32 generation;                       /**< out: generation of the blacklist used */
+        __u32 reserved;
+};
+
+/*
+ * Read-only status page, mapped with mmap(NULL, sizeof(struct refmon_shared), PROT_READ, MAP_SHARED, fd, 0)
+ * on /dev/refmon. The kernel rewrites it at each state change and blacklist edit, and every second for
+ * the counters. seq is odd while an update is in progress: a reader loads seq, copies the fields, and
+ * retries if seq was odd or changed meanwhile (with read barriers around the copy), as for the vDSO.
+ */
+struct refmon_shared {
+        __u32 seq;
+        __s32 state;
+        __u32 rules;                            /**< paths in the blacklist */
+        __u32 generation;                       /**< incremented at each change of the blacklist */
+        __u64 rule_bytes;                       /**< total length of the blacklisted paths */
+        __u32 armed_hooks;                      /**< bit i set if hook i is armed (order of enum rf_hook) */
+        __u32 syscalls_installed;
+        __u64 calls;                            /**< hook invocations, summed over all hooks */
+        __u64 denials;                          /**< operations denied, summed over all hooks */
+        __u64 updated_ns;                       /**< CLOCK_REALTIME of the last update, in nanoseconds */
+};
+
+#define REFMON_IOC_GET_STATE    _IOR(REFMON_IOC_MAGIC, 1, __s32)
+#define REFMON_IOC_SET_STATE    _IOW(REFMON_IOC_MAGIC, 2, struct refmon_state_req)
+#define REFMON_IOC_OPEN_SESSION _IOWR(REFMON_IOC_MAGIC, 3, struct refmon_session_req)
+#define REFMON_IOC_ADD_RULES    _IOWR(REFMON_IOC_MAGIC, 4, struct refmon_batch_req)
+#define REFMON_IOC_REMOVE_RULES _IOWR(REFMON_IOC_MAGIC, 5, struct refmon_batch_req)
+#define REFMON_IOC_DUMP         _IOWR(REFMON_IOC_MAGIC, 6, struct refmon_dump_req)
+#define REFMON_IOC_STATS        _IOR(REFMON_IOC_MAGIC, 7, struct refmon_stats)
+#define REFMON_IOC_QUERY        _IOWR(REFMON_IOC_MAGIC, 8, struct refmon_query_req)
+
+#endif
@@ -36,12 +36,17 @@
 #include <linux/cred.h>
 #include <linux/file.h>
 #include <linux/fs_struct.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
 
 #include "syscall-mount/scth.h"
 #include "stack_reference_monitor.h"
 #include "utils/utils.h"
 #include "utils/blacklist.h"
 #include "kprobes/kprobes.h"
+#include "device/device.h"
+#include "stats/stats.h"
+#include "trace/refmon_trace.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Staccone Simone <simone.staccone@virgilio.it>");
@@ -58,8 +63,18 @@ module_param_string(password, password, PASSW_LEN, 0);
 unsigned long syscalls_table_address = 0x0;
 module_param(syscalls_table_address, ulong, 0660);
 
+/* free entries already found by the_usctm (its free_entries parameter), checked instead of searched; 0 ends the list */
+#define MAX_FREE_ENTRIES 15
+int free_entries[MAX_FREE_ENTRIES];
+int free_entries_count;
+module_param_array(free_entries, int, &free_entries_count, 0444);
+
+/* 0 to control the reference monitor through /dev/refmon only, without patching the syscall table */
+int install_syscalls = 1;
+module_param(install_syscalls, int, 0444);
+
 unsigned long the_ni_syscall;
-unsigned long new_sys_call_array[] = {0x0, 0x0, 0x0, 0x0, 0x0, 0x0};             /* new syscalls addresses array */
+unsigned long new_sys_call_array[] = {0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0};        /* new syscalls addresses array */
 #define HACKED_ENTRIES (int)(sizeof(new_sys_call_array) / sizeof(unsigned long)) /* number of entries to be hacked */
 int restore[HACKED_ENTRIES] = {[0 ...(HACKED_ENTRIES - 1)] - 1};                 /* array of free entries on the syscall table */
 
@@ -68,18 +83,85 @@ int switch_state_code;
 int get_reference_monitor_state;
 int add_to_blacklist_code;
 int remove_from_blacklist_code;
-int print_blacklist_code;
+int dump_blacklist_code;
 int get_blacklist_size_code;
+int open_rec_session_code;
 
-// update RF state syscall
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 17, 0)
-__SYSCALL_DEFINEx(2, _switch_rf_state, int, state, char *, password)
+// serializes the hook re-evaluations and the scans of the open files
+static DEFINE_MUTEX(hooks_mutex);
+
+// quiet time after the last reconfiguration before the open files are scanned
+#define WRITERS_SCAN_DELAY HZ
+
+static void writers_scan(struct work_struct *work);
+static DECLARE_DELAYED_WORK(writers_work, writers_scan);
+
+/*
+ * Disarm write/lseek if no process has a blacklisted file open for writing. The scan runs once the
+ * edits of a batch or of a session are over; by then the hooks that began before the rules were added
+ * have returned (they run with preemption disabled), and the opens that were past the open hook when
+ * it was armed have had the delay to install their file.
+ */
+static void writers_scan(struct work_struct *work)
 {
-#else
-asmlinkage long sys_switch_rf_state(int state, char *password)
+    int found;
+
+    if (!(armed_kprobes() & WRITE_HOOKS))
+    {
+        return;
+    }
+
+    synchronize_rcu();
+    found = blacklist_open_writers(&reference_monitor);
+
+    mutex_lock(&hooks_mutex);
+    // a reconfiguration during the scan queued another one, which decides instead
+    if (!found && !delayed_work_pending(&writers_work))
+    {
+        arm_kprobes(armed_kprobes() & ~WRITE_HOOKS);
+    }
+    mutex_unlock(&hooks_mutex);
+
+    stats_publish();
+}
+
+/**
+ *  @brief Arm the hooks needed by the current state and blacklist, disarm the others, then update the status page
+ *
+ *  write/lseek are armed with the others and stay armed until a scan of the open files, deferred after
+ *  the last reconfiguration, finds no writer of a blacklisted file (see writers_scan()).
+ */
+void refresh_hooks(void)
+{
+    unsigned int mask = 0;
+
+    mutex_lock(&hooks_mutex);
+
+    if (reference_monitor.state == RF_ON || reference_monitor.state == RF_REC_ON)
+    {
+        mask = blacklist_hooks(&reference_monitor);
+    }
+
+    if (mask != 0)
+    {
+        mask |= WRITE_HOOKS;
+        mod_delayed_work(system_wq, &writers_work, WRITERS_SCAN_DELAY);
+    }
+    arm_kprobes(mask);
+
+    mutex_unlock(&hooks_mutex);
+
+    stats_publish();
+}
+
+/**
+ *  @brief Switch the RF state after checking the password (shared by the syscall and the /dev/refmon ioctl)
+ *  @return the new state, or a negative error code
+ */
+long switch_rf_state(int state, char *password)
 {
-#endif
     char *state_string;
+    int old_state;
     int ret;
 
     // Check if the monitor state is admissible
@@ -103,18 +185,15 @@ asmlinkage long sys_switch_rf_state(int state, char *password)
         return ret;
     }
 
+    // Any state change ends the reconfiguration session
     spin_lock(&reference_monitor.lock);
+    old_state = reference_monitor.state;
     reference_monitor.state = state;
+    rec_session_close(&reference_monitor);
     spin_unlock(&reference_monitor.lock);
 
-    if (state == 0 || state == 2)
-    {
-        enable_kprobes();
-    }
-    else
-    {
-        disable_kprobes();
-    }
+    trace_refmon_state_change(old_state, state);
+    refresh_hooks();
 
     AUDIT
     {
@@ -143,9 +222,21 @@ asmlinkage long sys_switch_rf_state(int state, char *password)
             break;
         }
         printk("%s: [INFO] Password check successful, state changed to %s\n", MODNAME, state_string);
+        kfree(state_string);
     }
 
-    return reference_monitor.state;
+    return state;
+}
+
+// update RF state syscall
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 17, 0)
+__SYSCALL_DEFINEx(2, _switch_rf_state, int, state, char *, password)
+{
+#else
+asmlinkage long sys_switch_rf_state(int state, char *password)
+{
+#endif
+    return switch_rf_state(state, password);
 }
 
 // update RF state syscall
@@ -206,8 +297,8 @@ asmlinkage long sys_add_to_blacklist(char *path, char *password)
         return ret;
     }
 
-    // Check if the password is equal to the one stored in the reference monitor state
-    ret = password_check(password, &reference_monitor);
+    // Check the password, or the token of the reconfiguration session
+    ret = rec_credentials_check(password, &reference_monitor);
     if (ret != 0)
     {
         return ret;
@@ -227,6 +318,8 @@ asmlinkage long sys_add_to_blacklist(char *path, char *password)
         return ret;
     }
 
+    refresh_hooks();
+
     return 0;
 }
 
@@ -248,8 +341,8 @@ asmlinkage long sys_remove_from_blacklist(char *path, char *password)
         return ret;
     }
 
-    // Check if the password is equal to the one stored in the reference monitor state
-    ret = password_check(password, &reference_monitor);
+    // Check the password, or the token of the reconfiguration session
+    ret = rec_credentials_check(password, &reference_monitor);
     if (ret != 0)
     {
         return ret;
@@ -264,6 +357,10 @@ asmlinkage long sys_remove_from_blacklist(char *path, char *password)
 
     // Try to add to blacklist a new path
     ret = remove_from_blacklist(path, &reference_monitor);
+    if (ret == 0)
+    {
+        refresh_hooks();
+    }
     if (ret == -EINVAL)
     {
         return 1;
@@ -274,112 +371,113 @@ asmlinkage long sys_remove_from_blacklist(char *path, char *password)
     return 0;
 }
 
-// Get blacklist size syscall
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 17, 0)
-__SYSCALL_DEFINEx(1, _get_blacklist_size, int, dummy)
-{
-#else
-asmlinkage long sys_get_blacklist_size(void)
-{
-#endif
-    return reference_monitor.blacklist_size;
-}
-
-// Print blacklist syscall
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 17, 0)
-__SYSCALL_DEFINEx(2, _print_blacklist, char *, user_space_blacklist, int, blacklist_size)
-{
-#else
-asmlinkage long sys_print_blacklist(char *user_space_blacklist, int blacklist_size)
+/**
+ *  @brief Open a reconfiguration session: the token copied to user space replaces the password of add/remove calls
+ *  @param token User buffer of REC_TOKEN_LEN bytes
+ */
+long open_rec_session(char *password, char *token)
 {
-#endif
-    struct blacklist_node *curr = reference_monitor.blacklist_head;
-    char *blacklist_entries;
-    char temp_string[256];
+    char kernel_token[REC_TOKEN_LEN];
     int ret;
 
-    if (blacklist_size != reference_monitor.blacklist_size)
+    // Check if the reference monitor is in reconfiguration state
+    ret = is_rf_rec(&reference_monitor);
+    if (ret != 0)
     {
-        return -1;
+        return ret;
     }
 
-    blacklist_entries = (char *)kmalloc(blacklist_size * PATH_MAX, GFP_KERNEL);
-    if (!blacklist_entries)
+    // Check if the password is equal to the one stored in the reference monitor state
+    ret = password_check(password, &reference_monitor);
+    if (ret != 0)
     {
-        printk(KERN_ERR "Failed to allocate hash descriptor\n");
-        return -1;
+        return ret;
     }
 
-    if (curr == NULL)
+    // Check if the user is running as root
+    ret = euid_check(current_euid());
+    if (ret != 0)
     {
-        printk("%s: Blacklist is empty\n", MODNAME);
-        blacklist_entries = "Blacklist is empty\n";
+        return ret;
     }
-    else
-    {
-        printk("%s: Blacklist elements:\n", MODNAME);
-        sprintf(blacklist_entries, "Blacklist elements\n");
-
-        while (curr->next != NULL)
-        {
-            printk("- %s\n", curr->path);
-            blacklist_entries = krealloc((void *)blacklist_entries, strlen(blacklist_entries) + strlen(temp_string), GFP_KERNEL);
-            if (!blacklist_entries)
-            {
-                printk(KERN_ERR "Failed to re-allocate hash descriptor\n");
-                return -1;
-            }
-
-            sprintf(temp_string, "- %s\n", curr->path);
-            strcat(blacklist_entries, temp_string);
-
-            curr = curr->next;
-        }
-        blacklist_entries = krealloc((void *)blacklist_entries, strlen(blacklist_entries) + strlen(temp_string), GFP_KERNEL);
-        if (!blacklist_entries)
-        {
-            printk(KERN_ERR "Failed to re-allocate hash descriptor\n");
-            return -1;
-        }
 
-        printk("- %s\n", curr->path);
+    rec_session_open(&reference_monitor, kernel_token);
 
-        sprintf(temp_string, "- %s\n", curr->path);
-        strcat(blacklist_entries, temp_string);
+    ret = copy_to_user(token, kernel_token, REC_TOKEN_LEN);
+    memzero_explicit(kernel_token, REC_TOKEN_LEN);
+    if (ret)
+    {
+        pr_err("%s: [ERROR] Error while copying the session token to user address space\n", MODNAME);
+        spin_lock(&reference_monitor.lock);
+        rec_session_close(&reference_monitor);
+        spin_unlock(&reference_monitor.lock);
+        return -EFAULT;
     }
 
-    // Use Cross-Ring Data Move to copy blacklist from user to kernel space
-    ret = copy_to_user(user_space_blacklist, (void *)blacklist_entries, strlen(blacklist_entries));
-    if (ret)
+    AUDIT
     {
-        pr_err("%s: [ERROR] Error while copying blacklist from user address space to kernel address space\n", MODNAME);
-        kfree(blacklist_entries);
-        return -EAGAIN;
+        printk("%s: [INFO] Reconfiguration session opened for %d seconds\n", MODNAME, REC_SESSION_SECONDS);
     }
 
     return 0;
 }
 
+// Open a reconfiguration session syscall
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 17, 0)
+__SYSCALL_DEFINEx(2, _open_rec_session, char *, password, char *, token)
+{
+#else
+asmlinkage long sys_open_rec_session(char *password, char *token)
+{
+#endif
+    return open_rec_session(password, token);
+}
+
+// Get blacklist size syscall
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 17, 0)
+__SYSCALL_DEFINEx(1, _get_blacklist_size, int, dummy)
+{
+#else
+asmlinkage long sys_get_blacklist_size(void)
+{
+#endif
+    return reference_monitor.blacklist_size;
+}
+
+// Dump blacklist syscall: packed entries from the cursor, see dump_blacklist()
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 17, 0)
+__SYSCALL_DEFINEx(3, _dump_blacklist, char *, user_space_blacklist, size_t, len, unsigned long *, cursor)
+{
+#else
+asmlinkage long sys_dump_blacklist(char *user_space_blacklist, size_t len, unsigned long *cursor)
+{
+#endif
+    return dump_blacklist(user_space_blacklist, len, cursor, &reference_monitor);
+}
+
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 17, 0)
 long sys_switch_rf_state = (unsigned long)__x64_sys_switch_rf_state;
 long sys_get_rf_state = (unsigned long)__x64_sys_get_rf_state;
 long sys_add_to_blacklist = (unsigned long)__x64_sys_add_to_blacklist;
 long sys_remove_from_blacklist = (unsigned long)__x64_sys_remove_from_blacklist;
-long sys_print_blacklist = (unsigned long)__x64_sys_print_blacklist;
+long sys_dump_blacklist = (unsigned long)__x64_sys_dump_blacklist;
 long sys_get_blacklist_size = (unsigned long)__x64_sys_get_blacklist_size;
+long sys_open_rec_session = (unsigned long)__x64_sys_open_rec_session;
 #else
 #endif
 
 /**
  *  @brief Check if this file is blacklisted
  *  @param path The pathname to check if it is found in the blacklist
+ *  @param hook The hook checking the path, the denials of the matching rule are counted per hook
+ *  @param rule Set to the id of the matching rule, left untouched if none matches
  *  @return 0 if is not in blacklist and 1 if the path is found
  */
-int is_blacklisted(char *path)
+int is_blacklisted(char *path, int hook, u32 *rule)
 {
     struct blacklist_node *curr;
 
-    if (reference_monitor.blacklist_size == 0)
+    if (path == NULL || reference_monitor.blacklist_size == 0)
     {
         return 0;
     }
@@ -389,27 +487,15 @@ int is_blacklisted(char *path)
     }
     else
     {
-        curr = reference_monitor.blacklist_head;
-
         spin_lock(&reference_monitor.lock);
-        while (curr != NULL)
+        curr = rules_match(reference_monitor.blacklist_head, path);
+        if (curr != NULL)
         {
-            if (strncmp(path, curr->path, strlen(curr->path)) == 0)
-            {
-                spin_unlock(&reference_monitor.lock);
-
-                return 1;
-            }
-            else if (curr->path[strlen(curr->path) - 1] == '/') // Check if the last slash isn't added in path recognition
-            {
-                if (strncmp(path, curr->path, strlen(curr->path) - 1) == 0)
-                {
-                    spin_unlock(&reference_monitor.lock);
-
-                    return 1;
-                }
-            }
-            curr = curr->next;
+            this_cpu_inc(curr->stats->denials[hook]);
+            *rule = curr->id;
+            spin_unlock(&reference_monitor.lock);
+
+            return 1;
         }
 
         spin_unlock(&reference_monitor.lock);
@@ -446,16 +532,33 @@ int initialize_syscalls(void)
     new_sys_call_array[1] = (unsigned long)sys_get_rf_state;
     new_sys_call_array[2] = (unsigned long)sys_add_to_blacklist;
     new_sys_call_array[3] = (unsigned long)sys_remove_from_blacklist;
-    new_sys_call_array[4] = (unsigned long)sys_print_blacklist;
+    new_sys_call_array[4] = (unsigned long)sys_dump_blacklist;
     new_sys_call_array[5] = (unsigned long)sys_get_blacklist_size;
+    new_sys_call_array[6] = (unsigned long)sys_open_rec_session;
 
     CONDITIONAL
     {
         printk("%s: [DEBUG] New system call address points to 0x%p", MODNAME, (void *)new_sys_call_array[0]);
     }
 
-    /* get free entries on the syscall table */
-    ret = get_entries(restore, HACKED_ENTRIES, (unsigned long *)syscalls_table_address, &the_ni_syscall);
+    /* get free entries on the syscall table, the ones given by the_usctm are only checked */
+    ret = -1;
+    if (free_entries_count >= HACKED_ENTRIES)
+    {
+        ret = check_entries(free_entries, HACKED_ENTRIES, (unsigned long *)syscalls_table_address, &the_ni_syscall);
+        if (ret == HACKED_ENTRIES)
+        {
+            memcpy(restore, free_entries, sizeof(restore));
+        }
+        else
+        {
+            printk("%s: [INFO] Free entries given at load are not valid, searching them\n", MODNAME);
+        }
+    }
+    if (ret != HACKED_ENTRIES)
+    {
+        ret = get_entries(restore, HACKED_ENTRIES, (unsigned long *)syscalls_table_address, &the_ni_syscall);
+    }
 
     if (ret != HACKED_ENTRIES)
     {
@@ -489,8 +592,9 @@ int initialize_syscalls(void)
     get_reference_monitor_state = restore[1];
     add_to_blacklist_code = restore[2];
     remove_from_blacklist_code = restore[3];
-    print_blacklist_code = restore[4];
+    dump_blacklist_code = restore[4];
     get_blacklist_size_code = restore[5];
+    open_rec_session_code = restore[6];
 
     return 0;
 }
@@ -498,7 +602,6 @@ int initialize_syscalls(void)
 int init_module(void)
 {
     int ret;
-    char *enc_password;
 
     AUDIT
     {
@@ -509,21 +612,25 @@ int init_module(void)
         printk("%s: [INFO] Number of entries to hack %d\n", MODNAME, HACKED_ENTRIES);
     }
 
-    ret = initialize_syscalls();
-
+    // The hash transform is needed by the syscalls as soon as they are installed
+    ret = hash_init();
     if (ret != 0)
     {
         return ret;
     }
+
     AUDIT
     {
         printk("%s: [INFO] Setting RF initial state to OFF\n", MODNAME);
     }
 
+    spin_lock_init(&reference_monitor.lock);
     spin_lock(&reference_monitor.lock);
     reference_monitor.state = 1;
     reference_monitor.blacklist_head = NULL;
     reference_monitor.blacklist_size = 0;
+    reference_monitor.blacklist_bytes = 0;
+    reference_monitor.blacklist_generation = 1;
     spin_unlock(&reference_monitor.lock);
 
     AUDIT
@@ -531,14 +638,40 @@ int init_module(void)
         printk("%s: [INFO] Encryipting password\n", MODNAME);
     }
 
-    enc_password = encrypt_password(password);
-    reference_monitor.password = enc_password;
+    ret = compute_digest(password, strnlen(password, PASSW_LEN), reference_monitor.password_digest);
+    memzero_explicit(password, PASSW_LEN);
+    if (ret != 0)
+    {
+        pr_err("%s: [ERROR] Failed to calculate the password hash\n", MODNAME);
+        hash_clean();
+        return ret;
+    }
 
     AUDIT
     {
         printk("%s: [INFO] Password entrypted and set correctly\n", MODNAME);
     }
+
+    if (install_syscalls)
+    {
+        ret = initialize_syscalls();
+        if (ret != 0)
+        {
+            hash_clean();
+            return ret;
+        }
+    }
+
+    // Without the syscalls the device is the only way to control the reference monitor
+    ret = refmon_device_init();
+    if (ret != 0 && !install_syscalls)
+    {
+        hash_clean();
+        return ret;
+    }
+
     kretprobe_init();
+    stats_init();
     AUDIT
     {
         printk("%s: [INFO] Module correctly installed\n", MODNAME);
@@ -555,15 +688,25 @@ void cleanup_module(void)
         printk("%s: [INFO] Shutting down reference monitor\n", MODNAME);
     }
 
+    stats_clean();
+    refmon_device_clean();
+
     /* syscall table restoration */
-    unprotect_memory();
-    for (i = 0; i < HACKED_ENTRIES; i++)
+    if (install_syscalls)
     {
-        ((unsigned long *)syscalls_table_address)[restore[i]] = the_ni_syscall;
+        unprotect_memory();
+        for (i = 0; i < HACKED_ENTRIES; i++)
+        {
+            ((unsigned long *)syscalls_table_address)[restore[i]] = the_ni_syscall;
+        }
+        protect_memory();
     }
-    protect_memory();
 
+    // no reconfiguration can queue another scan now
+    cancel_delayed_work_sync(&writers_work);
     kretprobe_clean();
+    blacklist_clean(&reference_monitor);
+    hash_clean();
 
     AUDIT
     {
@@ -4,10 +4,14 @@
 #include <asm/atomic.h>
 #include <linux/limits.h>
 
+#include "kprobes/kprobes.h"
+#include "utils/rules.h"
+
 
 
 #define MODNAME "STACK REFERENCE MONITOR"
 #define PASSW_LEN 32
+#define PASSW_DIGEST_LEN 32 /* SHA256 */
 #define AUDIT if(1)
 #define DEBUG
 #define LOG_FILE "/opt/mount/ref_monitor_log.txt"
@@ -18,6 +22,12 @@
 #define RF_REC_ON       2
 #define RF_REC_OFF      3
 
+// Reconfiguration sessions: tokens are REC_TOKEN_PREFIX followed by the hex digits of REC_TOKEN_BYTES random bytes
+#define REC_TOKEN_PREFIX        '!'
+#define REC_TOKEN_BYTES         12
+#define REC_TOKEN_LEN           (2 * REC_TOKEN_BYTES + 2)
+#define REC_SESSION_SECONDS     60
+
 
 #ifdef DEBUG 
 #define CONDITIONAL if(0)
@@ -26,10 +36,19 @@
 #endif
 
 
-typedef struct blacklist_node{
-        char *path;
-        struct blacklist_node *next;
-}blacklist_node;
+/*
+ * Packed entries filled by the dump_blacklist syscall: a 32 bit length followed by the bytes of the path,
+ * without NUL terminator nor padding. Cursors are (generation << 32) | index of the next entry, 0 to start.
+ */
+#define BLACKLIST_ENTRY_HEADER  4
+
+struct blacklist_snapshot;
+
+// per-CPU counters of a blacklist rule, summed when read (see stats/stats.c)
+struct rule_stats {
+        u64 denials[NUM_KRETPROBES];            /**< operations denied by the rule, per hook */
+};
+
 
 
 /** @struct reference_monitor
@@ -37,11 +56,22 @@ typedef struct blacklist_node{
  */
 struct reference_monitor {
         int state;                              /**< The state can be one of the following: OFF (0), ON (1), REC-OFF (2), REC-ON (3)*/
-        char *password;                         /**< Password for Reference Monitor reconfiguration */
+        u8 password_digest[PASSW_DIGEST_LEN];   /**< SHA256 of the password for Reference Monitor reconfiguration */
+        char session_token[REC_TOKEN_LEN];      /**< Token of the open reconfiguration session, empty if none */
+        unsigned long session_expires;          /**< Jiffies after which the session token is rejected */
         blacklist_node *blacklist_head;             /**< Files to be protected */
         spinlock_t lock;                        /**< Lock for synchronization */
         int blacklist_size;
+        size_t blacklist_bytes;                 /**< Total length of the blacklisted paths */
+        unsigned int blacklist_generation;      /**< Incremented at each change of the blacklist, starting from 1 */
+        struct blacklist_snapshot __rcu *snapshot; /**< Immutable copy of the blacklist read by dumps */
 };
 
-int is_blacklisted(char *path);
+extern struct reference_monitor reference_monitor;
+extern int install_syscalls;
+
+int is_blacklisted(char *path, int hook, u32 *rule);
+long switch_rf_state(int state, char *password);
+long open_rec_session(char *password, char *token);
+void refresh_hooks(void);
 #endif
\ No newline at end of file
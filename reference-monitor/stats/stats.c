@@ -0,0 +1,445 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+#include <linux/version.h>
+#include <linux/mm.h>
+#include <linux/spinlock.h>
+#include <linux/sched.h>
+#include <linux/workqueue.h>
+#include <linux/timekeeping.h>
+#include <linux/jump_label.h>
+#include <linux/uaccess.h>
+#include <linux/string.h>
+
+#include "stats.h"
+#include "../stack_reference_monitor.h"
+#include "../refmon_ioctl.h"
+
+/*
+ * Counters of the hooks and of the blacklist rules, exposed in debugfs (/sys/kernel/debug/refmon/).
+ * Hot paths only increment per-CPU counters, the sums over the possible CPUs are computed here
+ * when a file is read, so a read may miss the increments done meanwhile.
+ */
+
+static struct dentry *stats_dir;
+
+/*
+ * Status page mapped read-only by the readers of /dev/refmon (struct refmon_shared). Writers are
+ * serialized by shared_lock and bump seq around each update, readers never take a lock.
+ */
+static struct refmon_shared *shared_page;
+static DEFINE_SPINLOCK(shared_lock);
+
+static void stats_refresh(struct work_struct *work);
+static DECLARE_DELAYED_WORK(shared_work, stats_refresh);
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 16, 0)
+#define DEFINE_SHOW_ATTRIBUTE(__name)                                          \
+    static int __name##_open(struct inode *inode, struct file *file)           \
+    {                                                                          \
+        return single_open(file, __name##_show, inode->i_private);             \
+    }                                                                          \
+    static const struct file_operations __name##_fops = {                      \
+        .owner = THIS_MODULE,                                                  \
+        .open = __name##_open,                                                 \
+        .read = seq_read,                                                      \
+        .llseek = seq_lseek,                                                   \
+        .release = single_release,                                             \
+    }
+#endif
+
+// hooks: one line per kretprobe, with the instances missed because its pool was empty and whether it is armed
+static int hooks_show(struct seq_file *m, void *v)
+{
+    struct hook_stats sum;
+    unsigned int armed = armed_kprobes();
+    int hook, cpu;
+
+    seq_printf(m, "%-8s %12s %12s %12s %12s %6s\n", "hook", "calls", "matches", "resolutions", "nmissed", "armed");
+    for (hook = 0; hook < NUM_KRETPROBES; hook++)
+    {
+        memset(&sum, 0, sizeof(sum));
+        for_each_possible_cpu(cpu)
+        {
+            sum.calls += per_cpu(hook_stats[hook], cpu).calls;
+            sum.matches += per_cpu(hook_stats[hook], cpu).matches;
+            sum.resolutions += per_cpu(hook_stats[hook], cpu).resolutions;
+        }
+
+        seq_printf(m, "%-8s %12llu %12llu %12llu %12lu %6d\n", hook_names[hook], sum.calls, sum.matches,
+                   sum.resolutions, hook_nmissed(hook), !!(armed & BIT(hook)));
+    }
+
+    return 0;
+}
+
+/*
+ * rules: one line per blacklisted path, with its total denials followed by the denials of each hook.
+ * The hooks take reference_monitor.lock too, so the rules are copied at open time in chunks of
+ * RULES_CHUNK, dropping the lock in between, and printed from the copy. A chunk resumes after the last
+ * rule copied, found again by its id (ids grow along the list) if the blacklist changed meanwhile:
+ * rules added after the open may be missed.
+ */
+#define RULES_CHUNK 64
+
+struct rule_row {
+    u64 hits;
+    u64 denials[NUM_KRETPROBES];
+    const char *path;           /**< in the paths of the table */
+};
+
+struct rules_table {
+    size_t count;
+    char *paths;
+    struct rule_row rows[];
+};
+
+static void rules_table_free(struct rules_table *table)
+{
+    if (table)
+        kvfree(table->paths);
+    kvfree(table);
+}
+
+static struct rules_table *rules_table_collect(void)
+{
+    struct reference_monitor *rf = &reference_monitor;
+    struct rules_table *table;
+    struct blacklist_node *curr, *last = NULL;
+    struct rule_row *row;
+    size_t capacity, bytes, used = 0, len, chunk;
+    unsigned int generation = 0;
+    u32 last_id = 0;
+    int hook, cpu;
+
+    spin_lock(&rf->lock);
+    capacity = rf->blacklist_size;
+    bytes = rf->blacklist_bytes + capacity;
+    spin_unlock(&rf->lock);
+
+    table = kvzalloc(sizeof(*table) + capacity * sizeof(struct rule_row), GFP_KERNEL);
+    if (!table)
+        return NULL;
+    table->paths = kvmalloc(bytes ? bytes : 1, GFP_KERNEL);
+    if (!table->paths)
+    {
+        rules_table_free(table);
+        return NULL;
+    }
+
+    do
+    {
+        spin_lock(&rf->lock);
+        if (last == NULL)
+            curr = rf->blacklist_head;
+        else if (rf->blacklist_generation == generation)
+            curr = last->next;
+        else
+            for (curr = rf->blacklist_head; curr != NULL && curr->id <= last_id; curr = curr->next)
+                ;
+
+        for (chunk = 0; curr != NULL && chunk < RULES_CHUNK; curr = curr->next, chunk++)
+        {
+            len = strlen(curr->path) + 1;
+            if (table->count == capacity || used + len > bytes)
+            {
+                curr = NULL;
+                break;
+            }
+
+            row = &table->rows[table->count++];
+            for (hook = 0; hook < NUM_KRETPROBES; hook++)
+            {
+                for_each_possible_cpu(cpu)
+                    row->denials[hook] += per_cpu_ptr(curr->stats, cpu)->denials[hook];
+                row->hits += row->denials[hook];
+            }
+            memcpy(table->paths + used, curr->path, len);
+            row->path = table->paths + used;
+            used += len;
+
+            last = curr;
+            last_id = curr->id;
+        }
+        generation = rf->blacklist_generation;
+        spin_unlock(&rf->lock);
+
+        cond_resched();
+    } while (curr != NULL);
+
+    return table;
+}
+
+static int rules_show(struct seq_file *m, void *v)
+{
+    struct rules_table *table = m->private;
+    struct rule_row *row;
+    size_t i;
+    int hook;
+
+    seq_printf(m, "%12s", "hits");
+    for (hook = 0; hook < NUM_KRETPROBES; hook++)
+        seq_printf(m, " %8s", hook_names[hook]);
+    seq_puts(m, "  path\n");
+
+    for (i = 0; i < table->count; i++)
+    {
+        row = &table->rows[i];
+        seq_printf(m, "%12llu", row->hits);
+        for (hook = 0; hook < NUM_KRETPROBES; hook++)
+            seq_printf(m, " %8llu", row->denials[hook]);
+        seq_printf(m, "  %s\n", row->path);
+    }
+
+    return 0;
+}
+
+static int rules_open(struct inode *inode, struct file *file)
+{
+    struct rules_table *table;
+    int ret;
+
+    table = rules_table_collect();
+    if (!table)
+        return -ENOMEM;
+
+    ret = single_open(file, rules_show, table);
+    if (ret)
+        rules_table_free(table);
+
+    return ret;
+}
+
+static int rules_release(struct inode *inode, struct file *file)
+{
+    rules_table_free(((struct seq_file *)file->private_data)->private);
+    return single_release(inode, file);
+}
+
+static const struct file_operations rules_fops = {
+    .owner = THIS_MODULE,
+    .open = rules_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = rules_release,
+};
+
+// latency: log2 histograms of the phases of each hook (only the non empty ones), a bucket is labeled with its lower bound
+static int latency_show(struct seq_file *m, void *v)
+{
+    u64 counts[LATENCY_BUCKETS];
+    u64 samples;
+    int hook, phase, bucket, cpu;
+
+    seq_printf(m, "enabled: %d\n", static_key_enabled(&hook_latency_enabled));
+    seq_printf(m, "%-8s %-8s %12s\n", "hook", "phase", "samples");
+    for (hook = 0; hook < NUM_KRETPROBES; hook++)
+    {
+        for (phase = 0; phase < NUM_PHASES; phase++)
+        {
+            samples = 0;
+            for (bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+            {
+                counts[bucket] = 0;
+                for_each_possible_cpu(cpu)
+                    counts[bucket] += per_cpu(hook_latency[hook][phase], cpu).buckets[bucket];
+                samples += counts[bucket];
+            }
+            if (samples == 0)
+                continue;
+
+            seq_printf(m, "%-8s %-8s %12llu\n", hook_names[hook], phase_names[phase], samples);
+            for (bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+            {
+                if (counts[bucket])
+                    seq_printf(m, "  >= %10llu ns %12llu\n", bucket ? 1ULL << bucket : 0ULL, counts[bucket]);
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int latency_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, latency_show, inode->i_private);
+}
+
+// "1" or "0" enables or disables the timing of the hooks, "reset" clears the histograms
+static ssize_t latency_write(struct file *file, const char __user *ubuf, size_t count, loff_t *ppos)
+{
+    char buf[8];
+    bool enable;
+    int cpu;
+
+    if (count >= sizeof(buf))
+        return -EINVAL;
+
+    if (copy_from_user(buf, ubuf, count))
+        return -EFAULT;
+    buf[count] = '\0';
+
+    if (sysfs_streq(buf, "reset"))
+    {
+        // increments racing with the reset may survive it
+        for_each_possible_cpu(cpu)
+            memset(per_cpu_ptr(&hook_latency, cpu), 0, sizeof(hook_latency));
+    }
+    else if (kstrtobool(buf, &enable) == 0)
+    {
+        if (enable)
+            static_branch_enable(&hook_latency_enabled);
+        else
+            static_branch_disable(&hook_latency_enabled);
+    }
+    else
+    {
+        return -EINVAL;
+    }
+
+    return count;
+}
+
+static const struct file_operations latency_fops = {
+    .owner = THIS_MODULE,
+    .open = latency_open,
+    .read = seq_read,
+    .write = latency_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+DEFINE_SHOW_ATTRIBUTE(hooks);
+
+/**
+ * @brief Rewrite the status page with the current state, blacklist and counters
+ */
+void stats_publish(void)
+{
+    struct refmon_shared snap;
+    int hook, cpu;
+
+    memset(&snap, 0, sizeof(snap));
+
+    spin_lock(&reference_monitor.lock);
+    snap.state = reference_monitor.state;
+    snap.rules = reference_monitor.blacklist_size;
+    snap.rule_bytes = reference_monitor.blacklist_bytes;
+    snap.generation = reference_monitor.blacklist_generation;
+    spin_unlock(&reference_monitor.lock);
+
+    for (hook = 0; hook < NUM_KRETPROBES; hook++)
+    {
+        for_each_possible_cpu(cpu)
+        {
+            snap.calls += per_cpu(hook_stats[hook], cpu).calls;
+            snap.denials += per_cpu(hook_stats[hook], cpu).matches;
+        }
+    }
+    snap.armed_hooks = armed_kprobes();
+    snap.syscalls_installed = install_syscalls ? 1 : 0;
+    snap.updated_ns = ktime_get_real_ns();
+
+    spin_lock(&shared_lock);
+    if (shared_page)
+    {
+        snap.seq = shared_page->seq + 2;
+
+        WRITE_ONCE(shared_page->seq, shared_page->seq + 1);
+        smp_wmb();
+        memcpy((char *)shared_page + sizeof(snap.seq), (char *)&snap + sizeof(snap.seq), sizeof(snap) - sizeof(snap.seq));
+        smp_wmb();
+        WRITE_ONCE(shared_page->seq, snap.seq);
+    }
+    spin_unlock(&shared_lock);
+}
+
+// counters change without any event, the page is refreshed every second
+static void stats_refresh(struct work_struct *work)
+{
+    stats_publish();
+    schedule_delayed_work(&shared_work, HZ);
+}
+
+/**
+ * @brief Map the status page read-only in the address space of the caller (mmap of /dev/refmon)
+ */
+int stats_mmap(struct vm_area_struct *vma)
+{
+    if (!shared_page)
+        return -ENODEV;
+
+    if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > PAGE_SIZE)
+        return -EINVAL;
+
+    if (vma->vm_flags & VM_WRITE)
+        return -EPERM;
+
+    // mprotect cannot make the mapping writable later
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+    vm_flags_clear(vma, VM_MAYWRITE);
+#else
+    vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+
+    return remap_pfn_range(vma, vma->vm_start, virt_to_phys(shared_page) >> PAGE_SHIFT,
+                           vma->vm_end - vma->vm_start, vma->vm_page_prot);
+}
+
+/**
+ * @brief Allocate the status page and create the debugfs files of the counters, failures are not fatal for the module
+ */
+int stats_init(void)
+{
+    struct refmon_shared *page;
+
+    BUILD_BUG_ON(sizeof(struct refmon_shared) > PAGE_SIZE);
+
+    page = (struct refmon_shared *)get_zeroed_page(GFP_KERNEL);
+    if (!page)
+    {
+        pr_err("%s: [ERROR] Cannot allocate the status page\n", MODNAME);
+    }
+    else
+    {
+        spin_lock(&shared_lock);
+        shared_page = page;
+        spin_unlock(&shared_lock);
+
+        stats_refresh(NULL);
+    }
+
+    stats_dir = debugfs_create_dir("refmon", NULL);
+    if (IS_ERR_OR_NULL(stats_dir))
+    {
+        pr_err("%s: [ERROR] Cannot create the debugfs directory of the counters\n", MODNAME);
+        stats_dir = NULL;
+        return -ENODEV;
+    }
+
+    debugfs_create_file("hooks", 0400, stats_dir, NULL, &hooks_fops);
+    debugfs_create_file("rules", 0400, stats_dir, NULL, &rules_fops);
+    debugfs_create_file("latency", 0600, stats_dir, NULL, &latency_fops);
+
+    return 0;
+}
+
+void stats_clean(void)
+{
+    struct refmon_shared *page;
+
+    cancel_delayed_work_sync(&shared_work);
+
+    // no mapping is left at unload: a mapping holds the device file, which holds the module
+    spin_lock(&shared_lock);
+    page = shared_page;
+    shared_page = NULL;
+    spin_unlock(&shared_lock);
+    free_page((unsigned long)page);
+
+    debugfs_remove_recursive(stats_dir);
+    stats_dir = NULL;
+}
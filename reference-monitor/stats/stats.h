@@ -0,0 +1,10 @@
+#ifndef STATS_MODULE
+#define STATS_MODULE
+
+struct vm_area_struct;
+
+int stats_init(void);
+void stats_clean(void);
+void stats_publish(void);
+int stats_mmap(struct vm_area_struct *vma);
+#endif
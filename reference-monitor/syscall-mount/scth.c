@@ -42,6 +42,7 @@
 #include <asm/cacheflush.h>
 #include <asm/apic.h>
 #include <linux/syscalls.h>
+#include <linux/hash.h>
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Francesco Quaglia <quaglia@dis.uniroma1.it>");
@@ -86,12 +87,22 @@ void unprotect_memory(void)
 	write_cr0_forced(cr0 & ~X86_CR0_WP);
 }
 
+#define TABLE_ENTRIES 256
+#define VALUES_BITS 9 /* hash of the entry values, twice as many slots as entries */
+
+/*
+ * Free entries are those pointing to sys_ni_syscall, the first address held by more than one entry.
+ * Entry values are counted in a small open addressing table, so the table is read twice instead of
+ * comparing all the pairs of entries.
+ */
 int get_entries(int *entry_ids, int num_acquires, unsigned long sys_call_table, unsigned long *sys_ni_sys_call)
 {
 
 	unsigned long *p;
 	unsigned long addr;
-	int i, j, z, k; // stuff to discover memory contents
+	unsigned long *values;
+	unsigned char *counts;
+	int i, j, h;
 	int ret = 0;
 	int restore[MAX_ACQUIRES] = {[0 ...(MAX_ACQUIRES - 1)] - 1};
 
@@ -109,62 +120,88 @@ int get_entries(int *entry_ids, int num_acquires, unsigned long sys_call_table,
 
 	p = (unsigned long *)sys_call_table;
 
-	j = -1;
-	for (i = 0; i < 256; i++)
+	values = kmalloc_array(1 << VALUES_BITS, sizeof(*values), GFP_KERNEL);
+	counts = kzalloc(1 << VALUES_BITS, GFP_KERNEL);
+	if (!values || !counts)
+	{
+		kfree(values);
+		kfree(counts);
+		return -1;
+	}
+
+	for (i = 0; i < TABLE_ENTRIES; i++)
+	{
+		for (h = hash_long(p[i], VALUES_BITS); counts[h] && values[h] != p[i]; h = (h + 1) & ((1 << VALUES_BITS) - 1))
+			;
+		values[h] = p[i];
+		if (counts[h] < 2)
+			counts[h]++;
+	}
+
+	for (i = 0; i < TABLE_ENTRIES; i++)
+	{
+		for (h = hash_long(p[i], VALUES_BITS); values[h] != p[i]; h = (h + 1) & ((1 << VALUES_BITS) - 1))
+			;
+		if (counts[h] > 1)
+			break;
+	}
+	kfree(values);
+	kfree(counts);
+
+	if (i == TABLE_ENTRIES)
+	{
+		pr_err("%s: [ERROR] could not locate %d available entries in the sys-call table\n", LIBNAME, num_acquires);
+		return -1;
+	}
+
+	addr = p[i];
+	AUDIT
+	{
+		printk("%s: [INFO] sys_ni_syscall correctly located at 0x%px\n", LIBNAME, (void *)addr);
+	}
+
+	for (j = i; j < TABLE_ENTRIES && ret < num_acquires; j++)
 	{
-		for (z = i + 1; z < 256; z++)
+		if (p[j] == addr)
 		{
-			if (p[i] == p[z])
-			{
-				AUDIT
-				{
-					printk("%s: [INFO] Table entries %d and %d keep the same address\n", LIBNAME, i, z);
-					printk("%s: [INFO] sys_ni_syscall correctly located at 0x%px\n", LIBNAME, (void *)p[i]);
-				}
-
-				addr = p[i];
-
-				if (j < (num_acquires - 1))
-				{
-					restore[++j] = i;
-					ret++;
-					printk("%s: [INFO] Acquiring table entry %d\n", LIBNAME, i);
-				}
-
-				if (j < (num_acquires - 1))
-				{
-					restore[++j] = z;
-					ret++;
-					printk("%s: [INFO] Acquiring table entry %d\n", LIBNAME, z);
-				}
-
-				for (k = z + 1; k < 256 && j < (num_acquires - 1); k++)
-				{
-					if (p[i] == p[k])
-					{
-						printk("%s: [INFO] Acquiring table entry %d\n", LIBNAME, k);
-						restore[++j] = k;
-						ret++;
-					}
-				}
-
-				if (ret == num_acquires)
-				{
-					goto found_available_entries;
-				}
-				return -1;
-			}
+			printk("%s: [INFO] Acquiring table entry %d\n", LIBNAME, j);
+			restore[ret++] = j;
 		}
 	}
 
-	pr_err("%s: [ERROR] could not locate %d available entries in the sys-call table\n", LIBNAME, num_acquires);
-
-	return -1;
+	if (ret != num_acquires)
+	{
+		return -1;
+	}
 
-found_available_entries:
 	printk("%s: [INFO] Ret is %d\n", LIBNAME, ret);
 	memcpy((char *)entry_ids, (char *)restore, ret * sizeof(int));
 	*sys_ni_sys_call = addr;
 
 	return ret;
 }
+
+/*
+ * Check entries found by an earlier discovery (see the cache of the_usctm): they must be distinct
+ * entries of the table holding the same address, which is returned as sys_ni_syscall.
+ */
+int check_entries(int *entry_ids, int num_acquires, unsigned long sys_call_table, unsigned long *sys_ni_sys_call)
+{
+	unsigned long *p = (unsigned long *)sys_call_table;
+	int i;
+
+	if (num_acquires < 2 || num_acquires > MAX_ACQUIRES)
+		return -1;
+
+	for (i = 0; i < num_acquires; i++)
+	{
+		if (entry_ids[i] <= 0 || entry_ids[i] >= TABLE_ENTRIES || (i > 0 && entry_ids[i] <= entry_ids[i - 1]))
+			return -1;
+		if (p[entry_ids[i]] != p[entry_ids[0]])
+			return -1;
+	}
+
+	*sys_ni_sys_call = p[entry_ids[0]];
+
+	return num_acquires;
+}
@@ -6,5 +6,6 @@
 void protect_memory(void);
 void unprotect_memory(void);
 int get_entries(int *, int, unsigned long*, unsigned long* );
+int check_entries(int *, int, unsigned long*, unsigned long* );
 
 #endif
@@ -0,0 +1,168 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM refmon
+
+#if !defined(REFMON_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define REFMON_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/types.h>
+#include <linux/version.h>
+
+/*
+ * Tracepoints of the reference monitor (events/refmon/ in tracefs), instantiated in trace/trace.c.
+ * Disabled tracepoints cost a patched-out branch, enabled ones can be filtered per event by perf or
+ * ftrace (e.g. echo 'denied == 1' > events/refmon/refmon_verdict/filter).
+ */
+
+// names of the hooks, in the order of enum rf_hook
+#define refmon_show_hook(hook)                                                 \
+    __print_symbolic(hook, {0, "open"}, {1, "unlink"}, {2, "create"}, {3, "mkdir"}, {4, "rename"}, \
+                     {5, "rmdir"}, {6, "link"}, {7, "symlink"}, {8, "write"}, {9, "lseek"})
+
+// since 6.10 the source of a string field is the one given to __string
+#ifndef refmon_assign_str
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 10, 0)
+#define refmon_assign_str(dst, src) __assign_str(dst)
+#else
+#define refmon_assign_str(dst, src) __assign_str(dst, src)
+#endif
+#endif
+
+#define refmon_show_state(state)                                               \
+    __print_symbolic(state, {0, "ON"}, {1, "OFF"}, {2, "REC_ON"}, {3, "REC_OFF"})
+
+TRACE_EVENT(refmon_hook_entry,
+
+    TP_PROTO(int hook),
+
+    TP_ARGS(hook),
+
+    TP_STRUCT__entry(
+        __field(int, hook)
+    ),
+
+    TP_fast_assign(
+        __entry->hook = hook;
+    ),
+
+    TP_printk("hook=%s", refmon_show_hook(__entry->hook))
+);
+
+// rule is the id of the matching rule (0 if none), latency_ns the time spent matching the path
+TRACE_EVENT(refmon_verdict,
+
+    TP_PROTO(int hook, unsigned long ino, u32 rule, u64 latency_ns, int denied),
+
+    TP_ARGS(hook, ino, rule, latency_ns, denied),
+
+    TP_STRUCT__entry(
+        __field(int, hook)
+        __field(unsigned long, ino)
+        __field(u32, rule)
+        __field(u64, latency_ns)
+        __field(int, denied)
+    ),
+
+    TP_fast_assign(
+        __entry->hook = hook;
+        __entry->ino = ino;
+        __entry->rule = rule;
+        __entry->latency_ns = latency_ns;
+        __entry->denied = denied;
+    ),
+
+    TP_printk("hook=%s ino=%lu rule=%u latency_ns=%llu verdict=%s", refmon_show_hook(__entry->hook), __entry->ino,
+              __entry->rule, __entry->latency_ns, __entry->denied ? "deny" : "allow")
+);
+
+TRACE_EVENT(refmon_log_enqueue,
+
+    TP_PROTO(int tid, const char *exe_path),
+
+    TP_ARGS(tid, exe_path),
+
+    TP_STRUCT__entry(
+        __field(int, tid)
+        __string(exe_path, exe_path ? exe_path : "")
+    ),
+
+    TP_fast_assign(
+        __entry->tid = tid;
+        refmon_assign_str(exe_path, exe_path ? exe_path : "");
+    ),
+
+    TP_printk("tid=%d exe=%s", __entry->tid, __get_str(exe_path))
+);
+
+// written is the result of the write on the log file, a negative error code on failures
+TRACE_EVENT(refmon_log_dequeue,
+
+    TP_PROTO(int tid, long written),
+
+    TP_ARGS(tid, written),
+
+    TP_STRUCT__entry(
+        __field(int, tid)
+        __field(long, written)
+    ),
+
+    TP_fast_assign(
+        __entry->tid = tid;
+        __entry->written = written;
+    ),
+
+    TP_printk("tid=%d written=%ld", __entry->tid, __entry->written)
+);
+
+TRACE_EVENT(refmon_state_change,
+
+    TP_PROTO(int old_state, int new_state),
+
+    TP_ARGS(old_state, new_state),
+
+    TP_STRUCT__entry(
+        __field(int, old_state)
+        __field(int, new_state)
+    ),
+
+    TP_fast_assign(
+        __entry->old_state = old_state;
+        __entry->new_state = new_state;
+    ),
+
+    TP_printk("old=%s new=%s", refmon_show_state(__entry->old_state), refmon_show_state(__entry->new_state))
+);
+
+// added is 1 for an insertion and 0 for a removal, generation the one of the blacklist after the change
+TRACE_EVENT(refmon_rule_change,
+
+    TP_PROTO(int added, u32 rule, u32 generation, const char *path),
+
+    TP_ARGS(added, rule, generation, path),
+
+    TP_STRUCT__entry(
+        __field(int, added)
+        __field(u32, rule)
+        __field(u32, generation)
+        __string(path, path)
+    ),
+
+    TP_fast_assign(
+        __entry->added = added;
+        __entry->rule = rule;
+        __entry->generation = generation;
+        refmon_assign_str(path, path);
+    ),
+
+    TP_printk("%s rule=%u generation=%u path=%s", __entry->added ? "add" : "remove", __entry->rule,
+              __entry->generation, __get_str(path))
+);
+
+#endif /* REFMON_TRACE_H */
+
+// out of tree: the header is found through the include path given in the Makefile
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE refmon_trace
+#include <trace/define_trace.h>
@@ -2,13 +2,20 @@
 #include <string.h>
 #include <stdlib.h>
 
-int main()
+int main(int argc, char *argv[])
 {
-	FILE *fp = fopen("/home/stack1/Desktop/temp.txt", "r+");
+	FILE *fp;
 	const char *buffer = "Ciao";
 	char read_buffer[16];
 	int ret;
 
+	if (argc != 2)
+	{
+		puts("Error: This program should be called as open <file>");
+		exit(EXIT_FAILURE);
+	}
+
+	fp = fopen(argv[1], "r+");
 	if (fp == NULL)
 	{
 		puts("Couldn't open file");
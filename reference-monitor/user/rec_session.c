@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include "user.h"
+
+/*
+ * Bulk edit of the blacklist: the password is checked once to open a reconfiguration session,
+ * then every path is added (or removed) presenting the session token instead of the password.
+ * The reference monitor must be in REC_ON or REC_OFF state.
+ */
+int main(int argc, char *argv[])
+{
+    char token[REC_TOKEN_LEN];
+    int error_flag = 0;
+    int remove;
+    int ret;
+    int i;
+
+    if (argc < 4 || (strcmp(argv[2], "add") != 0 && strcmp(argv[2], "remove") != 0))
+    {
+        puts("Error: This program should be called as rec_session <password> add|remove <path> [<path> ...]");
+        return EXIT_FAILURE;
+    }
+    remove = strcmp(argv[2], "remove") == 0;
+
+    ret = syscall(OPEN_REC_SESSION, argv[1], token);
+    if (ret == -1)
+    {
+        if (errno == EACCES)
+        {
+            printf("%s: Invalid Password\n", strerror(errno));
+        }
+        else
+        {
+            perror("Cannot open a reconfiguration session");
+        }
+        return EXIT_FAILURE;
+    }
+
+    for (i = 3; i < argc; i++)
+    {
+        ret = syscall(remove ? REMOVE_FROM_BLACKLIST : ADD_TO_BLACKLIST, argv[i], token);
+        if (ret == -1)
+        {
+            printf("%s: %s\n", argv[i], strerror(errno));
+            error_flag = 1;
+        }
+    }
+
+    return error_flag;
+}
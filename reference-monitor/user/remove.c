@@ -8,21 +8,24 @@
 int main(int argc, char *argv[])
 {
     int ret = 0;
-    char *buf;
-    char file_string[256];
     int error_flag = 0;
-    buf = getlogin();
+    char blacklist[DUMP_BUFFER_SIZE];
+    unsigned long cursor = 0;
 
-    sprintf(file_string, "/home/%s/Desktop/rf/", buf);
+    if (argc != 3)
+    {
+        puts("Error: This program should be called as remove <password> <path>");
+        return EXIT_FAILURE;
+    }
 
-    ret = syscall(REMOVE_FROM_BLACKLIST, file_string, "1234");
+    ret = syscall(REMOVE_FROM_BLACKLIST, argv[2], argv[1]);
     if (ret == -1)
     {
         perror("...");
         error_flag = 1;
     }
 
-    ret = syscall(PRINT_BLACKLIST, 1);
+    ret = syscall(DUMP_BLACKLIST, blacklist, sizeof(blacklist), &cursor);
     if (ret == -1)
     {
         perror("...");
@@ -3,39 +3,30 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
-#include <pwd.h>
 
 #include "user.h"
 
 int main(int argc, char *argv[])
 {
     int ret = 0;
-    char *buf;
-    char file_string[256];
     int error_flag = 0;
-    char *blacklist;
-    int blacklist_size;
-    struct passwd *pass; 
+    int i;
 
-    pass = getpwuid(getuid());
-    if (!pass)
+    if (argc < 3)
     {
-        printf("%s\n", strerror(errno));
-        return -1;
+        puts("Error: This program should be called as user <password> <path> [<path> ...]");
+        return EXIT_FAILURE;
     }
-    buf = pass->pw_name;
 
-
-    sprintf(file_string, "/home/stack1/Desktop/rf/");
-
-    ret = syscall(ADD_TO_BLACKLIST, file_string, "pippo");
-    if (ret == -1)
+    for (i = 2; i < argc; i++)
     {
-        perror("...");
-        error_flag = 1;
+        ret = syscall(ADD_TO_BLACKLIST, argv[i], argv[1]);
+        if (ret == -1)
+        {
+            printf("%s: %s\n", argv[i], strerror(errno));
+            error_flag = 1;
+        }
     }
 
-
-
     return error_flag;
 }
@@ -7,14 +7,16 @@
 #define GET_RF_STATE            156
 #define ADD_TO_BLACKLIST        174
 #define REMOVE_FROM_BLACKLIST   177
-#define PRINT_BLACKLIST         178
+#define DUMP_BLACKLIST          178
 #define GET_BLACKLIST_SIZE      180
+#define OPEN_REC_SESSION        181
 #else
 #define GET_RF_STATE            174
 #define ADD_TO_BLACKLIST        177
 #define REMOVE_FROM_BLACKLIST   178
-#define PRINT_BLACKLIST         180
+#define DUMP_BLACKLIST          180
 #define GET_BLACKLIST_SIZE      181
+#define OPEN_REC_SESSION        182
 #endif
 
 // Definition of macros to map RF state to numbers
@@ -22,3 +24,10 @@
 #define RF_OFF          1
 #define RF_REC_ON       2
 #define RF_REC_OFF      3
+
+// Reconfiguration session tokens (see OPEN_REC_SESSION) are at most REC_TOKEN_LEN bytes, NUL included
+#define REC_TOKEN_LEN   26
+
+// Entries filled by DUMP_BLACKLIST: a 32 bit length followed by the path, without NUL terminator nor padding
+#define BLACKLIST_ENTRY_HEADER  4
+#define DUMP_BUFFER_SIZE        65536
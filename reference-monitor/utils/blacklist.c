@@ -2,14 +2,119 @@
 #include <linux/errno.h>
 #include <linux/slab.h>
 #include <linux/uaccess.h>
+#include <linux/string.h>
+#include <linux/mm.h>
+#include <linux/kref.h>
+#include <linux/rcupdate.h>
+#include <linux/percpu.h>
+#include <linux/fdtable.h>
+#include <linux/sched/signal.h>
+#include <linux/sched/task.h>
+#include <linux/file.h>
 
 #include "../stack_reference_monitor.h"
+#include "../trace/refmon_trace.h"
+
+// copy a path from user space, always NUL terminated
+static int copy_path(char *kernel_path, const char *path)
+{
+    long ret;
+
+    ret = strncpy_from_user(kernel_path, path, PATH_MAX);
+    if (ret < 0)
+    {
+        pr_err("%s: [ERROR] Error in strncpy_from_user (return value %ld)\n", MODNAME, ret);
+        return -EAGAIN;
+    }
+    if (ret == PATH_MAX)
+    {
+        return -ENAMETOOLONG;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Add to the blacklist a path already copied in kernel space
+ * @return 0 on success, -EEXIST if the path is already blacklisted, -ENOMEM
+ */
+int blacklist_insert(const char *kernel_path, struct reference_monitor *rf)
+{
+    blacklist_node *new;
+
+    new = rules_node_new(kernel_path);
+    if (!new)
+    {
+        pr_err("%s: [ERROR] Error in kmalloc allocation\n", MODNAME);
+        return -ENOMEM;
+    }
+
+    new->stats = alloc_percpu(struct rule_stats);
+    if (!new->stats)
+    {
+        pr_err("%s: [ERROR] Error in kmalloc allocation\n", MODNAME);
+        rules_node_free(new);
+        return -ENOMEM;
+    }
+
+    spin_lock(&rf->lock);
+
+    // new paths are appended at the tail, after checking that they are not already there
+    if (rules_append(&rf->blacklist_head, new) != 0)
+    {
+        spin_unlock(&rf->lock);
+        free_percpu(new->stats);
+        rules_node_free(new);
+        return -EEXIST;
+    }
+
+    rf->blacklist_size++;
+    rf->blacklist_bytes += strlen(new->path);
+    rf->blacklist_generation++;
+    new->id = rf->blacklist_generation;
+    spin_unlock(&rf->lock);
+
+    trace_refmon_rule_change(1, new->id, new->id, kernel_path);
+
+    return 0;
+}
+
+/**
+ * @brief Remove from the blacklist a path already copied in kernel space
+ * @return 0 on success, -EINVAL if the path is not blacklisted
+ */
+int blacklist_delete(const char *kernel_path, struct reference_monitor *rf)
+{
+    blacklist_node *curr;
+    u32 generation;
+
+    spin_lock(&rf->lock);
+
+    // Unlink the node, the matcher only walks the list with the lock held
+    curr = rules_unlink(&rf->blacklist_head, kernel_path);
+    if (curr == NULL)
+    {
+        spin_unlock(&rf->lock);
+        return -EINVAL;
+    }
+
+    rf->blacklist_size--;
+    rf->blacklist_bytes -= strlen(curr->path);
+    rf->blacklist_generation++;
+    generation = rf->blacklist_generation;
+    spin_unlock(&rf->lock);
+
+    trace_refmon_rule_change(0, curr->id, generation, kernel_path);
+
+    free_percpu(curr->stats);
+    rules_node_free(curr);
+
+    return 0;
+}
 
 int add_to_blacklist(char *path, struct reference_monitor *rf)
 {
     char *kernel_rel_path;
-    blacklist_node *curr;
-    blacklist_node *new;
     int ret;
 
     kernel_rel_path = kmalloc(PATH_MAX, GFP_KERNEL);
@@ -19,133 +124,482 @@ int add_to_blacklist(char *path, struct reference_monitor *rf)
         return -ENOMEM;
     }
 
-    ret = copy_from_user(kernel_rel_path, path, PATH_MAX);
-    if (ret == -1)
+    ret = copy_path(kernel_rel_path, path);
+    if (ret == 0)
     {
-        pr_err("%s: [ERROR] Error in copy_from_user (return value %d)\n", MODNAME, ret);
-        kfree(kernel_rel_path);
-        return -EAGAIN;
+        ret = blacklist_insert(kernel_rel_path, rf);
     }
 
-    new = (blacklist_node *)kmalloc(sizeof(blacklist_node), GFP_KERNEL);
-    if (!new)
+    if (ret == 0)
+    {
+        printk("%s: [INFO] Path %s added succesfully to blacklist", MODNAME, kernel_rel_path);
+    }
+
+    kfree(kernel_rel_path);
+    return ret;
+}
+
+int remove_from_blacklist(char *path, struct reference_monitor *rf)
+{
+    char *kernel_path;
+    int ret;
+
+    kernel_path = kmalloc(PATH_MAX, GFP_KERNEL);
+    if (!kernel_path)
     {
         pr_err("%s: [ERROR] Error in kmalloc allocation\n", MODNAME);
         return -ENOMEM;
     }
 
-    new->path = kmalloc(PATH_MAX, GFP_KERNEL);
+    ret = copy_path(kernel_path, path);
+    if (ret == 0)
+    {
+        ret = blacklist_delete(kernel_path, rf);
+        if (ret == 0)
+        {
+            printk("%s: [INFO] Path %s removed succesfully from blacklist\n", MODNAME, kernel_path);
+        }
+        else
+        {
+            printk("%s: [INFO] Path %s not found in blacklist\n", MODNAME, kernel_path);
+        }
+    }
 
-    strcpy(new->path, (const char *)kernel_rel_path);
+    kfree(kernel_path);
+    return ret;
+}
 
-    spin_lock(&rf->lock);
+/*
+ * Hooks are armed only when the blacklist can make them deny something: an empty blacklist needs none,
+ * and write/lseek only matter for files opened for writing before their rule was added, since the open
+ * hook denies newer ones (and the receive of writable files passed over unix sockets). mkdir/rmdir are
+ * armed with any rule: rules match by prefix, so even the rule of a file (/a/f) covers directories (/a/fx).
+ */
 
-    curr = rf->blacklist_head;
-    if (curr == NULL)
+/**
+ * @brief Mask of the hooks (bit i for hook i) needed by the rules of the blacklist, write/lseek excluded
+ */
+unsigned int blacklist_hooks(struct reference_monitor *rf)
+{
+    unsigned int mask = 0;
+
+    spin_lock(&rf->lock);
+    if (rf->blacklist_head != NULL)
     {
-        rf->blacklist_head = new;
+        mask = BASE_HOOKS;
     }
-    else if (curr->next == NULL)
+    spin_unlock(&rf->lock);
+
+    return mask;
+}
+
+/*
+ * Dumps read an immutable snapshot of the blacklist, published with RCU and rebuilt only when the
+ * blacklist changed since the last one: a listing made of several calls is consistent as long as
+ * the generation in its cursor is the one of the snapshot, edits in between make it fail with -ESTALE.
+ */
+struct blacklist_snapshot
+{
+    struct kref ref;
+    struct rcu_head rcu;
+    unsigned int generation;
+    unsigned int count;
+    size_t *offsets; /* offsets[i] is where the packed entry i starts in data, offsets[count] is the end */
+    char *data;
+};
+
+static void blacklist_snapshot_free(struct rcu_head *rcu)
+{
+    kvfree(container_of(rcu, struct blacklist_snapshot, rcu));
+}
+
+// readers may still be in an RCU section about to take a reference
+static void blacklist_snapshot_release(struct kref *ref)
+{
+    call_rcu(&container_of(ref, struct blacklist_snapshot, ref)->rcu, blacklist_snapshot_free);
+}
+
+/*
+ * The hooks take the lock too, so the snapshot is copied in chunks of SNAPSHOT_CHUNK rules, dropping the
+ * lock in between: an edit meanwhile makes the copy start again. After SNAPSHOT_ATTEMPTS copies spoiled
+ * by edits the lock is held for the whole copy, so that a stream of edits cannot starve the dumps.
+ */
+#define SNAPSHOT_CHUNK 64
+#define SNAPSHOT_ATTEMPTS 4
+
+// build the snapshot of the blacklist for the given generation, NULL if it changed in the meantime
+// (call with the lock held, dropped between chunks if chunked, and held again on return)
+static struct blacklist_snapshot *blacklist_snapshot_build(struct reference_monitor *rf, struct blacklist_snapshot *snap,
+                                                           unsigned int generation, unsigned int count, size_t bytes,
+                                                           bool chunked)
+{
+    blacklist_node *curr;
+    unsigned int i = 0, chunk = 0;
+    size_t pos = 0;
+    u32 len;
+
+    if (generation != rf->blacklist_generation)
+        return NULL;
+
+    snap->offsets = (size_t *)(snap + 1);
+    snap->data = (char *)(snap->offsets + count + 1);
+    snap->generation = generation;
+
+    for (curr = rf->blacklist_head; curr != NULL && i < count; curr = curr->next)
     {
-        if (strcmp(curr->path, kernel_rel_path) == 0)
+        if (chunked && ++chunk > SNAPSHOT_CHUNK)
         {
             spin_unlock(&rf->lock);
-            kfree(kernel_rel_path);
-            return -EEXIST;
+            cond_resched();
+            spin_lock(&rf->lock);
+
+            // curr may have been unlinked and freed
+            if (generation != rf->blacklist_generation)
+                return NULL;
+            chunk = 1;
         }
-        curr->next = new;
+
+        len = strlen(curr->path);
+        if (pos + BLACKLIST_ENTRY_HEADER + len > bytes)
+            break;
+
+        snap->offsets[i++] = pos;
+        memcpy(snap->data + pos, &len, BLACKLIST_ENTRY_HEADER);
+        memcpy(snap->data + pos + BLACKLIST_ENTRY_HEADER, curr->path, len);
+        pos += BLACKLIST_ENTRY_HEADER + len;
     }
-    else
+    snap->count = i;
+    snap->offsets[i] = pos;
+
+    return snap;
+}
+
+// get a reference to the snapshot of the current blacklist, building it if needed
+static struct blacklist_snapshot *blacklist_snapshot_get(struct reference_monitor *rf)
+{
+    struct blacklist_snapshot *snap, *old;
+    unsigned int generation, count, attempts = 0;
+    size_t bytes;
+
+    for (;;)
     {
-        while (curr->next != NULL)
+        rcu_read_lock();
+        snap = rcu_dereference(rf->snapshot);
+        if (snap && snap->generation == READ_ONCE(rf->blacklist_generation) && kref_get_unless_zero(&snap->ref))
         {
-            if (strcmp(curr->path, kernel_rel_path) == 0)
-            {
-                spin_unlock(&rf->lock);
-                kfree(kernel_rel_path);
-                return -EEXIST;
-            }
-            curr = curr->next;
+            rcu_read_unlock();
+            return snap;
         }
+        rcu_read_unlock();
+
+        spin_lock(&rf->lock);
+        generation = rf->blacklist_generation;
+        count = rf->blacklist_size;
+        bytes = rf->blacklist_bytes + (size_t)count * BLACKLIST_ENTRY_HEADER;
+        spin_unlock(&rf->lock);
 
-        if (strcmp(curr->path, kernel_rel_path) == 0)
+        snap = kvmalloc(sizeof(*snap) + (count + 1) * sizeof(size_t) + bytes, GFP_KERNEL);
+        if (!snap)
         {
+            pr_err("%s: [ERROR] Error in kvmalloc allocation of a blacklist snapshot\n", MODNAME);
+            return ERR_PTR(-ENOMEM);
+        }
+
+        spin_lock(&rf->lock);
+        if (!blacklist_snapshot_build(rf, snap, generation, count, bytes, ++attempts <= SNAPSHOT_ATTEMPTS))
+        {
+            // the blacklist changed while allocating or copying, try again with its new size
             spin_unlock(&rf->lock);
-            kfree(kernel_rel_path);
-            return -EEXIST;
+            kvfree(snap);
+            continue;
         }
-        curr->next = new;
+
+        // one reference for the published pointer, one for the caller
+        kref_init(&snap->ref);
+        kref_get(&snap->ref);
+        old = rcu_dereference_protected(rf->snapshot, lockdep_is_held(&rf->lock));
+        rcu_assign_pointer(rf->snapshot, snap);
+        spin_unlock(&rf->lock);
+
+        if (old)
+            kref_put(&old->ref, blacklist_snapshot_release);
+
+        return snap;
     }
+}
 
-    rf->blacklist_size++;
-    spin_unlock(&rf->lock);
+// check if path is covered by an entry of the snapshot, with the matcher of the hooks
+static int blacklist_snapshot_match(const struct blacklist_snapshot *snap, const char *path)
+{
+    unsigned int entry;
+    size_t rule_len;
 
-    printk("%s: [INFO] Path %s added succesfully to blacklist", MODNAME, kernel_rel_path);
+    for (entry = 0; entry < snap->count; entry++)
+    {
+        rule_len = snap->offsets[entry + 1] - snap->offsets[entry] - BLACKLIST_ENTRY_HEADER;
+        if (rule_matches_len(path, snap->data + snap->offsets[entry] + BLACKLIST_ENTRY_HEADER, rule_len))
+            return 1;
+    }
 
-    kfree(kernel_rel_path);
     return 0;
 }
 
-int remove_from_blacklist(char *path, struct reference_monitor *rf)
+/**
+ * @brief Copy to buf as many packed entries of the blacklist as fit, starting from the cursor
+ * @param cursor In: 0 or the cursor returned by the previous call. Out: the cursor of the next call
+ * @return the number of entries copied (0 at the end of the blacklist), -ESTALE if the blacklist changed
+ *         since the first call of the listing, -EOVERFLOW if buf cannot hold the next entry
+ */
+long dump_blacklist(char *buf, size_t len, unsigned long *cursor, struct reference_monitor *rf)
 {
-    char *kernel_path;
-    blacklist_node *curr;
-    blacklist_node *prev;
-    int ret;
+    struct blacklist_snapshot *snap;
+    unsigned long kernel_cursor;
+    unsigned int first, last;
+    long ret;
 
-    kernel_path = kmalloc(PATH_MAX, GFP_KERNEL);
-    if (!kernel_path)
+    if (get_user(kernel_cursor, cursor))
+        return -EFAULT;
+
+    snap = blacklist_snapshot_get(rf);
+    if (IS_ERR(snap))
+        return PTR_ERR(snap);
+
+    first = 0;
+    if (kernel_cursor != 0)
     {
-        pr_err("%s: [ERROR] Error in kmalloc allocation\n", MODNAME);
-        return -ENOMEM;
+        if ((kernel_cursor >> 32) != snap->generation)
+        {
+            ret = -ESTALE;
+            goto out;
+        }
+
+        first = kernel_cursor & 0xffffffff;
+        if (first > snap->count)
+        {
+            ret = -EINVAL;
+            goto out;
+        }
     }
 
-    ret = copy_from_user(kernel_path, path, PATH_MAX);
-    if (ret == -1)
+    last = first;
+    while (last < snap->count && snap->offsets[last + 1] - snap->offsets[first] <= len)
+        last++;
+
+    if (last == first && first < snap->count)
     {
-        pr_err("%s: [ERROR] Error in copy_from_user (return value %d)\n", MODNAME, ret);
-        kfree(kernel_path);
-        return -EAGAIN;
+        ret = -EOVERFLOW;
+        goto out;
     }
 
-    spin_lock(&rf->lock);
+    if (copy_to_user(buf, snap->data + snap->offsets[first], snap->offsets[last] - snap->offsets[first]) ||
+        put_user(((unsigned long)snap->generation << 32) | last, cursor))
+    {
+        ret = -EFAULT;
+        goto out;
+    }
 
-    curr = rf->blacklist_head;
-    if (curr == NULL)
+    ret = last - first;
+
+out:
+    kref_put(&snap->ref, blacklist_snapshot_release);
+    return ret;
+}
+
+/**
+ * @brief Tell which of count NUL terminated paths, packed one after the other in paths, are covered by a rule
+ *
+ * All the paths are matched against the same snapshot of the blacklist, without holding the lock.
+ * @param verdicts Bitmap of (count + 63) / 64 words, zeroed by the caller: bit i is set if path i is covered
+ * @return the number of paths covered, -EINVAL if paths does not hold exactly count paths
+ */
+long query_blacklist(const char *paths, size_t len, u32 count, u64 *verdicts, u32 *generation, struct reference_monitor *rf)
+{
+    struct blacklist_snapshot *snap;
+    const char *path, *end = paths + len;
+    u32 i;
+    long ret = 0;
+
+    snap = blacklist_snapshot_get(rf);
+    if (IS_ERR(snap))
+        return PTR_ERR(snap);
+
+    path = paths;
+    for (i = 0; i < count; i++)
     {
-        goto not_found;
+        if (path >= end)
+        {
+            ret = -EINVAL;
+            goto out;
+        }
+
+        if (blacklist_snapshot_match(snap, path))
+        {
+            verdicts[i / 64] |= 1ULL << (i % 64);
+            ret++;
+        }
+
+        path += strlen(path) + 1;
+        cond_resched();
     }
-    else if (strcmp(curr->path, kernel_path) == 0)
+
+    if (path < end)
+        ret = -EINVAL;
+
+    *generation = snap->generation;
+
+out:
+    kref_put(&snap->ref, blacklist_snapshot_release);
+    return ret;
+}
+
+struct writer_cursor
+{
+    struct file *file;
+    unsigned int fd;
+};
+
+// iterate_fd callback, stops the walk at the first file open for writing and takes a reference to it
+static int blacklist_next_writer(const void *data, struct file *file, unsigned int fd)
+{
+    struct writer_cursor *cursor = (struct writer_cursor *)data;
+
+    if (!(file->f_mode & FMODE_WRITE))
     {
-        rf->blacklist_head = curr->next;
-        rf->blacklist_size--;
-        goto found;
+        return 0;
     }
-    else
+
+    cursor->file = get_file(file);
+    cursor->fd = fd;
+    return 1;
+}
+
+/*
+ * Check the files open for writing by task one at a time: the file table lock is only held to find the
+ * next one, the path is resolved and matched without locks.
+ */
+static int task_open_writer(struct task_struct *task, struct blacklist_snapshot *snap, char *buffer)
+{
+    struct writer_cursor cursor = {.fd = 0};
+    char *path;
+    int found = 0;
+
+    while (!found)
     {
-        while (curr != NULL && strcmp(curr->path, kernel_path) != 0)
+        cursor.file = NULL;
+        task_lock(task);
+        if (task->files)
         {
-            prev = curr;
-            curr = curr->next;
+            iterate_fd(task->files, cursor.fd, blacklist_next_writer, &cursor);
         }
+        task_unlock(task);
 
-        if(curr == NULL){
-            goto not_found;
+        if (!cursor.file)
+        {
+            break;
         }
 
-        // Unlink center node
-        prev->next = curr->next;
-        goto found;
+        // same resolution as the hooks (see get_path_from_dentry)
+        path = dentry_path_raw(cursor.file->f_path.dentry, buffer, PATH_MAX);
+        found = !IS_ERR(path) && blacklist_snapshot_match(snap, path);
+        fput(cursor.file);
+
+        cursor.fd++;
+        cond_resched();
     }
 
-not_found:
-    spin_unlock(&rf->lock);
-    printk("%s: [INFO] Path %s not found in blacklist\n", MODNAME, kernel_path);
-    return -EINVAL;
+    return found;
+}
 
-found:
+// give up on a walk restarted this many times by exiting processes, as if a writer was found
+#define WRITERS_SCAN_RESTARTS 8
 
+/**
+ * @brief Check if any task has a blacklisted file open for writing, walking the file tables of all processes
+ *
+ * The files are matched against a snapshot of the blacklist and the walk sleeps between processes, so it
+ * must not be called from the syscall path of each edit (see refresh_hooks()).
+ * @return 1 if such a file exists (or the walk cannot be done), 0 otherwise
+ */
+int blacklist_open_writers(struct reference_monitor *rf)
+{
+    struct blacklist_snapshot *snap;
+    struct task_struct *task;
+    u64 checked = 0;
+    int restarts = 0;
+    int found = 0;
+    char *buffer;
+
+    buffer = kmalloc(PATH_MAX, GFP_KERNEL);
+    if (!buffer)
+    {
+        pr_err("%s: [ERROR] Error in kmalloc allocation\n", MODNAME);
+        return 1;
+    }
+
+    snap = blacklist_snapshot_get(rf);
+    if (IS_ERR(snap))
+    {
+        kfree(buffer);
+        return 1;
+    }
+
+    // threads of a process share its file table; the list is in creation order
+    rcu_read_lock();
+    task = &init_task;
+    while (!found)
+    {
+        task = next_task(task);
+        if (task == &init_task)
+        {
+            break;
+        }
+
+        // after a restart, skip the processes already checked
+        if (task->start_time <= checked)
+        {
+            continue;
+        }
+
+        get_task_struct(task);
+        rcu_read_unlock();
+
+        found = task_open_writer(task, snap, buffer);
+        checked = task->start_time;
+        cond_resched();
+
+        rcu_read_lock();
+        // an exited process is no longer linked: start again from the head of the list
+        if (!pid_alive(task))
+        {
+            put_task_struct(task);
+            task = &init_task;
+            if (++restarts > WRITERS_SCAN_RESTARTS)
+            {
+                found = 1;
+            }
+            continue;
+        }
+        put_task_struct(task);
+    }
+    rcu_read_unlock();
+
+    kref_put(&snap->ref, blacklist_snapshot_release);
+    kfree(buffer);
+    return found;
+}
+
+// drop the published snapshot and wait for its release (module unload)
+void blacklist_clean(struct reference_monitor *rf)
+{
+    struct blacklist_snapshot *snap;
+
+    spin_lock(&rf->lock);
+    snap = rcu_dereference_protected(rf->snapshot, lockdep_is_held(&rf->lock));
+    RCU_INIT_POINTER(rf->snapshot, NULL);
     spin_unlock(&rf->lock);
-    printk("%s: [INFO] Path %s removed succesfully from blacklist\n", MODNAME, kernel_path);
-    return 0;
+
+    if (snap)
+        kref_put(&snap->ref, blacklist_snapshot_release);
+
+    rcu_barrier();
 }
@@ -1,6 +1,13 @@
 #ifndef BLACKLIST
 #define BLACKLIST
 
+int blacklist_insert(const char *kernel_path, struct reference_monitor *rf);
+int blacklist_delete(const char *kernel_path, struct reference_monitor *rf);
 int add_to_blacklist(char *path, struct reference_monitor *rf);
 int remove_from_blacklist(char *path, struct reference_monitor *rf);
+long dump_blacklist(char *buf, size_t len, unsigned long *cursor, struct reference_monitor *rf);
+long query_blacklist(const char *paths, size_t len, u32 count, u64 *verdicts, u32 *generation, struct reference_monitor *rf);
+void blacklist_clean(struct reference_monitor *rf);
+unsigned int blacklist_hooks(struct reference_monitor *rf);
+int blacklist_open_writers(struct reference_monitor *rf);
 #endif
\ No newline at end of file
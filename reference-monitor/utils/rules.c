@@ -0,0 +1,134 @@
+#include "rules.h"
+
+/*
+ * Rule store and matcher of the blacklist, shared by the module and by the user-space library used
+ * to benchmark and fuzz them (client/Makefile, targets matcher and fuzz): only rules_shim.h differs
+ * between the two builds. The rules are a list in insertion order, a path is denied by the first rule
+ * that covers it.
+ */
+
+/**
+ * @brief Check if path is covered by a rule of len bytes, not necessarily NUL terminated (entries of the snapshots)
+ */
+int rule_matches_len(const char *path, const char *rule, size_t len)
+{
+    if (strncmp(path, rule, len) == 0)
+    {
+        return 1;
+    }
+
+    return len > 0 && rule[len - 1] == '/' && strncmp(path, rule, len - 1) == 0;
+}
+
+/**
+ * @brief Check if path is covered by a blacklist rule, a rule ending with '/' also covers the directory itself
+ */
+int rule_matches(const char *path, const char *rule)
+{
+    return rule_matches_len(path, rule, strlen(rule));
+}
+
+/**
+ * @brief Allocate a node holding a copy of path, not linked to any list
+ * @return the node, NULL if the allocation failed
+ */
+blacklist_node *rules_node_new(const char *path)
+{
+    blacklist_node *node;
+
+    node = (blacklist_node *)rules_alloc(sizeof(blacklist_node));
+    if (!node)
+    {
+        return NULL;
+    }
+
+    node->path = rules_strdup(path);
+    if (!node->path)
+    {
+        rules_free(node);
+        return NULL;
+    }
+    node->next = NULL;
+    node->stats = NULL;
+    node->id = 0;
+
+    return node;
+}
+
+// the stats of the kernel are released by the caller
+void rules_node_free(blacklist_node *node)
+{
+    if (node)
+    {
+        rules_free(node->path);
+        rules_free(node);
+    }
+}
+
+/**
+ * @brief Append node at the tail of the list, after checking that its path is not already there
+ * @return 0 on success, -EEXIST if the path is already in the list (node is not linked)
+ */
+int rules_append(blacklist_node **head, blacklist_node *node)
+{
+    blacklist_node **link;
+    blacklist_node *curr;
+
+    link = head;
+    for (curr = *head; curr != NULL; curr = curr->next)
+    {
+        if (strcmp(curr->path, node->path) == 0)
+        {
+            return -EEXIST;
+        }
+        link = &curr->next;
+    }
+
+    node->next = NULL;
+    *link = node;
+
+    return 0;
+}
+
+/**
+ * @brief Unlink from the list the node with the given path, without freeing it
+ * @return the node, NULL if the path is not in the list
+ */
+blacklist_node *rules_unlink(blacklist_node **head, const char *path)
+{
+    blacklist_node **link;
+    blacklist_node *curr;
+
+    link = head;
+    for (curr = *head; curr != NULL; curr = curr->next)
+    {
+        if (strcmp(curr->path, path) == 0)
+        {
+            *link = curr->next;
+            curr->next = NULL;
+            return curr;
+        }
+        link = &curr->next;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief First rule of the list that covers path
+ * @return the node of the rule, NULL if none covers it
+ */
+blacklist_node *rules_match(blacklist_node *head, const char *path)
+{
+    blacklist_node *curr;
+
+    for (curr = head; curr != NULL; curr = curr->next)
+    {
+        if (rule_matches(path, curr->path))
+        {
+            return curr;
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,22 @@
+#ifndef RULES
+#define RULES
+
+#include "rules_shim.h"
+
+struct rule_stats;
+
+typedef struct blacklist_node{
+        char *path;
+        struct blacklist_node *next;
+        struct rule_stats __percpu *stats;      /**< Kernel only, NULL in user space */
+        u32 id;                                 /**< Blacklist generation of the insertion, unique among the rules */
+}blacklist_node;
+
+int rule_matches_len(const char *path, const char *rule, size_t len);
+int rule_matches(const char *path, const char *rule);
+blacklist_node *rules_node_new(const char *path);
+void rules_node_free(blacklist_node *node);
+int rules_append(blacklist_node **head, blacklist_node *node);
+blacklist_node *rules_unlink(blacklist_node **head, const char *path);
+blacklist_node *rules_match(blacklist_node *head, const char *path);
+#endif
@@ -0,0 +1,34 @@
+#ifndef RULES_SHIM
+#define RULES_SHIM
+
+/*
+ * What the rule store (utils/rules.c) needs from its environment: the kernel module builds it with
+ * kmalloc, the user-space library (client/Makefile, target matcher) with the C library. Locking is
+ * left to the callers, the module holds reference_monitor.lock around every call.
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/errno.h>
+
+#define rules_alloc(size)       kmalloc(size, GFP_KERNEL)
+#define rules_strdup(str)       kstrdup(str, GFP_KERNEL)
+#define rules_free(ptr)         kfree(ptr)
+#else
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+typedef uint32_t u32;
+
+#define __percpu
+#define rules_alloc(size)       malloc(size)
+#define rules_strdup(str)       strdup(str)
+#define rules_free(ptr)         free(ptr)
+#endif
+
+#endif
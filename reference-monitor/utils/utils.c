@@ -8,78 +8,85 @@
 #include <linux/uaccess.h>
 #include <linux/file.h>
 #include <crypto/hash.h>
+#include <crypto/algapi.h>
+#include <linux/random.h>
+#include <linux/jiffies.h>
+#include <linux/spinlock.h>
 #include <linux/errno.h>
 #include <linux/mm.h>
 #include <linux/module.h>
 
 #include "../stack_reference_monitor.h"
 
+// SHA256 transform allocated once at module load, shared by all the digest computations
+static struct crypto_shash *hash_tfm;
+
 /**
- * @brief Password encryption (SHA256)
- * @param password Password to be encrypted
- * @returns Encrypted password
+ * @brief Allocate the SHA256 transform used for passwords and fingerprints
+ * @returns 0 on success, a negative error code otherwise
  */
-char *encrypt_password(const char *password)
+int hash_init(void)
 {
-        struct crypto_shash *hash_tfm;
-        struct shash_desc *desc;
-        unsigned char *digest;
-        char *result = NULL;
-        int ret = -ENOMEM;
-        int i;
-
-        /* hash transform allocation */
         hash_tfm = crypto_alloc_shash("sha256", 0, 0);
         if (IS_ERR(hash_tfm))
         {
                 printk(KERN_ERR "Failed to allocate hash transform\n");
-                return NULL;
+                return PTR_ERR(hash_tfm);
         }
 
-        /* hash descriptor allocation */
-        desc = kmalloc(sizeof(struct shash_desc) + crypto_shash_descsize(hash_tfm), GFP_ATOMIC);
-        if (!desc)
-        {
-                printk(KERN_ERR "Failed to allocate hash descriptor\n");
-                goto out;
-        }
+        return 0;
+}
+
+void hash_clean(void)
+{
+        if (!IS_ERR_OR_NULL(hash_tfm))
+                crypto_free_shash(hash_tfm);
+        hash_tfm = NULL;
+}
+
+/**
+ * @brief SHA256 digest of len bytes of data, the descriptor lives on the stack
+ * @param digest Buffer of PASSW_DIGEST_LEN bytes
+ * @returns 0 on success, a negative error code otherwise
+ */
+int compute_digest(const char *data, size_t len, u8 *digest)
+{
+        SHASH_DESC_ON_STACK(desc, hash_tfm);
+        int ret;
+
         desc->tfm = hash_tfm;
+        ret = crypto_shash_digest(desc, data, len, digest);
+        shash_desc_zero(desc);
 
-        /* digest allocation */
-        digest = kmalloc(32, GFP_ATOMIC);
-        if (!digest)
-        {
-                printk(KERN_ERR "Failed to allocate hash buffer\n");
-                goto out;
-        }
+        return ret;
+}
 
-        /* hash computation */
-        ret = crypto_shash_digest(desc, password, strlen(password), digest);
-        if (ret)
+/**
+ * @brief Password encryption (SHA256)
+ * @param password Password to be encrypted
+ * @returns Encrypted password as an hex string to be freed by the caller, NULL on error
+ */
+char *encrypt_password(const char *password)
+{
+        u8 digest[PASSW_DIGEST_LEN];
+        char *result;
+
+        if (compute_digest(password, strlen(password), digest))
         {
                 printk(KERN_ERR "Failed to calculate hash\n");
-                goto out;
+                return NULL;
         }
 
         /* result allocation */
-        result = kmalloc(2 * 32 + 1, GFP_ATOMIC);
+        result = kmalloc(2 * PASSW_DIGEST_LEN + 1, GFP_ATOMIC);
         if (!result)
         {
                 printk(KERN_ERR "Failed to allocate memory for result\n");
-                goto out;
+                return NULL;
         }
 
-        /* printing result */
-        for (i = 0; i < 32; i++)
-                sprintf(&result[i * 2], "%02x", digest[i]);
-
-out:
-        if (digest)
-                kfree(digest);
-        if (desc)
-                kfree(desc);
-        if (hash_tfm)
-                crypto_free_shash(hash_tfm);
+        bin2hex(result, digest, PASSW_DIGEST_LEN);
+        result[2 * PASSW_DIGEST_LEN] = '\0';
 
         return result;
 }
@@ -95,41 +102,123 @@ int is_rf_rec(struct reference_monitor *rf)
         return 0;
 }
 
-int password_check(char *password, struct reference_monitor *rf)
+// copy a password (or a session token) from user space, always NUL terminated and zero padded
+static int copy_secret(char *kernel_secret, const char __user *secret)
 {
-        char *kernel_password;
-        int ret;
-
-        kernel_password = kmalloc(PASSW_LEN, GFP_KERNEL);
-        if (!kernel_password)
-        {
-                pr_err("%s: [ERROR] Error in kmalloc allocation for kernel password\n", MODNAME);
-                return -ENOMEM;
-        }
+        long ret;
 
+        memset(kernel_secret, 0, PASSW_LEN + 1);
 
         // Use Cross-Ring Data Move to copy password from user to kernel space
-        ret = copy_from_user(kernel_password, (void *)password, PASSW_LEN);
-        if (ret)
+        ret = strncpy_from_user(kernel_secret, secret, PASSW_LEN);
+        if (ret < 0)
         {
                 pr_err("%s: [ERROR] Error while copying password from user address space to kernel address space\n", MODNAME);
-                kfree(kernel_password);
                 return -EAGAIN;
         }
 
+        return 0;
+}
 
-        if (strcmp(rf->password, encrypt_password(kernel_password)) != 0)
+// compare the digest of a kernel copy of the password with the stored one, in constant time
+static int digest_check(const char *kernel_password, struct reference_monitor *rf)
+{
+        u8 digest[PASSW_DIGEST_LEN];
+        int ret;
+
+        ret = compute_digest(kernel_password, strlen(kernel_password), digest);
+        if (ret)
+        {
+                pr_err("%s: [ERROR] Failed to calculate the password hash\n", MODNAME);
+                return ret;
+        }
+
+        ret = crypto_memneq(digest, rf->password_digest, PASSW_DIGEST_LEN);
+        memzero_explicit(digest, PASSW_DIGEST_LEN);
+        if (ret)
         {
                 pr_err("%s: [INFO] Access denied: invalid password\n", MODNAME);
-                kfree(kernel_password);
                 return -EACCES;
         }
 
-        kfree(kernel_password);
-
         return 0;
 }
 
+int password_check(char *password, struct reference_monitor *rf)
+{
+        char kernel_password[PASSW_LEN + 1];
+        int ret;
+
+        ret = copy_secret(kernel_password, password);
+        if (ret)
+                return ret;
+
+        ret = digest_check(kernel_password, rf);
+        memzero_explicit(kernel_password, sizeof(kernel_password));
+
+        return ret;
+}
+
+/**
+ * @brief Open a reconfiguration session: the token (REC_TOKEN_PREFIX followed by random hex digits) replaces
+ *        the password of add/remove calls until it expires or the state of the reference monitor changes
+ * @param token Buffer of REC_TOKEN_LEN bytes receiving the token
+ */
+void rec_session_open(struct reference_monitor *rf, char *token)
+{
+        u8 random[REC_TOKEN_BYTES];
+
+        get_random_bytes(random, sizeof(random));
+        token[0] = REC_TOKEN_PREFIX;
+        bin2hex(token + 1, random, sizeof(random));
+        token[REC_TOKEN_LEN - 1] = '\0';
+        memzero_explicit(random, sizeof(random));
+
+        spin_lock(&rf->lock);
+        memcpy(rf->session_token, token, REC_TOKEN_LEN);
+        rf->session_expires = jiffies + REC_SESSION_SECONDS * HZ;
+        spin_unlock(&rf->lock);
+}
+
+// call with rf->lock held
+void rec_session_close(struct reference_monitor *rf)
+{
+        memzero_explicit(rf->session_token, REC_TOKEN_LEN);
+}
+
+/**
+ * @brief Check the credentials of a reconfiguration call: either the token of the open session or the password
+ *        (which may start with REC_TOKEN_PREFIX too, so it is checked whenever the token does not match)
+ * @returns 0 if the credentials are valid, a negative error code otherwise
+ */
+int rec_credentials_check(char *credentials, struct reference_monitor *rf)
+{
+        char kernel_credentials[PASSW_LEN + 1];
+        int ret, token, session = 0;
+
+        ret = copy_secret(kernel_credentials, credentials);
+        if (ret)
+                return ret;
+
+        token = kernel_credentials[0] == REC_TOKEN_PREFIX;
+        if (token)
+        {
+                spin_lock(&rf->lock);
+                session = rf->session_token[0] == REC_TOKEN_PREFIX && time_before(jiffies, rf->session_expires) &&
+                          !crypto_memneq(kernel_credentials, rf->session_token, REC_TOKEN_LEN);
+                spin_unlock(&rf->lock);
+        }
+
+        if (!session)
+                ret = digest_check(kernel_credentials, rf);
+
+        memzero_explicit(kernel_credentials, sizeof(kernel_credentials));
+        if (ret && token)
+                pr_err("%s: [INFO] Access denied: invalid or expired reconfiguration session\n", MODNAME);
+
+        return ret;
+}
+
 int euid_check(kuid_t euid)
 {
         // check EUID
@@ -2,10 +2,16 @@
 #define UTILS
 
 
+int hash_init(void);
+void hash_clean(void);
+int compute_digest(const char *data, size_t len, u8 *digest);
 char *encrypt_password(const char *password);
 int rf_state_check(int state);
 int is_rf_rec(struct reference_monitor *rf);
 int euid_check(kuid_t euid);
 int password_check(char *password, struct reference_monitor *rf);
+void rec_session_open(struct reference_monitor *rf, char *token);
+void rec_session_close(struct reference_monitor *rf);
+int rec_credentials_check(char *credentials, struct reference_monitor *rf);
 char *get_path_from_dentry(struct dentry *dentry);
 #endif
\ No newline at end of file
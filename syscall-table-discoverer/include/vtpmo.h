@@ -1,3 +1,7 @@
 
 #define NO_MAP (-1)
 
+/* called for each mapped extent [start, end) found by vtpmo_walk_range, a non zero return value stops the walk */
+typedef int (*vtpmo_extent_fn)(unsigned long start, unsigned long end, void *data);
+
+int vtpmo_walk_range(unsigned long start, unsigned long end, vtpmo_extent_fn fn, void *data);
@@ -74,6 +74,11 @@ static inline unsigned long _read_cr3(void) {
 
 #define AUDIT if(0)
 
+#define PML4_SIZE (1UL << 39)
+#define PDP_SIZE  (1UL << 30)
+#define PDE_SIZE  (1UL << 21)
+#define PTE_SIZE  (1UL << 12)
+
 
 
 /* This routine traverses the page table to check 
@@ -128,6 +133,16 @@ int sys_vtpmo(unsigned long vaddr){
 		return NO_MAP;
 	}
 
+	if((ulong)pdp[PDP(target_address)].pud & LH_MAPPING){ 
+		AUDIT
+		printk("%s: PDP region mapped to large page\n",MODNAME);
+		frame_addr = (ulong)(pdp[PDP(target_address)].pud) & PT_ADDRESS_MASK; 
+
+		frame_number = frame_addr >> 12;
+
+		return frame_number;
+	}
+
 	pde = __va((ulong)(pdp[PDP(target_address)].pud) & PT_ADDRESS_MASK);
 	AUDIT
 	printk("%s: PDE traversing on entry %lld\n",MODNAME,PDE(target_address));
@@ -177,3 +192,101 @@ int sys_vtpmo(unsigned long vaddr){
 	
 }
 
+
+
+/* first address of the next region of the given size after addr, or end if it is beyond (or wraps) */
+static inline unsigned long next_region(unsigned long addr, unsigned long size, unsigned long end){
+	unsigned long next = (addr & ~(size - 1)) + size;
+
+	return (next <= addr || next > end) ? end : next;
+}
+
+struct extent {
+	unsigned long start;
+	unsigned long end;
+	vtpmo_extent_fn fn;
+	void *data;
+};
+
+/* extend the pending extent with [start, end), reporting the pending one first if they are not adjacent */
+static int add_extent(struct extent *ext, unsigned long start, unsigned long end){
+	int ret = 0;
+
+	if(ext->end == start && ext->end != ext->start){
+		ext->end = end;
+		return 0;
+	}
+	if(ext->end != ext->start) ret = ext->fn(ext->start, ext->end, ext->data);
+	ext->start = start;
+	ext->end = end;
+	return ret;
+}
+
+/* This routine traverses the page table once for the whole range [start, end), reporting the mapped
+ * extents in increasing order: unmapped PML4/PDP/PDE entries are skipped as a whole, 1 GB and 2 MB
+ * pages are reported as a single extent, adjacent mapped regions are merged. */
+
+int vtpmo_walk_range(unsigned long start, unsigned long end, vtpmo_extent_fn fn, void *data){
+
+	struct extent ext = { .start = 0, .end = 0, .fn = fn, .data = data };
+	pgd_t *pml4;
+	pud_t *pdp;
+	pmd_t *pde;
+	pte_t *pte;
+	unsigned long addr = start & ADDRESS_MASK;
+	unsigned long next;
+	int ret;
+
+	pml4 = PAGE_TABLE_ADDRESS;
+
+	while(addr < end){
+		next = next_region(addr, PML4_SIZE, end);
+		if(!((ulong)(pml4[PML4(addr)].pgd) & VALID)){
+			addr = next;
+			continue;
+		}
+		pdp = __va((ulong)(pml4[PML4(addr)].pgd) & PT_ADDRESS_MASK);
+
+		for(; addr < next; ){
+			unsigned long pdp_next = next_region(addr, PDP_SIZE, next);
+
+			if(!((ulong)(pdp[PDP(addr)].pud) & VALID)){
+				addr = pdp_next;
+				continue;
+			}
+			if((ulong)(pdp[PDP(addr)].pud) & LH_MAPPING){
+				if((ret = add_extent(&ext, addr, pdp_next))) return ret;
+				addr = pdp_next;
+				continue;
+			}
+			pde = __va((ulong)(pdp[PDP(addr)].pud) & PT_ADDRESS_MASK);
+
+			for(; addr < pdp_next; ){
+				unsigned long pde_next = next_region(addr, PDE_SIZE, pdp_next);
+
+				if(!((ulong)(pde[PDE(addr)].pmd) & VALID)){
+					addr = pde_next;
+					continue;
+				}
+				if((ulong)(pde[PDE(addr)].pmd) & LH_MAPPING){
+					if((ret = add_extent(&ext, addr, pde_next))) return ret;
+					addr = pde_next;
+					continue;
+				}
+				pte = __va((ulong)(pde[PDE(addr)].pmd) & PT_ADDRESS_MASK);
+
+				for(; addr < pde_next; addr = next_region(addr, PTE_SIZE, pde_next)){
+					if((ulong)(pte[PTE(addr)].pte) & VALID){
+						if((ret = add_extent(&ext, addr, next_region(addr, PTE_SIZE, pde_next)))) return ret;
+					}
+				}
+			}
+		}
+	}
+
+	// the last pending extent
+	if(ext.end != ext.start) return fn(ext.start, ext.end, data);
+
+	return 0;
+}
+
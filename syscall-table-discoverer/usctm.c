@@ -40,6 +40,8 @@
 #include <asm/cacheflush.h>
 #include <asm/apic.h>
 #include <linux/syscalls.h>
+#include <linux/ktime.h>
+#include <asm/page_64_types.h>
 #include "./include/vtpmo.h"
 
 
@@ -81,6 +83,15 @@ EXPORT_SYMBOL(sys_call_table_address);
 unsigned long sys_ni_syscall_address = 0x0;
 module_param(sys_ni_syscall_address, ulong, 0660);
 
+/* offset of the table from an exported kernel function: KASLR moves the whole image, so it only depends on the build.
+ * Given at load (see discovery_cache.sh) it is checked first, after discovery it holds the offset found. */
+#define KERNEL_ANCHOR ((unsigned long)sprintf)
+unsigned long table_offset = 0x0;
+module_param(table_offset, ulong, 0660);
+
+unsigned long discovery_ns = 0;				// time spent looking for the table, also printed at load
+module_param(discovery_ns, ulong, 0444);
+
 
 int good_area(unsigned long * addr){
 
@@ -100,8 +111,31 @@ bad_area:
 
 
 
-/* This routine checks if the page contains the begin of the syscall_table.  */
-int validate_page(unsigned long *addr){
+/* This routine checks if the syscall table starts at addr (all the entries up to SEVENTH_NI_SYSCALL must be mapped). */
+int is_syscall_table(unsigned long *addr){
+	if(
+		   ( (addr[FIRST_NI_SYSCALL] & 0x3  ) == 0 )		
+		   && (addr[FIRST_NI_SYSCALL] != 0x0 )			// not points to 0x0	
+		   && (addr[FIRST_NI_SYSCALL] > 0xffffffff00000000 )	// not points to a locatio lower than 0xffffffff00000000	
+		&&   ( addr[FIRST_NI_SYSCALL] == addr[SECOND_NI_SYSCALL] )
+		&&   ( addr[FIRST_NI_SYSCALL] == addr[THIRD_NI_SYSCALL]	 )	
+		&&   ( addr[FIRST_NI_SYSCALL] == addr[FOURTH_NI_SYSCALL] )
+		&&   ( addr[FIRST_NI_SYSCALL] == addr[FIFTH_NI_SYSCALL] )	
+		&&   ( addr[FIRST_NI_SYSCALL] == addr[SIXTH_NI_SYSCALL] )
+		&&   ( addr[FIRST_NI_SYSCALL] == addr[SEVENTH_NI_SYSCALL] )	
+		&&   (good_area(addr))
+	){
+		hacked_ni_syscall = (void*)(addr[FIRST_NI_SYSCALL]);				// save ni_syscall
+		sys_ni_syscall_address = (unsigned long)hacked_ni_syscall;
+		hacked_syscall_tbl = (void*)(addr);				// save syscall_table address
+		sys_call_table_address = (unsigned long) hacked_syscall_tbl;
+		return 1;
+	}
+	return 0;
+}
+
+/* This routine checks if the page contains the begin of the syscall_table, next_mapped tells if the following page is mapped.  */
+int validate_page(unsigned long *addr, int next_mapped){
 	int i = 0;
 	unsigned long page 	= (unsigned long) addr;
 	unsigned long new_page 	= (unsigned long) addr;
@@ -111,53 +145,88 @@ int validate_page(unsigned long *addr){
 		// If the table occupies 2 pages check if the second one is materialized in a frame
 		if( 
 			( (page+PAGE_SIZE) == (new_page & ADDRESS_MASK) )
-			&& sys_vtpmo(new_page) == NO_MAP
+			&& !next_mapped
 		) 
 			break;
 		// go for patter matching
-		addr = (unsigned long*) (page+i);
-		if(
-			   ( (addr[FIRST_NI_SYSCALL] & 0x3  ) == 0 )		
-			   && (addr[FIRST_NI_SYSCALL] != 0x0 )			// not points to 0x0	
-			   && (addr[FIRST_NI_SYSCALL] > 0xffffffff00000000 )	// not points to a locatio lower than 0xffffffff00000000	
-	//&& ( (addr[FIRST_NI_SYSCALL] & START) == START ) 	
-			&&   ( addr[FIRST_NI_SYSCALL] == addr[SECOND_NI_SYSCALL] )
-			&&   ( addr[FIRST_NI_SYSCALL] == addr[THIRD_NI_SYSCALL]	 )	
-			&&   ( addr[FIRST_NI_SYSCALL] == addr[FOURTH_NI_SYSCALL] )
-			&&   ( addr[FIRST_NI_SYSCALL] == addr[FIFTH_NI_SYSCALL] )	
-			&&   ( addr[FIRST_NI_SYSCALL] == addr[SIXTH_NI_SYSCALL] )
-			&&   ( addr[FIRST_NI_SYSCALL] == addr[SEVENTH_NI_SYSCALL] )	
-			&&   (good_area(addr))
-		){
-			hacked_ni_syscall = (void*)(addr[FIRST_NI_SYSCALL]);				// save ni_syscall
-			sys_ni_syscall_address = (unsigned long)hacked_ni_syscall;
-			hacked_syscall_tbl = (void*)(addr);				// save syscall_table address
-			sys_call_table_address = (unsigned long) hacked_syscall_tbl;
-			return 1;
-		}
+		if(is_syscall_table((unsigned long*) (page+i))) return 1;
 	}
 	return 0;
 }
 
-/* This routines looks for the syscall table.  */
-void syscall_table_finder(void){
+/* This routine looks for the syscall table in the pages of a mapped extent (extents are maximal: the page after end is not mapped).  */
+int scan_extent(unsigned long start, unsigned long end, void *data){
 	unsigned long k; // current page
-	unsigned long candidate; // current page
-
-	for(k=START; k < MAX_ADDR; k+=4096){	
-		candidate = k;
-		if(
-			(sys_vtpmo(candidate) != NO_MAP) 	
-		){
-			// check if candidate maintains the syscall_table
-			if(validate_page( (unsigned long *)(candidate)) ){
-				printk("%s: syscall table found at 0x%px\n",MODNAME,(void*)(hacked_syscall_tbl));
-				printk("%s: sys_ni_syscall found at 0x%px\n",MODNAME,(void*)(hacked_ni_syscall));
-				break;
-			}
-		}
+
+	for(k=start; k < end; k+=4096){	
+		// check if candidate maintains the syscall_table
+		if(validate_page( (unsigned long *)(k), k+PAGE_SIZE < end) ) return 1;
 	}
-	
+	return 0;
+}
+
+/* This routine looks for the syscall table in the mapped pages of [start, end), the page tables are walked once.  */
+int scan_range(unsigned long start, unsigned long end){
+	return vtpmo_walk_range(start, end, scan_extent, NULL) == 1;
+}
+
+/* kallsyms_lookup_name is not exported since 5.7: its address is read from a kprobe placed on it.  */
+unsigned long lookup_name(const char *name){
+#ifdef CONFIG_KPROBES
+	typedef unsigned long (*kallsyms_lookup_name_t)(const char *name);
+	static kallsyms_lookup_name_t kallsyms_lookup;
+	struct kprobe kp = { .symbol_name = "kallsyms_lookup_name" };
+
+	if(!kallsyms_lookup){
+		if(register_kprobe(&kp) < 0) return 0;
+		kallsyms_lookup = (kallsyms_lookup_name_t)kp.addr;
+		unregister_kprobe(&kp);
+	}
+	return kallsyms_lookup ? kallsyms_lookup(name) : 0;
+#else
+	return 0;
+#endif
+}
+
+/* This routine checks a candidate address of the table given by a symbol or by the cache.  */
+int check_candidate(unsigned long addr){
+	return addr && sys_vtpmo(addr) != NO_MAP && sys_vtpmo(addr+SEVENTH_NI_SYSCALL*sizeof(void*)) != NO_MAP
+	       && is_syscall_table((unsigned long *)addr);
+}
+
+/*
+ * This routines looks for the syscall table, from the cheapest strategy to the full scan:
+ * the cached offset, the sys_call_table symbol, the rodata section (kallsyms), the mapping of the kernel image,
+ * [START, MAX_ADDR). Every candidate goes through the same pattern matching.
+ */
+const char *syscall_table_finder(void){
+	unsigned long addr, start, end;
+
+	if(table_offset && check_candidate(KERNEL_ANCHOR + table_offset))
+		return "cached offset";
+
+	addr = lookup_name("sys_call_table");
+	if(check_candidate(addr))
+		return "kallsyms";
+
+	// the table is read only data
+	start = lookup_name("__start_rodata");
+	end = lookup_name("__end_rodata");
+	if(!start || !end){
+		start = lookup_name("_stext");
+		end = lookup_name("_end");
+	}
+	if(start && end > start && scan_range(start, end))
+		return "kernel rodata scan";
+
+	// the kernel image is mapped at __START_KERNEL_map, wherever KASLR places it in physical memory
+	if(scan_range(__START_KERNEL_map, __START_KERNEL_map + KERNEL_IMAGE_SIZE))
+		return "kernel image scan";
+
+	if(scan_range(START, MAX_ADDR))
+		return "full scan";
+
+	return NULL;
 }
 
 
@@ -169,16 +238,24 @@ module_param_array(free_entries,int,NULL,0660);//default array size already know
 int init_module(void) {
 	
 	int i,j;
+	const char *method;
+	u64 begin;
 		
     printk("%s: initializing\n",MODNAME);
 	
-	syscall_table_finder();
+	begin = ktime_get_ns();
+	method = syscall_table_finder();
+	discovery_ns = ktime_get_ns() - begin;
 
 	if(!hacked_syscall_tbl){
-		printk("%s: failed to find the sys_call_table\n",MODNAME);
+		printk("%s: failed to find the sys_call_table (%lu us)\n",MODNAME,discovery_ns/1000);
 		return -1;
 	}
 
+	printk("%s: syscall table found at 0x%px by %s in %lu us\n",MODNAME,(void*)(hacked_syscall_tbl),method,discovery_ns/1000);
+	printk("%s: sys_ni_syscall found at 0x%px\n",MODNAME,(void*)(hacked_ni_syscall));
+	table_offset = sys_call_table_address - KERNEL_ANCHOR;
+
 	j=0;
 	for(i=0;i<ENTRIES_TO_EXPLORE;i++)
 		if(hacked_syscall_tbl[i] == hacked_ni_syscall){